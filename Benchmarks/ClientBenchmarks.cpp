@@ -0,0 +1,205 @@
+/*
+ * Microbenchmarks of the client primitives, built on Google Benchmark.
+ * Every benchmark reports throughput (bytes_per_second) and heap allocations per call (allocs_per_call),
+ * run with --benchmark_format=json or --benchmark_out=<file> for results that compare across releases and hosts.
+ *
+ * Build with the client sources except main.cpp, for example:
+ *   g++ -std=c++20 -O2 -IClient Benchmarks/ClientBenchmarks.cpp Client/AESWrapper.cpp Client/WorkerPool.cpp Client/RSAWrapper.cpp
+ *       Client/Base64.cpp Client/Crc32.cpp Client/Endianess.cpp -lbenchmark -lcryptopp -lpthread
+ */
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include "AESWrapper.h"
+#include "RSAWrapper.h"
+#include "Base64.h"
+#include "Crc32.h"
+#include "Endianess.h"
+
+// Count heap allocations of the whole process, the benchmarks are single threaded so the count is of the measured code
+static std::atomic<size_t> g_allocations = 0;
+
+void* operator new(size_t size)
+{
+	++g_allocations;
+	if (void* p = std::malloc(size == 0 ? 1 : size))
+	{
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+// Input sizes of the buffer benchmarks: 1 KB, 1 MB and 1 GB
+#define BUFFER_SIZES ->Arg(1 << 10)->Arg(1 << 20)->Arg(1 << 30)->Unit(benchmark::kMicrosecond)
+
+static const uint8_t KEY[AES_KEY_SIZE] = { 0 };
+
+static std::vector<uint8_t> Input(size_t size)
+{
+	std::vector<uint8_t> input(size);
+	for (size_t i = 0; i < size; ++i)
+	{
+		input[i] = static_cast<uint8_t>(i * 131 + 7);
+	}
+	return input;
+}
+
+// Measure allocations from here to the end of the benchmark loop, and the bytes of bytesPerCall input on every call
+class Counters
+{
+	benchmark::State& m_state;
+	size_t m_bytesPerCall;
+	size_t m_allocations;
+
+public:
+	Counters(benchmark::State& state, size_t bytesPerCall) : m_state(state), m_bytesPerCall(bytesPerCall), m_allocations(g_allocations) {}
+	~Counters()
+	{
+		m_state.SetBytesProcessed(static_cast<int64_t>(m_state.iterations() * m_bytesPerCall));
+		m_state.counters["allocs_per_call"] = benchmark::Counter(static_cast<double>(g_allocations - m_allocations), benchmark::Counter::kAvgIterations);
+	}
+};
+
+static void BM_AesEncrypt(benchmark::State& state)
+{
+	const AESWrapper aes(KEY, sizeof(KEY));
+	const auto plain = Input(state.range(0));
+	std::vector<uint8_t> cipher(AESWrapper::CipherSize(plain.size()));
+	Counters counters(state, plain.size());
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(aes.Encrypt(plain.data(), plain.size(), cipher.data(), cipher.size()));
+	}
+}
+BENCHMARK(BM_AesEncrypt) BUFFER_SIZES;
+
+static void BM_AesDecrypt(benchmark::State& state)
+{
+	const AESWrapper aes(KEY, sizeof(KEY));
+	const auto plain = Input(state.range(0));
+	const auto cipher = aes.Encrypt(plain.data(), plain.size());
+	Counters counters(state, cipher.size());
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(aes.Decrypt(reinterpret_cast<const uint8_t*>(cipher.data()), cipher.size()));
+	}
+}
+BENCHMARK(BM_AesDecrypt) BUFFER_SIZES;
+
+static void BM_RsaKeyGeneration(benchmark::State& state)
+{
+	Counters counters(state, 0);
+	for (auto _ : state)
+	{
+		RSAPrivateWrapper rsa(static_cast<size_t>(state.range(0)));
+		benchmark::DoNotOptimize(&rsa);
+	}
+}
+BENCHMARK(BM_RsaKeyGeneration)->Arg(1024)->Arg(2048)->Arg(3072)->Unit(benchmark::kMillisecond);
+
+// Decrypt of an encrypted AES key, the only RSA decrypt of the protocol
+static void BM_RsaDecrypt(benchmark::State& state)
+{
+	RSAPrivateWrapper rsa(static_cast<size_t>(state.range(0)));
+	CryptoPP::AutoSeededRandomPool rng;
+	CryptoPP::RSA::PublicKey publicKey;
+	CryptoPP::StringSource keySource(rsa.getPublicKey(), true);
+	publicKey.Load(keySource);
+	std::string cipher;
+	CryptoPP::RSAES_OAEP_SHA_Encryptor encryptor(publicKey);
+	CryptoPP::StringSource ss(KEY, sizeof(KEY), true, new CryptoPP::PK_EncryptorFilter(rng, encryptor, new CryptoPP::StringSink(cipher)));
+
+	Counters counters(state, cipher.size());
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(rsa.decrypt(reinterpret_cast<const uint8_t*>(cipher.data()), cipher.size()));
+	}
+}
+BENCHMARK(BM_RsaDecrypt)->Arg(1024)->Arg(2048)->Arg(3072)->Unit(benchmark::kMicrosecond);
+
+static void BM_Base64Encode(benchmark::State& state)
+{
+	const auto bytes = Input(state.range(0));
+	Counters counters(state, bytes.size());
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(Base64::Encode(bytes.data(), bytes.size()));
+	}
+}
+BENCHMARK(BM_Base64Encode) BUFFER_SIZES;
+
+static void BM_Base64Decode(benchmark::State& state)
+{
+	const auto bytes = Input(state.range(0));
+	const auto encoded = Base64::Encode(bytes.data(), bytes.size());
+	Counters counters(state, encoded.size());
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(Base64::Decode(encoded));
+	}
+}
+BENCHMARK(BM_Base64Decode) BUFFER_SIZES;
+
+// span overloads into buffers of the caller, the allocations counter should stay 0
+static void BM_Base64EncodeSpan(benchmark::State& state)
+{
+	const auto bytes = Input(state.range(0));
+	std::vector<char> encoded(Base64::EncodedSize(bytes.size()));
+	Counters counters(state, bytes.size());
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(Base64::Encode(bytes, encoded));
+	}
+}
+BENCHMARK(BM_Base64EncodeSpan) BUFFER_SIZES;
+
+static void BM_Base64DecodeSpan(benchmark::State& state)
+{
+	const auto bytes = Input(state.range(0));
+	const auto encoded = Base64::Encode(bytes.data(), bytes.size());
+	std::vector<uint8_t> decoded(Base64::MaxDecodedSize(encoded.size()));
+	Counters counters(state, encoded.size());
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(Base64::Decode(encoded, decoded));
+	}
+}
+BENCHMARK(BM_Base64DecodeSpan) BUFFER_SIZES;
+
+static void BM_Crc32(benchmark::State& state)
+{
+	const auto bytes = Input(state.range(0));
+	Counters counters(state, bytes.size());
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(Crc32::Calculate(bytes.data(), bytes.size()));
+	}
+}
+BENCHMARK(BM_Crc32) BUFFER_SIZES;
+
+static void BM_EndianessSwap(benchmark::State& state)
+{
+	auto bytes = Input(state.range(0));
+	Counters counters(state, bytes.size());
+	for (auto _ : state)
+	{
+		Endianess::Swap(bytes.data(), bytes.size());
+		benchmark::ClobberMemory();
+	}
+}
+BENCHMARK(BM_EndianessSwap) BUFFER_SIZES;
+
+BENCHMARK_MAIN();
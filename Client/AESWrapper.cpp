@@ -1,13 +1,76 @@
 #include "AESWrapper.h"
-#include <modes.h>
-#include <aes.h>
-#include <filters.h>
+#include "WorkerPool.h"
+#include <gcm.h>
 #include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
 #include <immintrin.h>	// _rdrand32_step
 
+static const CryptoPP::byte ZERO_IV[CryptoPP::AES::BLOCKSIZE] = { 0 };	// for practical use iv should never be a fixed value!
+static std::atomic<uint64_t> nextWrapperId{ 1 };
 
-AESWrapper::AESWrapper(const uint8_t* symmetricKey, size_t symmetricKeySize) : m_symmetricKey(symmetricKey), m_symmetricKeySize(symmetricKeySize)
+// GCM of the calling thread with the expanded key and GHASH tables of one wrapper, a GCM object can't be shared while it encrypts
+struct ThreadGcm
 {
+	uint64_t wrapperId = 0;
+	CryptoPP::GCM<CryptoPP::AES>::Encryption gcm;
+};
+static thread_local ThreadGcm threadGcm;
+
+AESWrapper::Encryptor::Encryptor(const CryptoPP::AES::Encryption& aes) : m_aes(aes), m_cbc(m_aes, ZERO_IV)
+{
+}
+
+size_t AESWrapper::Encryptor::Update(const uint8_t* plain, size_t length, uint8_t* cipher)
+{
+	size_t written = 0;
+	if (m_pendingSize > 0)
+	{
+		const size_t fill = std::min(BLOCK_SIZE - m_pendingSize, length);
+		memcpy(m_pending + m_pendingSize, plain, fill);
+		m_pendingSize += fill;
+		plain += fill;
+		length -= fill;
+		if (m_pendingSize < BLOCK_SIZE)
+		{
+			return 0;
+		}
+		m_cbc.ProcessData(cipher, m_pending, BLOCK_SIZE);
+		m_pendingSize = 0;
+		written += BLOCK_SIZE;
+	}
+
+	// whole blocks in one call so Crypto++ can process many blocks at once (AES-NI when available), in place if cipher is plain
+	const size_t blocksSize = length - (length % BLOCK_SIZE);
+	if (blocksSize > 0)
+	{
+		m_cbc.ProcessData(cipher + written, plain, blocksSize);
+		written += blocksSize;
+	}
+
+	m_pendingSize = length - blocksSize;
+	memcpy(m_pending, plain + blocksSize, m_pendingSize);
+	return written;
+}
+
+size_t AESWrapper::Encryptor::Final(uint8_t* cipher)
+{
+	const uint8_t padding = static_cast<uint8_t>(BLOCK_SIZE - m_pendingSize); // PKCS#7, a whole block of padding if nothing is pending
+	memset(m_pending + m_pendingSize, padding, padding);
+	m_cbc.ProcessData(cipher, m_pending, BLOCK_SIZE);
+	m_pendingSize = 0;
+	return BLOCK_SIZE;
+}
+
+AESWrapper::AESWrapper(const uint8_t* symmetricKey, size_t symmetricKeySize) : m_symmetricKey(symmetricKey, symmetricKeySize), m_id(nextWrapperId++),
+	m_aesEncryption(m_symmetricKey.data(), m_symmetricKey.size()), m_aesDecryption(m_symmetricKey.data(), m_symmetricKey.size())
+{
+}
+
+AESWrapper::Encryptor AESWrapper::CreateEncryptor() const
+{
+	return Encryptor(m_aesEncryption);
 }
 
 std::string AESWrapper::Encrypt(const std::string& plain) const
@@ -17,30 +80,78 @@ std::string AESWrapper::Encrypt(const std::string& plain) const
 
 std::string AESWrapper::Encrypt(const uint8_t* text, size_t length) const
 {
-	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 };	// for practical use iv should never be a fixed value!
+	std::string cipher(CipherSize(length), '\0');
+	Encrypt(text, length, reinterpret_cast<uint8_t*>(cipher.data()), cipher.size());
+	return cipher;
+}
 
-	CryptoPP::AES::Encryption aesEncryption(m_symmetricKey, m_symmetricKeySize);
-	CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption(aesEncryption, iv);
+size_t AESWrapper::Encrypt(const uint8_t* plain, size_t length, uint8_t* cipher, size_t cipherCapacity) const
+{
+	if (cipherCapacity < CipherSize(length))
+	{
+		throw std::invalid_argument("Cipher buffer of " + std::to_string(cipherCapacity) + " bytes is too small for " + std::to_string(length) + " plain bytes");
+	}
 
-	std::string cipher;
-	CryptoPP::StreamTransformationFilter stfEncryptor(cbcEncryption, new CryptoPP::StringSink(cipher));
-	stfEncryptor.Put(text, length);
-	stfEncryptor.MessageEnd();
+	Encryptor encryptor(m_aesEncryption);
+	const size_t written = encryptor.Update(plain, length, cipher);
+	return written + encryptor.Final(cipher + written);
+}
 
-	return cipher;
+size_t AESWrapper::EncryptInPlace(uint8_t* buffer, size_t length, size_t capacity) const
+{
+	return Encrypt(buffer, length, buffer, capacity);
 }
 
 std::string AESWrapper::Decrypt(const uint8_t* cipher, size_t length) const
 {
-	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 };	// for practical use iv should never be a fixed value!
+	if (length == 0 || length % BLOCK_SIZE != 0)
+	{
+		throw std::invalid_argument("Cipher size " + std::to_string(length) + " is not a multiple of the block size");
+	}
 
-	CryptoPP::AES::Decryption aesDecryption(m_symmetricKey, m_symmetricKeySize);
-	CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, iv);
+	CryptoPP::AES::Decryption aesDecryption(m_aesDecryption);
+	CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, ZERO_IV);
 
-	std::string decrypted;
-	CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, new CryptoPP::StringSink(decrypted));
-	stfDecryptor.Put(cipher, length);
-	stfDecryptor.MessageEnd();
+	std::string decrypted(length, '\0');
+	cbcDecryption.ProcessData(reinterpret_cast<CryptoPP::byte*>(decrypted.data()), cipher, length);
 
+	const uint8_t padding = static_cast<uint8_t>(decrypted.back());
+	if (padding == 0 || padding > BLOCK_SIZE || std::any_of(decrypted.end() - padding, decrypted.end(), [padding](char c) { return static_cast<uint8_t>(c) != padding; }))
+	{
+		throw std::runtime_error("Invalid padding in decrypted data");
+	}
+	decrypted.resize(length - padding);
 	return decrypted;
 }
+
+// Nonce of a segment, the file nonce with its last 8 bytes xor the big endian segment index
+void AESWrapper::SegmentNonce(const uint8_t* fileNonce, uint64_t segment, uint8_t* segmentNonce)
+{
+	memcpy(segmentNonce, fileNonce, CIPHER_NONCE_SIZE);
+	for (size_t i = 0; i < sizeof(segment); ++i)
+	{
+		segmentNonce[CIPHER_NONCE_SIZE - 1 - i] ^= static_cast<uint8_t>(segment >> (8 * i));
+	}
+}
+
+size_t AESWrapper::EncryptSegments(const uint8_t* plain, size_t length, uint64_t firstSegment, const uint8_t* fileNonce, uint8_t* cipher) const
+{
+	const size_t segments = (length + CIPHER_SEGMENT_SIZE - 1) / CIPHER_SEGMENT_SIZE;
+	WorkerPool::Shared().ParallelFor(segments, [&](size_t i)
+		{
+			const size_t plainOffset = i * CIPHER_SEGMENT_SIZE;
+			const size_t segmentSize = std::min(CIPHER_SEGMENT_SIZE, length - plainOffset);
+			uint8_t* segmentCipher = cipher + plainOffset + i * CIPHER_TAG_SIZE;
+
+			uint8_t nonce[CIPHER_NONCE_SIZE];
+			SegmentNonce(fileNonce, firstSegment + i, nonce);
+			if (threadGcm.wrapperId != m_id) // the key is expanded once per thread, each segment only resynchronizes to its nonce
+			{
+				threadGcm.gcm.SetKeyWithIV(m_symmetricKey.data(), m_symmetricKey.size(), nonce, sizeof(nonce));
+				threadGcm.wrapperId = m_id;
+			}
+			threadGcm.gcm.EncryptAndAuthenticate(segmentCipher, segmentCipher + segmentSize, CIPHER_TAG_SIZE, nonce, sizeof(nonce), nullptr, 0, plain + plainOffset, segmentSize);
+		});
+
+	return SegmentedCipherSize(length);
+}
@@ -1,17 +1,69 @@
 #pragma once
 #include <string>
+#include <cstdint>
 #include <boost/noncopyable.hpp>
+#include <modes.h>
+#include <aes.h>
+#include <secblock.h>
+#include "Protocol.h"
 
 class AESWrapper : boost::noncopyable
 {
-	const uint8_t* m_symmetricKey;
-	size_t m_symmetricKeySize;
+	CryptoPP::SecByteBlock m_symmetricKey; // zeroed on destruction
+	const uint64_t m_id;                   // tells the per thread GCM keys of wrappers apart, unlike an address it's never reused
+	// Key schedules expanded once and only copied. Crypto++ ciphers may write to an internal workspace while they process
+	// blocks, so each call works on its own copy, which costs a copy of the round keys and not their expansion.
+	CryptoPP::AES::Encryption m_aesEncryption;
+	CryptoPP::AES::Decryption m_aesDecryption;
 
 public:
-	AESWrapper(const uint8_t* symmetricKey, size_t symmetricKeySize); // symmetricKey allocate outside therefor dont free in the destructor
+	constexpr static size_t BLOCK_SIZE = CryptoPP::AES::BLOCKSIZE;
+
+	/*
+	 * Incremental AES-CBC encryption with PKCS#7 padding, the same cipher as Encrypt.
+	 * Update encrypts the whole blocks of its input straight to the caller's buffer and keeps the remainder for the next call,
+	 * Final pads and encrypts the remainder. Memory use doesn't depend on the plain size.
+	 * It has its own copy of the key schedule of the AESWrapper that created it, and is used by one thread at a time.
+	 */
+	class Encryptor : boost::noncopyable
+	{
+		CryptoPP::AES::Encryption m_aes;
+		CryptoPP::CBC_Mode_ExternalCipher::Encryption m_cbc;
+		uint8_t m_pending[BLOCK_SIZE];
+		size_t m_pendingSize = 0;
+
+	public:
+		explicit Encryptor(const CryptoPP::AES::Encryption& aes);
+
+		static size_t MaxUpdateSize(size_t length) { return length + BLOCK_SIZE; } // output bytes Update may write for length input bytes
+
+		// Return bytes written to cipher, cipher may be plain itself while nothing is pending (all updates so far were whole blocks)
+		size_t Update(const uint8_t* plain, size_t length, uint8_t* cipher);
+		size_t Final(uint8_t* cipher);                                       // write exactly BLOCK_SIZE bytes, return BLOCK_SIZE
+	};
+
+	AESWrapper(const uint8_t* symmetricKey, size_t symmetricKeySize); // copies symmetricKey, the caller's buffer may be freed and should be wiped
 	virtual ~AESWrapper() = default;
-	
+
+	const uint8_t* Key() const { return m_symmetricKey.data(); }
+	size_t KeySize() const { return m_symmetricKey.size(); }
+
+	static size_t CipherSize(size_t plainLength) { return (plainLength / BLOCK_SIZE + 1) * BLOCK_SIZE; }
+	static size_t SegmentedCipherSize(size_t plainLength) { return plainLength + ((plainLength + CIPHER_SEGMENT_SIZE - 1) / CIPHER_SEGMENT_SIZE) * CIPHER_TAG_SIZE; }
+	static void SegmentNonce(const uint8_t* fileNonce, uint64_t segment, uint8_t* segmentNonce);
+
+	Encryptor CreateEncryptor() const;
 	std::string Encrypt(const std::string& plain) const;
 	std::string Encrypt(const uint8_t* plain,  size_t length) const;
+	size_t Encrypt(const uint8_t* plain, size_t length, uint8_t* cipher, size_t cipherCapacity) const; // to a pre-sized buffer, return cipher size
+	size_t EncryptInPlace(uint8_t* buffer, size_t length, size_t capacity) const;                      // buffer holds the plain and then the cipher
 	std::string Decrypt(const uint8_t* cipher, size_t length) const;
+
+	/*
+	 * CIPHER_AES_GCM_SEGMENTS, split plain to segments of CIPHER_SEGMENT_SIZE and write each AES-GCM encrypted and followed by its tag.
+	 * Segments are independent so they are encrypted in parallel on the shared WorkerPool, each thread keeps a GCM keyed once for
+	 * the wrapper it last encrypted for and only sets the nonce of a segment. firstSegment is the index of the first
+	 * segment in the file, it makes the segment nonces unique in the file. Return the cipher size, cipher must hold SegmentedCipherSize.
+	 */
+	size_t EncryptSegments(const uint8_t* plain, size_t length, uint64_t firstSegment, const uint8_t* fileNonce, uint8_t* cipher) const;
 };
@@ -1,105 +1,301 @@
 #include "Base64.h"
+#include <array>
+#include <stdexcept>
 
-const std::string Base64::BASE64_CHARS = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BASE64_X86 1
+#include <immintrin.h>
+#include <cpu.h>
+#endif
 
-bool Base64::isBase64Letter(unsigned char c) 
+// GCC and Clang compile intrinsics of an instruction set only in functions that target it, MSVC always does
+#if defined(__GNUC__)
+#define BASE64_TARGET(isa) __attribute__((target(isa)))
+#else
+#define BASE64_TARGET(isa)
+#endif
+
+static constexpr char ENCODE_TABLE[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static constexpr uint8_t INVALID = 0xFF;
+
+// 6 bit value of every character, INVALID for characters outside the alphabet
+static constexpr auto DECODE_TABLE = []()
+{
+	std::array<uint8_t, 256> table{};
+	table.fill(INVALID);
+	for (uint8_t i = 0; i < 64; ++i)
+	{
+		table[static_cast<uint8_t>(ENCODE_TABLE[i])] = i;
+	}
+	return table;
+}();
+
+#ifdef BASE64_X86
+
+/*
+ * The vector code is of Wojciech Mula and Daniel Lemire, "Faster Base64 Encoding and Decoding using AVX2 Instructions".
+ * Encode splits each 3 bytes to four 6 bit values with a shuffle and two multiplies and maps them to characters with a shuffle.
+ * Decode maps characters to values by ranges, any character out of the ranges stops the vector loop, and packs with two multiply-adds.
+ */
+
+BASE64_TARGET("ssse3") static inline __m128i EncodeValues(__m128i in)
+{
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	const __m128i high = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+	const __m128i low = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+	const __m128i values = _mm_or_si128(high, low);
+
+	// offset of each value's range: 0-25 'A', 26-51 'a' - 26, 52-61 '0' - 52, 62 '+' - 62, 63 '/' - 63
+	__m128i range = _mm_subs_epu8(values, _mm_set1_epi8(51));
+	range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), values), _mm_set1_epi8(13)));
+	const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	return _mm_add_epi8(values, _mm_shuffle_epi8(offsets, range));
+}
+
+BASE64_TARGET("avx2") static inline __m256i EncodeValues(__m256i in)
+{
+	in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+	const __m256i high = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+	const __m256i low = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+	const __m256i values = _mm256_or_si256(high, low);
+
+	__m256i range = _mm256_subs_epu8(values, _mm256_set1_epi8(51));
+	range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), values), _mm256_set1_epi8(13)));
+	const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	return _mm256_add_epi8(values, _mm256_shuffle_epi8(offsets, range));
+}
+
+// Encode blocks of 12 bytes to 16 characters, every load reads 16 bytes. Return bytes encoded
+BASE64_TARGET("ssse3") static size_t EncodeSsse3(const uint8_t* bytes, size_t len, char* base64)
+{
+	size_t done = 0;
+	for (; done + 16 <= len; done += 12, base64 += 16)
+	{
+		const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + done));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(base64), EncodeValues(in));
+	}
+	return done;
+}
+
+// Encode blocks of 24 bytes to 32 characters, 12 bytes in each 128 bit lane. Return bytes encoded
+BASE64_TARGET("avx2") static size_t EncodeAvx2(const uint8_t* bytes, size_t len, char* base64)
+{
+	size_t done = 0;
+	for (; done + 28 <= len; done += 24, base64 += 32)
+	{
+		const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + done));
+		const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + done + 12));
+		const __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(base64), EncodeValues(in));
+	}
+	return done;
+}
+
+// All ones in the bytes of characters from first to last, the compares are signed so characters above 127 are never in
+BASE64_TARGET("ssse3") static inline __m128i Between(__m128i in, char first, char last)
+{
+	return _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8(first - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8(last + 1)));
+}
+
+BASE64_TARGET("avx2") static inline __m256i Between(__m256i in, char first, char last)
+{
+	return _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8(first - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(last + 1), in));
+}
+
+// 6 bit values of 16 characters, false if any is outside the alphabet
+BASE64_TARGET("ssse3") static inline bool DecodeValues(__m128i in, __m128i& values)
+{
+	const __m128i upper = Between(in, 'A', 'Z');
+	const __m128i lower = Between(in, 'a', 'z');
+	const __m128i digit = Between(in, '0', '9');
+	const __m128i plus = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+	const __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+	const __m128i valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), digit), _mm_or_si128(plus, slash));
+	if (_mm_movemask_epi8(valid) != 0xFFFF)
+	{
+		return false;
+	}
+
+	__m128i offset = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+	offset = _mm_or_si128(offset, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+	offset = _mm_or_si128(offset, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+	offset = _mm_or_si128(offset, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+	offset = _mm_or_si128(offset, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+	values = _mm_add_epi8(in, offset);
+	return true;
+}
+
+BASE64_TARGET("avx2") static inline bool DecodeValues(__m256i in, __m256i& values)
+{
+	const __m256i upper = Between(in, 'A', 'Z');
+	const __m256i lower = Between(in, 'a', 'z');
+	const __m256i digit = Between(in, '0', '9');
+	const __m256i plus = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('+'));
+	const __m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+	const __m256i valid = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(upper, lower), digit), _mm256_or_si256(plus, slash));
+	if (_mm256_movemask_epi8(valid) != -1)
+	{
+		return false;
+	}
+
+	__m256i offset = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')));
+	values = _mm256_add_epi8(in, offset);
+	return true;
+}
+
+// Decode blocks of 16 characters to 12 bytes, every store writes 16 bytes. Return characters decoded
+BASE64_TARGET("ssse3") static size_t DecodeSsse3(const char* base64, size_t len, uint8_t* bytes, size_t capacity)
+{
+	size_t done = 0;
+	size_t written = 0;
+	__m128i values;
+	for (; done + 16 <= len && written + 16 <= capacity; done += 16, written += 12)
+	{
+		if (!DecodeValues(_mm_loadu_si128(reinterpret_cast<const __m128i*>(base64 + done)), values))
+		{
+			break;
+		}
+		const __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+		const __m128i triples = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+		const __m128i packed = _mm_shuffle_epi8(triples, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(bytes + written), packed);
+	}
+	return done;
+}
+
+// Decode blocks of 32 characters to 24 bytes, every store writes 32 bytes. Return characters decoded
+BASE64_TARGET("avx2") static size_t DecodeAvx2(const char* base64, size_t len, uint8_t* bytes, size_t capacity)
 {
-    return (isalnum(c) || (c == '+') || (c == '/'));
+	size_t done = 0;
+	size_t written = 0;
+	__m256i values;
+	for (; done + 32 <= len && written + 32 <= capacity; done += 32, written += 24)
+	{
+		if (!DecodeValues(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(base64 + done)), values))
+		{
+			break;
+		}
+		const __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+		const __m256i triples = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+		const __m256i lanes = _mm256_shuffle_epi8(triples, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		const __m256i packed = _mm256_permutevar8x32_epi32(lanes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(bytes + written), packed);
+	}
+	return done;
 }
 
-std::string Base64::Encode(const std::string& bytes) 
+static const bool HAS_AVX2 = CryptoPP::HasAVX2();
+static const bool HAS_SSSE3 = CryptoPP::HasSSSE3();
+
+#endif
+
+std::string Base64::Encode(const std::string& bytes)
 {
-    // base 64 encoder, get string and encode it to base64 and present as string
-    auto len = bytes.size();
-    auto bytesArr = reinterpret_cast<const uint8_t*>(bytes.c_str());
-    return Encode(bytesArr, len);
+	return Encode(reinterpret_cast<const uint8_t*>(bytes.c_str()), bytes.size());
 }
 
 std::string Base64::Encode(const uint8_t* bytes, size_t len)
 {
-    // base 64 encoder, get array of bytes encode them to base64 and present as string
-    std::string base64Str;
-    int i = 0;
-    int j = 0;
-    uint8_t arrOf3[3];
-    uint8_t arrOf4[4];
-
-    while (len--)
-    {
-        arrOf3[i++] = *(bytes++);
-        if (i == 3) {
-            arrOf4[0] = (arrOf3[0] & 0xfc) >> 2;
-            arrOf4[1] = ((arrOf3[0] & 0x03) << 4) + ((arrOf3[1] & 0xf0) >> 4);
-            arrOf4[2] = ((arrOf3[1] & 0x0f) << 2) + ((arrOf3[2] & 0xc0) >> 6);
-            arrOf4[3] = arrOf3[2] & 0x3f;
-
-            for (i = 0; (i < 4); i++)
-                base64Str += BASE64_CHARS[arrOf4[i]];
-            i = 0;
-        }
-    }
-
-    if (i)
-    {
-        for (j = i; j < 3; j++)
-            arrOf3[j] = '\0';
-
-        arrOf4[0] = (arrOf3[0] & 0xfc) >> 2;
-        arrOf4[1] = ((arrOf3[0] & 0x03) << 4) + ((arrOf3[1] & 0xf0) >> 4);
-        arrOf4[2] = ((arrOf3[1] & 0x0f) << 2) + ((arrOf3[2] & 0xc0) >> 6);
-        arrOf4[3] = arrOf3[2] & 0x3f;
-
-        for (j = 0; (j < i + 1); j++)
-            base64Str += BASE64_CHARS[arrOf4[j]];
-
-        while ((i++ < 3))
-            base64Str += '=';
-    }
-
-    return base64Str;
+	std::string base64Str(EncodedSize(len), '\0');
+	Encode({ bytes, len }, base64Str);
+	return base64Str;
+}
+
+size_t Base64::Encode(std::span<const uint8_t> bytes, std::span<char> base64)
+{
+	if (base64.size() < EncodedSize(bytes.size()))
+	{
+		throw std::invalid_argument("Base64 buffer of " + std::to_string(base64.size()) + " chars is too small for " + std::to_string(bytes.size()) + " bytes");
+	}
+
+	const uint8_t* in = bytes.data();
+	size_t len = bytes.size();
+	char* out = base64.data();
+
+#ifdef BASE64_X86
+	const size_t vectorized = HAS_AVX2 ? EncodeAvx2(in, len, out) : HAS_SSSE3 ? EncodeSsse3(in, len, out) : 0;
+	in += vectorized;
+	len -= vectorized;
+	out += vectorized / 3 * 4;
+#endif
+
+	for (; len >= 3; len -= 3, in += 3, out += 4)
+	{
+		out[0] = ENCODE_TABLE[in[0] >> 2];
+		out[1] = ENCODE_TABLE[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+		out[2] = ENCODE_TABLE[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+		out[3] = ENCODE_TABLE[in[2] & 0x3f];
+	}
+
+	if (len > 0)
+	{
+		const uint8_t second = len > 1 ? in[1] : 0;
+		out[0] = ENCODE_TABLE[in[0] >> 2];
+		out[1] = ENCODE_TABLE[((in[0] & 0x03) << 4) | (second >> 4)];
+		out[2] = len > 1 ? ENCODE_TABLE[(second & 0x0f) << 2] : '=';
+		out[3] = '=';
+		out += 4;
+	}
+
+	return out - base64.data();
 }
+
 std::string Base64::Decode(const std::string& base64Str)
 {
-    // base 64 decoder, get encoded string (in base64 format) decode it and present as string
-    int in_len = base64Str.size();
-    int i = 0;
-    int j = 0;
-    int k = 0;
-    uint8_t arrOf3[3];
-    uint8_t arrOf4[4];
-    std::string decodedStr;
-
-    while (in_len-- && (base64Str[k] != '=') && isBase64Letter(base64Str[k]))
-    {
-        arrOf4[i++] = base64Str[k]; k++;
-        if (i == 4) {
-            for (i = 0; i < 4; i++)
-                arrOf4[i] = BASE64_CHARS.find(arrOf4[i]);
-
-            arrOf3[0] = (arrOf4[0] << 2) + ((arrOf4[1] & 0x30) >> 4);
-            arrOf3[1] = ((arrOf4[1] & 0xf) << 4) + ((arrOf4[2] & 0x3c) >> 2);
-            arrOf3[2] = ((arrOf4[2] & 0x3) << 6) + arrOf4[3];
-
-            for (i = 0; (i < 3); i++)
-                decodedStr += arrOf3[i];
-            i = 0;
-        }
-    }
-
-    if (i)
-    {
-        for (j = i; j < 4; j++)
-            arrOf4[j] = 0;
-
-        for (j = 0; j < 4; j++)
-            arrOf4[j] = BASE64_CHARS.find(arrOf4[j]);
-
-        arrOf3[0] = (arrOf4[0] << 2) + ((arrOf4[1] & 0x30) >> 4);
-        arrOf3[1] = ((arrOf4[1] & 0xf) << 4) + ((arrOf4[2] & 0x3c) >> 2);
-        arrOf3[2] = ((arrOf4[2] & 0x3) << 6) + arrOf4[3];
-
-        for (j = 0; (j < i - 1); j++) decodedStr += arrOf3[j];
-    }
-
-    return decodedStr;
+	std::string decodedStr(MaxDecodedSize(base64Str.size()), '\0');
+	decodedStr.resize(Decode(base64Str, std::span<uint8_t>(reinterpret_cast<uint8_t*>(decodedStr.data()), decodedStr.size())));
+	return decodedStr;
+}
+
+size_t Base64::Decode(std::string_view base64, std::span<uint8_t> bytes)
+{
+	if (bytes.size() < MaxDecodedSize(base64.size()))
+	{
+		throw std::invalid_argument("Buffer of " + std::to_string(bytes.size()) + " bytes is too small for " + std::to_string(base64.size()) + " base64 chars");
+	}
+
+	const char* in = base64.data();
+	size_t len = base64.size();
+	uint8_t* out = bytes.data();
+
+#ifdef BASE64_X86
+	const size_t vectorized = HAS_AVX2 ? DecodeAvx2(in, len, out, bytes.size()) : HAS_SSSE3 ? DecodeSsse3(in, len, out, bytes.size()) : 0;
+	in += vectorized;
+	len -= vectorized;
+	out += vectorized / 4 * 3;
+#endif
+
+	const auto value = [](char c) { return DECODE_TABLE[static_cast<uint8_t>(c)]; };
+	for (; len >= 4; len -= 4, in += 4, out += 3)
+	{
+		const uint8_t a = value(in[0]), b = value(in[1]), c = value(in[2]), d = value(in[3]);
+		if (((a | b | c | d) & 0xC0) != 0) // INVALID has the bits no 6 bit value has
+		{
+			break;
+		}
+		out[0] = static_cast<uint8_t>((a << 2) | (b >> 4));
+		out[1] = static_cast<uint8_t>((b << 4) | (c >> 2));
+		out[2] = static_cast<uint8_t>((c << 6) | d);
+	}
+
+	// the characters before padding or the first invalid character, a partial group of n characters is n - 1 bytes
+	uint8_t group[4] = { 0 };
+	size_t count = 0;
+	for (; count < len && count < 3 && value(in[count]) != INVALID; ++count)
+	{
+		group[count] = value(in[count]);
+	}
+	if (count > 1)
+	{
+		out[0] = static_cast<uint8_t>((group[0] << 2) | (group[1] >> 4));
+		out[1] = static_cast<uint8_t>((group[1] << 4) | (group[2] >> 2));
+		out += count - 1;
+	}
+
+	return out - bytes.data();
 }
@@ -1,16 +1,25 @@
 #pragma once
 #include <cstdint>
 #include <string>
+#include <string_view>
+#include <span>
 
+/*
+ * Base64 with the standard alphabet and '=' padding.
+ * The span methods write to a caller's buffer and don't allocate, whole blocks are encoded and decoded with AVX2 or SSSE3
+ * when the CPU has them and the rest with a table. Decode stops at the first character outside the alphabet ('=' included).
+ */
 class Base64
 {
 	Base64() = delete;
-	static const std::string BASE64_CHARS;
-	static bool isBase64Letter(unsigned char c);
 
 public:
+	static constexpr size_t EncodedSize(size_t len) { return (len + 2) / 3 * 4; }
+	static constexpr size_t MaxDecodedSize(size_t len) { return len / 4 * 3 + (len % 4 > 1 ? len % 4 - 1 : 0); }
+
 	static std::string Encode(const std::string& bytes);
 	static std::string Encode(const uint8_t* bytes, size_t len);
+	static size_t Encode(std::span<const uint8_t> bytes, std::span<char> base64); // base64 must hold EncodedSize, return chars written
 	static std::string Decode(const std::string& base64Str);
+	static size_t Decode(std::string_view base64, std::span<uint8_t> bytes);      // bytes must hold MaxDecodedSize, return bytes written
 };
-
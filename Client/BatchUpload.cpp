@@ -0,0 +1,306 @@
+#include "BatchUpload.h"
+#include "ClientLogic.h"
+#include "FileSource.h"
+#include "Transport.h"
+#include "FatalError.h"
+#include "Log.h"
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <boost/asio/co_spawn.hpp>
+
+namespace fs = std::filesystem;
+
+// True if name matches pattern of * (any characters) and ? (one character)
+static bool MatchWildcards(std::string_view pattern, std::string_view name)
+{
+	size_t p = 0, n = 0;
+	size_t star = std::string_view::npos, starMatch = 0;
+	while (n < name.size())
+	{
+		if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n]))
+		{
+			++p;
+			++n;
+		}
+		else if (p < pattern.size() && pattern[p] == '*')
+		{
+			star = p++;
+			starMatch = n;
+		}
+		else if (star != std::string_view::npos)
+		{
+			p = star + 1;
+			n = ++starMatch;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	while (p < pattern.size() && pattern[p] == '*')
+	{
+		++p;
+	}
+	return p == pattern.size();
+}
+
+static BatchFile MakeBatchFile(const fs::path& path)
+{
+	std::error_code error;
+	const auto size = fs::file_size(path, error);
+	return { path.string(), error ? 0 : size }; // a file that can't be read fails when it is uploaded
+}
+
+bool BatchUpload::IsManifest(const std::string& spec)
+{
+	std::error_code error;
+	return spec.starts_with('@') || spec.find_first_of("*?") != std::string::npos || fs::is_directory(spec, error);
+}
+
+std::vector<BatchFile> BatchUpload::ListFiles(const std::string& spec)
+{
+	std::vector<BatchFile> files;
+	if (spec.starts_with('@'))
+	{
+		std::ifstream list(spec.substr(1));
+		if (!list.is_open())
+		{
+			throw std::invalid_argument("File list " + spec.substr(1) + " not exists");
+		}
+		std::string line;
+		while (std::getline(list, line))
+		{
+			if (!line.empty() && line.back() == '\r')
+			{
+				line.pop_back();
+			}
+			if (!line.empty())
+			{
+				files.push_back(MakeBatchFile(line));
+			}
+		}
+	}
+	else if (spec.find_first_of("*?") == std::string::npos)
+	{
+		for (const auto& entry : fs::recursive_directory_iterator(spec, fs::directory_options::skip_permission_denied))
+		{
+			if (entry.is_regular_file())
+			{
+				files.push_back(MakeBatchFile(entry.path()));
+			}
+		}
+	}
+	else
+	{
+		const fs::path pattern(spec);
+		const fs::path directory = pattern.has_parent_path() ? pattern.parent_path() : fs::path(".");
+		if (directory.string().find_first_of("*?") != std::string::npos)
+		{
+			throw std::invalid_argument("Wildcards are supported in the file name only, not in " + directory.string());
+		}
+		for (const auto& entry : fs::directory_iterator(directory))
+		{
+			if (entry.is_regular_file() && MatchWildcards(pattern.filename().string(), entry.path().filename().string()))
+			{
+				files.push_back(MakeBatchFile(entry.path()));
+			}
+		}
+	}
+	return files;
+}
+
+BatchUpload::BatchUpload(std::vector<BatchFile> files, size_t transfers, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper) :
+	m_files(std::move(files)), m_transfers(std::clamp<size_t>(transfers, 1, MAX_TRANSFERS)), m_meInfo(std::move(meInfo)), m_aesWrapper(std::move(aesWrapper)),
+	m_results(m_files.size())
+{
+	Schedule();
+}
+
+// Split the files to large ones, largest first so the longest transfers start early, and batches of small ones in their order
+void BatchUpload::Schedule()
+{
+	std::vector<size_t> small;
+	for (size_t i = 0; i < m_files.size(); ++i)
+	{
+		(m_files[i].size > UPLOAD_CHUNK_SIZE ? m_large : small).push_back(i);
+	}
+	std::stable_sort(m_large.begin(), m_large.end(), [this](size_t a, size_t b) { return m_files[a].size > m_files[b].size; });
+
+	uint64_t batchBytes = 0;
+	for (const size_t i : small)
+	{
+		if (m_smallBatches.empty() || m_smallBatches.back().size() == SMALL_BATCH_FILES || batchBytes + m_files[i].size > SMALL_BATCH_BYTES)
+		{
+			m_smallBatches.emplace_back();
+			batchBytes = 0;
+		}
+		m_smallBatches.back().push_back(i);
+		batchBytes += m_files[i].size;
+	}
+}
+
+/*
+ * Next job of a transfer, a large file while fewer than all transfers (but one) upload large files, otherwise a batch of small files.
+ * A transfer that finished a large file takes a batch first, so large files interleave with the batches. Large files left after the
+ * last batch take every transfer. All transfers resume on the io_context thread, so the schedule needs no lock.
+ */
+std::optional<BatchUpload::Job> BatchUpload::NextJob(bool afterLarge)
+{
+	const size_t maxLarge = std::max<size_t>(1, m_transfers - 1);
+	const bool batchLeft = m_nextBatch < m_smallBatches.size();
+	if (m_nextLarge < m_large.size() && (!batchLeft || (!afterLarge && m_activeLarge < maxLarge)))
+	{
+		++m_activeLarge;
+		return Job{ { m_large[m_nextLarge++] }, true };
+	}
+	if (batchLeft)
+	{
+		return Job{ m_smallBatches[m_nextBatch++], false };
+	}
+	return std::nullopt;
+}
+
+awaitable<void> BatchUpload::Transfer(ClientSocket& socket)
+{
+	bool afterLarge = false;
+	while (auto job = NextJob(afterLarge))
+	{
+		for (const size_t i : job->files)
+		{
+			m_results[i] = co_await UploadOne(socket, m_files[i]);
+			Report(m_results[i]);
+		}
+		if (job->large)
+		{
+			--m_activeLarge;
+		}
+		afterLarge = job->large;
+	}
+}
+
+// Upload one file and confirm its crc with the server, retry an upload the server got a different crc of. Errors are in the result
+awaitable<BatchResult> BatchUpload::UploadOne(ClientSocket& socket, const BatchFile& file)
+{
+	BatchResult result{ file.path, file.size };
+	try
+	{
+		if (file.path.size() >= NAME_SIZE)
+		{
+			throw std::invalid_argument("Path is longer than " + std::to_string(NAME_SIZE - 1) + " letters");
+		}
+		FileName filename;
+		std::copy(file.path.begin(), file.path.end(), std::begin(filename.name));
+
+		// the digest and crc passes run on a compute thread, the other transfers keep sending meanwhile
+		auto& transport = Transport::Instance();
+		const FileSource source(file.path);
+		result.size = source.Size();
+		if (!m_precheck)
+		{
+			m_precheck = co_await ClientLogic::AsyncProbeUploadPrecheck(socket, m_meInfo, m_aesWrapper, filename, result.size); // the first transfers may probe together
+		}
+		UploadPrecheck precheck;
+		if (*m_precheck)
+		{
+			const auto digest = co_await transport.Compute([&]() { return ClientLogic::DigestContent(source); });
+			precheck = co_await ClientLogic::AsyncPrecheckUpload(socket, m_meInfo, m_aesWrapper, filename, result.size, digest);
+		}
+		if (precheck.storedCrc)
+		{
+			result.crc = co_await transport.Compute([&]()
+				{
+					const auto content = source.Bytes();
+					return Crc32::Calculate(content.data(), content.size());
+				});
+		}
+
+		for (int attempt = 1; attempt <= MAX_CRC_ATTEMPTS; ++attempt)
+		{
+			uint32_t serverCrc = precheck.storedCrc.value_or(0);
+			if (attempt > 1 || !precheck.storedCrc)
+			{
+				serverCrc = co_await ClientLogic::AsyncUploadFile(socket, m_meInfo, m_aesWrapper, filename, source, result.crc);
+			}
+			if (serverCrc == result.crc)
+			{
+				result.verified = co_await ClientLogic::AsyncSendCrcResult(socket, m_meInfo, filename, true);
+				if (!result.verified)
+				{
+					result.error = "Server didn't acknowledge the crc";
+				}
+				co_return result;
+			}
+			LOG_WARNING(file.path << ": received invalid CRC " << serverCrc << " in attempt " << attempt << ", expected " << result.crc);
+		}
+
+		co_await ClientLogic::AsyncSendCrcResult(socket, m_meInfo, filename, false);
+		result.error = "Invalid CRC in " + std::to_string(MAX_CRC_ATTEMPTS) + " attempts";
+	}
+	catch (const std::exception& e)
+	{
+		result.error = e.what();
+	}
+	co_return result;
+}
+
+void BatchUpload::Report(const BatchResult& result) const
+{
+	if (result.verified)
+	{
+		LOG_INFO(result.path << ": uploaded " << result.size << " bytes, crc " << result.crc);
+	}
+	else
+	{
+		LOG_ERROR(result.path << ": failed, " << result.error);
+	}
+}
+
+std::vector<BatchResult> BatchUpload::Run(const std::string& address, const std::string& port)
+{
+	// the server keeps files by name, a second file of the same name would replace the first
+	std::map<std::string, size_t> names;
+	for (size_t i = 0; i < m_files.size(); ++i)
+	{
+		const auto [first, added] = names.emplace(fs::path(m_files[i].path).filename().string(), i);
+		if (!added)
+		{
+			m_results[i] = { m_files[i].path, m_files[i].size, 0, false, "Same file name as " + m_files[first->second].path };
+			std::erase(m_large, i);
+			for (auto& batch : m_smallBatches)
+			{
+				std::erase(batch, i);
+			}
+			Report(m_results[i]);
+		}
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	auto& transport = Transport::Instance();
+	std::vector<Transport::Lease> leases;
+	std::exception_ptr error;
+	for (size_t i = 0; i < std::min(m_transfers, m_large.size() + m_smallBatches.size()); ++i)
+	{
+		leases.push_back(transport.Acquire(address, port, true));
+		boost::asio::co_spawn(transport.Context(), Transfer(*leases.back()), [&error](std::exception_ptr e)
+			{
+				if (e && !error)
+				{
+					error = e;
+				}
+			});
+	}
+	transport.Context().restart();
+	transport.Context().run();
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	const auto verified = std::count_if(m_results.begin(), m_results.end(), [](const BatchResult& result) { return result.verified; });
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	LOG_INFO("Batch upload of " << m_files.size() << " files: " << verified << " verified, " << m_files.size() - verified << " failed, in " << seconds << " seconds");
+	return m_results;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "Protocol.h"
+#include "ClientSocket.h"
+#include "MeInfo.hpp"
+#include "AESWrapper.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <boost/noncopyable.hpp>
+
+struct BatchFile
+{
+	std::string path;
+	uint64_t size = 0;
+};
+
+struct BatchResult
+{
+	std::string path;
+	uint64_t size = 0;
+	uint32_t crc = 0;
+	bool verified = false; // the server computed the same crc and acknowledged it
+	std::string error;
+};
+
+/*
+ * Upload many files under one authenticated client, over concurrent transfers (connections) on the shared io_context.
+ * The transfers hand their CPU bound stages to the compute threads of the Transport, so one file's digest or compression doesn't stall the others.
+ * Each transfer takes the next job from a size aware schedule: small files go in batches and large files, largest first,
+ * are interleaved with the batches and never take all transfers, so they don't hold the small files back.
+ */
+class BatchUpload : boost::noncopyable
+{
+public:
+	constexpr static size_t DEFAULT_TRANSFERS = 4;
+	constexpr static size_t MAX_TRANSFERS = 64;
+	constexpr static size_t SMALL_BATCH_FILES = 32;
+	constexpr static uint64_t SMALL_BATCH_BYTES = 8 * UPLOAD_CHUNK_SIZE;
+	constexpr static int MAX_CRC_ATTEMPTS = 3;
+
+	// The files of a manifest: "@list" of a path per line, a directory (recursively) or a glob of * and ? in the file name
+	static bool IsManifest(const std::string& spec);
+	static std::vector<BatchFile> ListFiles(const std::string& spec);
+
+	BatchUpload(std::vector<BatchFile> files, size_t transfers, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper);
+
+	std::vector<BatchResult> Run(const std::string& address, const std::string& port); // results in the order of the files
+
+private:
+	struct Job
+	{
+		std::vector<size_t> files;
+		bool large = false;
+	};
+
+	const std::vector<BatchFile> m_files;
+	const size_t m_transfers;
+	const std::shared_ptr<MeInfo> m_meInfo;
+	const std::shared_ptr<AESWrapper> m_aesWrapper;
+	std::vector<BatchResult> m_results;
+	std::vector<size_t> m_large;                   // largest first
+	std::vector<std::vector<size_t>> m_smallBatches;
+	size_t m_nextLarge = 0;
+	size_t m_nextBatch = 0;
+	size_t m_activeLarge = 0;
+	std::optional<bool> m_precheck;                // the server stores uploads by content, known after the first probe
+
+	void Schedule();
+	std::optional<Job> NextJob(bool afterLarge);
+	awaitable<void> Transfer(ClientSocket& socket);
+	awaitable<BatchResult> UploadOne(ClientSocket& socket, const BatchFile& file);
+	void Report(const BatchResult& result) const;
+};
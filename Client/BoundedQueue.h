@@ -0,0 +1,110 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <boost/noncopyable.hpp>
+
+/*
+ * Lock free queue of a fixed capacity between one producer thread and one consumer thread.
+ * Push waits while the queue is full and Pop while it's empty, on the atomic counters themselves (futex like, no mutex).
+ * Close ends the stream after the items already pushed, Cancel ends it at once on both sides.
+ */
+template <typename T>
+class BoundedQueue : boost::noncopyable
+{
+	constexpr static uint64_t CLOSED = 1ull << 63; // set in a counter to wake and stop the side that waits on it
+
+	std::vector<T> m_slots;
+	alignas(64) std::atomic<uint64_t> m_head{ 0 }; // items popped, advanced by the consumer
+	alignas(64) std::atomic<uint64_t> m_tail{ 0 }; // items pushed, advanced by the producer
+
+public:
+	explicit BoundedQueue(size_t capacity) : m_slots(capacity)
+	{
+	}
+
+	// Return false if the queue was closed or canceled
+	bool Push(T item)
+	{
+		const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+		while (true)
+		{
+			const uint64_t head = m_head.load(std::memory_order_acquire);
+			if ((head | tail) & CLOSED)
+			{
+				return false;
+			}
+			if (tail - head < m_slots.size())
+			{
+				break;
+			}
+			m_head.wait(head, std::memory_order_acquire);
+		}
+
+		m_slots[tail % m_slots.size()] = std::move(item);
+		m_tail.fetch_add(1, std::memory_order_release); // keeps a CLOSED bit set meanwhile
+		m_tail.notify_one();
+		return true;
+	}
+
+	// Return nothing at the end of a closed queue or once the queue is canceled
+	std::optional<T> Pop()
+	{
+		uint64_t head;
+		while (true)
+		{
+			head = m_head.load(std::memory_order_acquire); // each round, a Cancel of either side sets CLOSED here while items remain
+			if (head & CLOSED)
+			{
+				return std::nullopt;
+			}
+			const uint64_t tail = m_tail.load(std::memory_order_acquire);
+			if ((tail & ~CLOSED) != head)
+			{
+				break;
+			}
+			if (tail & CLOSED)
+			{
+				return std::nullopt;
+			}
+			m_tail.wait(tail, std::memory_order_acquire);
+		}
+
+		std::optional<T> item(std::move(m_slots[head % m_slots.size()]));
+		m_head.fetch_add(1, std::memory_order_release);
+		m_head.notify_one();
+		return item;
+	}
+
+	// By the producer, no more items will be pushed
+	void Close()
+	{
+		m_tail.fetch_or(CLOSED, std::memory_order_release);
+		m_tail.notify_all();
+	}
+
+	// By either side, drop the remaining items and make both sides stop
+	void Cancel()
+	{
+		m_head.fetch_or(CLOSED, std::memory_order_release);
+		m_tail.fetch_or(CLOSED, std::memory_order_release);
+		m_head.notify_all();
+		m_tail.notify_all();
+	}
+
+	// Items waiting in the queue, a snapshot that the other side may change right away
+	size_t Size() const
+	{
+		const uint64_t head = m_head.load(std::memory_order_acquire) & ~CLOSED;
+		const uint64_t tail = m_tail.load(std::memory_order_acquire) & ~CLOSED;
+		return static_cast<size_t>(tail - head);
+	}
+
+	// Empty and open again, only while no thread uses the queue
+	void Reset()
+	{
+		m_head = 0;
+		m_tail = 0;
+	}
+};
@@ -0,0 +1,80 @@
+#include "CircuitBreaker.h"
+#include <map>
+#include "Log.h"
+
+CircuitBreaker::CircuitBreaker(const std::string& endpoint) : m_endpoint(endpoint)
+{
+}
+
+std::shared_ptr<CircuitBreaker> CircuitBreaker::ForEndpoint(const std::string& endpoint)
+{
+	static std::mutex registryMutex;
+	static std::map<std::string, std::shared_ptr<CircuitBreaker>> registry;
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	auto& breaker = registry[endpoint];
+	if (breaker == nullptr)
+	{
+		breaker = std::make_shared<CircuitBreaker>(endpoint);
+	}
+	return breaker;
+}
+
+bool CircuitBreaker::AllowRequest()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	switch (m_state)
+	{
+	case State::Closed:
+		return true;
+	case State::Open:
+		if (std::chrono::steady_clock::now() - m_openedAt < OPEN_DURATION)
+		{
+			return false;
+		}
+		m_state = State::HalfOpen;
+		m_probing = true; // this request is the probe
+		return true;
+	case State::HalfOpen:
+	default:
+		if (m_probing)
+		{
+			return false;
+		}
+		m_probing = true;
+		return true;
+	}
+}
+
+void CircuitBreaker::OnSuccess()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_state != State::Closed)
+	{
+		LOG_INFO("Server " << m_endpoint << " is available again");
+	}
+	m_state = State::Closed;
+	m_failures = 0;
+	m_probing = false;
+}
+
+void CircuitBreaker::OnFailure()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_probing = false;
+	if (m_state == State::HalfOpen || ++m_failures >= FAILURE_THRESHOLD)
+	{
+		if (m_state != State::Open)
+		{
+			LOG_WARNING("Server " << m_endpoint << " is unavailable, failing requests fast for " << OPEN_DURATION.count() << " seconds");
+		}
+		m_state = State::Open;
+		m_openedAt = std::chrono::steady_clock::now();
+	}
+}
+
+CircuitBreaker::State CircuitBreaker::GetState()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_state;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+
+/*
+ * Per endpoint circuit breaker shared by all sockets to the same server.
+ * After FAILURE_THRESHOLD failed requests in a row it opens and requests fail fast for OPEN_DURATION,
+ * then a single probe request is let through and its result closes or reopens the breaker.
+ */
+class CircuitBreaker
+{
+public:
+	enum class State { Closed, Open, HalfOpen };
+
+	constexpr static int FAILURE_THRESHOLD = 5;
+	constexpr static std::chrono::seconds OPEN_DURATION{ 10 };
+
+	explicit CircuitBreaker(const std::string& endpoint);
+
+	static std::shared_ptr<CircuitBreaker> ForEndpoint(const std::string& endpoint);
+
+	bool AllowRequest(); // false while open or while another request probes the server
+	void OnSuccess();
+	void OnFailure();
+	State GetState();
+	const std::string& Endpoint() const { return m_endpoint; }
+
+private:
+	const std::string m_endpoint;
+	std::mutex m_mutex;
+	State m_state = State::Closed;
+	int m_failures = 0;
+	bool m_probing = false;
+	std::chrono::steady_clock::time_point m_openedAt;
+};
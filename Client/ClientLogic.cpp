@@ -1,15 +1,58 @@
 #include "ClientLogic.h"
 #include "FatalError.h"
-#include <iostream>
-#include "ClientSocket.h"
-#include "Base64.h"
+#include <vector>
+#include <array>
+#include <cstring>
+#include <chrono>
+#include "Log.h"
+#include "UploadPipeline.h"
+#include "Serializer.h"
+#include "WorkerPool.h"
+#include "Transport.h"
+#include "Endianess.h"
+#include "Compression.h"
+#include <osrng.h>
+#include <sha.h>
+#include <misc.h>
+
+constexpr uint32_t VARIABLE_PAYLOAD_SIZE = UINT32_MAX; // Response with a dynamic field, its payload size isn't checked
+
+template <typename T>
+constexpr uint32_t PAYLOAD_SIZE = sizeof(T) - sizeof(ResponseHeader);
+
+// Expected payload size of every response code, indexed from RESPONSE_REGISTRATION_SUCCEEDED
+constexpr auto RESPONSE_PAYLOAD_SIZES = []()
+{
+	std::array<uint32_t, RESPONSE_UPLOAD_CHUNK_CRCS - RESPONSE_REGISTRATION_SUCCEEDED + 1> sizes{};
+	sizes.fill(VARIABLE_PAYLOAD_SIZE);
+	sizes[RESPONSE_REGISTRATION_SUCCEEDED - RESPONSE_REGISTRATION_SUCCEEDED] = PAYLOAD_SIZE<ResponseWithClientID>;
+	sizes[RESPONSE_REGISTRATION_FAILED - RESPONSE_REGISTRATION_SUCCEEDED] = PAYLOAD_SIZE<ResponseRegistrationFailed>;
+	sizes[RESPONSE_VALID_CRC - RESPONSE_REGISTRATION_SUCCEEDED] = PAYLOAD_SIZE<ResponseValidCrc>;
+	sizes[RESPONSE_MSG_RECEIVED - RESPONSE_REGISTRATION_SUCCEEDED] = PAYLOAD_SIZE<ResponseWithClientID>;
+	sizes[RESPONSE_RECONNECT_REJECTED - RESPONSE_REGISTRATION_SUCCEEDED] = PAYLOAD_SIZE<ResponseWithClientID>;
+	sizes[RESPONSE_UPLOAD_STATE - RESPONSE_REGISTRATION_SUCCEEDED] = PAYLOAD_SIZE<ResponseUploadState>;
+	sizes[RESPONSE_UPLOAD_CRC - RESPONSE_REGISTRATION_SUCCEEDED] = PAYLOAD_SIZE<ResponseUploadCrc>;
+	sizes[RESPONSE_RESUMPTION_TICKET - RESPONSE_REGISTRATION_SUCCEEDED] = PAYLOAD_SIZE<ResponseResumptionTicket>;
+	sizes[RESPONSE_RESUME_ALLOWED - RESPONSE_REGISTRATION_SUCCEEDED] = PAYLOAD_SIZE<ResponseResumeAllowed>;
+	return sizes;
+}();
+
+static uint32_t ExpectedPayloadSize(uint16_t code)
+{
+	const size_t index = static_cast<size_t>(code) - RESPONSE_REGISTRATION_SUCCEEDED;
+	if (code < RESPONSE_REGISTRATION_SUCCEEDED || index >= RESPONSE_PAYLOAD_SIZES.size())
+	{
+		return VARIABLE_PAYLOAD_SIZE;
+	}
+	return RESPONSE_PAYLOAD_SIZES[index];
+}
 
 
 bool ClientLogic::IsGlobalError(const ResponseHeader& header)
 {
 	if (header.code == RESPONSE_GLOBAL_ERROR)
 	{
-		std::cerr << "server responded with an error" << std::endl;
+		LOG_ERROR("server responded with an error");
 		return true;
 	}
 
@@ -23,9 +66,10 @@ bool ClientLogic::ValidateResponse(const ResponseHeader& header, const ResponseC
 		return false;
 	}
 
-	if (header.version != CLIENT_VERSION)
+	// an older server answers with its own version, the socket already handled its framing
+	if (header.version < CLIENT_VERSION_PADDED || header.version > CLIENT_VERSION)
 	{
-		throw FatalException("Received unsupported client version " + std::to_string(header.version) + ", expected to " + std::to_string(CLIENT_VERSION));
+		throw FatalException("Received unsupported client version " + std::to_string(header.version) + ", expected to " + std::to_string(CLIENT_VERSION_PADDED) + "-" + std::to_string(CLIENT_VERSION));
 	}
 
 	if (header.code != expectedCode)
@@ -33,36 +77,10 @@ bool ClientLogic::ValidateResponse(const ResponseHeader& header, const ResponseC
 		throw FatalException("Unexpected response code received " + std::to_string(header.code) + " but expected to " + std::to_string(expectedCode));
 	}
 
-	uint32_t expectedSize = DEFAULT_INT_VAL;
-	switch (header.code)
-	{
-	case RESPONSE_REGISTRATION_SUCCEEDED:
-	{
-		expectedSize = sizeof(ResponseWithClientID) - sizeof(ResponseHeader);
-		break;
-	}
-	case RESPONSE_REGISTRATION_FAILED:
-	{
-		expectedSize = sizeof(ResponseRegistrationFailed) - sizeof(ResponseHeader);
-		break;
-	}
-	case RESPONSE_VALID_CRC:
+	const uint32_t expectedSize = ExpectedPayloadSize(header.code);
+	if (expectedSize == VARIABLE_PAYLOAD_SIZE)
 	{
-		expectedSize = sizeof(ResponseValidCrc) - sizeof(ResponseHeader);
-		break;
-	}
-	case RESPONSE_MSG_RECEIVED:
-	case RESPONSE_RECONNECT_REJECTED:
-	{
-		expectedSize = sizeof(ResponseWithClientID) - sizeof(ResponseHeader);
-		break;
-	}
-	case RESPONSE_AES_KEY:
-	case RESPONSE_RECONNECT_ALLOWED:
-	default:
-	{
-		return true; 
-	}
+		return true;
 	}
 
 	if (header.payloadSize != expectedSize)
@@ -73,138 +91,1181 @@ bool ClientLogic::ValidateResponse(const ResponseHeader& header, const ResponseC
 }
 
 // Send register request and update clientID if the registration success, return status true if success else false
-bool ClientLogic::Register(const ClientName& clientName, const std::string& ip, int port, ClientID& clientID)
+bool ClientLogic::Register(ClientSocket& socket, const ClientName& clientName, ClientID& clientID)
 {
 	RequestRegistration request;
 	request.clientName = clientName;
-	ClientSocket socket(ip, std::to_string(port));
-	const auto response = socket.RetryableSendAndReceive((uint8_t*)(&request), sizeof(RequestRegistration), 3, "Failed to send registration request to server");
-	ResponseHeader* resHeader = (ResponseHeader*)response;
-	if (resHeader->code == RESPONSE_REGISTRATION_SUCCEEDED)
+	const auto wire = Serializer::Encode(request);
+	const auto response = socket.RetryableSendAndReceive(wire.data(), wire.size(), 3, "Failed to send registration request to server");
+	return OnRegisterResponse(response, clientID);
+}
+
+awaitable<bool> ClientLogic::AsyncRegister(ClientSocket& socket, const ClientName& clientName, ClientID& clientID)
+{
+	RequestRegistration request;
+	request.clientName = clientName;
+	const auto wire = Serializer::Encode(request);
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(wire.data(), wire.size(), 3, "Failed to send registration request to server");
+	co_return OnRegisterResponse(response, clientID);
+}
+
+bool ClientLogic::OnRegisterResponse(const ResponseView& response, ClientID& clientID)
+{
+	if (response.Code() == RESPONSE_REGISTRATION_SUCCEEDED)
 	{
-		if (ClientLogic::ValidateResponse(*(ResponseHeader*)(response), RESPONSE_REGISTRATION_SUCCEEDED))
+		if (ClientLogic::ValidateResponse(response.Header(), RESPONSE_REGISTRATION_SUCCEEDED))
 		{
-			ResponseWithClientID* reg = (ResponseWithClientID*)(response);
-			clientID = reg->clientId;
-			delete[] response;
+			clientID = response.As<ResponseWithClientID>().clientId;
 			return true;
 		}
 	}
 	else //RESPONSE_REGISTRATION_FAILED
 	{
-		if (ClientLogic::ValidateResponse(*(ResponseHeader*)(response), RESPONSE_REGISTRATION_FAILED))
+		if (ClientLogic::ValidateResponse(response.Header(), RESPONSE_REGISTRATION_FAILED))
 		{
-			std::cerr << "Failed to register, client name already in exists" << std::endl;
+			LOG_ERROR("Failed to register, client name already in exists");
 		}
 	}
 
-	delete[] response;
 	return false;
 }
 
-std::shared_ptr<AESWrapper> ClientLogic::ExtractAesFromResponse(const std::shared_ptr<MeInfo>& meInfo, uint8_t* response, ResponseCode excpectedCode)
+std::shared_ptr<AESWrapper> ClientLogic::ExtractAesFromResponse(const std::shared_ptr<MeInfo>& meInfo, const ResponseView& response, ResponseCode excpectedCode)
 {
-	ResponseHeader* resHeader = (ResponseHeader*)response;
-	if (!ClientLogic::ValidateResponse(*resHeader, excpectedCode))
+	if (!ClientLogic::ValidateResponse(response.Header(), excpectedCode))
 	{
 		return nullptr;
 	}
+	if (response.PayloadSize() <= CLIENT_ID_SIZE)
+	{
+		throw FatalException("Received response without encrypted aes key");
+	}
 
-	uint8_t* encryptedAesKey = response + sizeof(ResponseHeader) + CLIENT_ID_SIZE;
-	std::cout << "encrypted aes: " << Base64::Encode(encryptedAesKey, resHeader->payloadSize - CLIENT_ID_SIZE) << std::endl;
+	const uint8_t* encryptedAesKey = response.Payload() + CLIENT_ID_SIZE;
+	const size_t encryptedAesKeySize = response.PayloadSize() - CLIENT_ID_SIZE;
+	LOG_DEBUG("encrypted aes: " << Log::Dump(encryptedAesKey, encryptedAesKeySize));
 	const auto rsa = meInfo->GetRsaObject();
-	const auto aes = rsa->decrypt(encryptedAesKey, resHeader->payloadSize - CLIENT_ID_SIZE);
-	std::cout << "aes key: " << Base64::Encode(aes) << std::endl;
+	auto aes = rsa->decrypt(encryptedAesKey, encryptedAesKeySize);
+	LOG_TRACE("aes key: " << Log::Dump(aes));
 
-	return std::make_shared<AESWrapper>(reinterpret_cast<const uint8_t*>(aes.c_str()), aes.size());
+	auto aesWrapper = std::make_shared<AESWrapper>(reinterpret_cast<const uint8_t*>(aes.c_str()), aes.size());
+	CryptoPP::SecureWipeBuffer(reinterpret_cast<CryptoPP::byte*>(aes.data()), aes.size()); // the wrapper keeps its own copy
+	return aesWrapper;
 }
 
-/* return AES symmatric key */
-std::shared_ptr<AESWrapper> ClientLogic::SendPublicKey(const std::shared_ptr<MeInfo>& meInfo, const std::string& ip, int port)
+RequestPublicKey ClientLogic::MakePublicKeyRequest(const std::shared_ptr<MeInfo>& meInfo, const std::string& publicKey)
 {
 	RequestPublicKey request(meInfo->GetClientID());
 	request.payload.clientName = meInfo->GetClientName();
-	auto publicKey = meInfo->GetRsaPublicKey();
 	std::copy(publicKey.begin(), publicKey.end(), std::begin(request.payload.clientPublicKey.publicKey));
+	return request;
+}
 
-	ClientSocket socket(ip, port);
-	const auto response = socket.RetryableSendAndReceive((uint8_t*)(&request), sizeof(RequestPublicKey), 3, "Failed to send request public key to server");
-	if (response == nullptr)
+RequestVariablePublicKeyWithoutKey ClientLogic::MakeVariablePublicKeyRequest(const std::shared_ptr<MeInfo>& meInfo, const std::string& publicKey)
+{
+	if (publicKey.size() > MAX_PUBLIC_KEY_SIZE)
 	{
-		return nullptr;
+		throw std::invalid_argument("Public key of " + std::to_string(publicKey.size()) + " bytes exceeds the max of " + std::to_string(MAX_PUBLIC_KEY_SIZE));
 	}
 
-	const auto aesWrapper = ExtractAesFromResponse(meInfo, response, RESPONSE_AES_KEY);
-	delete[] response;
-	return aesWrapper;
+	RequestVariablePublicKeyWithoutKey request(meInfo->GetClientID(), static_cast<uint16_t>(publicKey.size()));
+	request.payload.clientName = meInfo->GetClientName();
+	return request;
 }
 
-/* Return crc that receviced from the server */
-uint32_t ClientLogic::SendFileContent(const std::shared_ptr<MeInfo>& meInfo, const std::string& ip, int port, const FileName& filename, const std::string& content)
+/* return AES symmatric key, a 1024 bits key is sent in the fixed size request that older servers know */
+std::shared_ptr<AESWrapper> ClientLogic::SendPublicKey(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo)
+{
+	const auto publicKey = meInfo->GetRsaPublicKey();
+	if (publicKey.size() == PUBLIC_KEY_SIZE)
+	{
+		const auto request = Serializer::Encode(MakePublicKeyRequest(meInfo, publicKey));
+		const auto response = socket.RetryableSendAndReceive(request.data(), request.size(), 3, "Failed to send request public key to server");
+		return ExtractAesFromResponse(meInfo, response, RESPONSE_AES_KEY);
+	}
+
+	const auto request = Serializer::Encode(MakeVariablePublicKeyRequest(meInfo, publicKey));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(publicKey) };
+	const auto response = socket.RetryableSendAndReceive(requestBuffers, 3, "Failed to send request public key to server");
+	return ExtractAesFromResponse(meInfo, response, RESPONSE_AES_KEY);
+}
+
+awaitable<std::shared_ptr<AESWrapper>> ClientLogic::AsyncSendPublicKey(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo)
+{
+	const auto publicKey = meInfo->GetRsaPublicKey();
+	if (publicKey.size() == PUBLIC_KEY_SIZE)
+	{
+		const auto request = Serializer::Encode(MakePublicKeyRequest(meInfo, publicKey));
+		const auto response = co_await socket.AsyncRetryableSendAndReceive(request.data(), request.size(), 3, "Failed to send request public key to server");
+		co_return ExtractAesFromResponse(meInfo, response, RESPONSE_AES_KEY);
+	}
+
+	const auto request = Serializer::Encode(MakeVariablePublicKeyRequest(meInfo, publicKey));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(publicKey) };
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(requestBuffers, 3, "Failed to send request public key to server");
+	co_return ExtractAesFromResponse(meInfo, response, RESPONSE_AES_KEY);
+}
+
+RequestSendFileWithoutContent ClientLogic::MakeSendFileRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, size_t contentSize)
 {
 	RequestSendFileWithoutContent request(meInfo->GetClientID());
 	std::copy(filename.name, filename.name + NAME_SIZE, std::begin(request.payload.fileName.name));
-	request.payload.contentSize = content.size();
-	request.header.payloadSize += content.size();
-
-	int totalSize = sizeof(RequestHeader) + request.header.payloadSize;
+	request.payload.contentSize = static_cast<uint32_t>(contentSize);
+	request.header.payloadSize += static_cast<uint32_t>(contentSize);
+	LOG_DEBUG("request size : " << sizeof(RequestHeader) + request.header.payloadSize);
+	return request;
+}
 
-	// copy all bytes from the request without the file content bytes
-	uint8_t* requestBytes = new uint8_t[totalSize];
-	std::copy((uint8_t*)(&request), (uint8_t*)(&request) + totalSize - content.size(), requestBytes);
+/* Return crc that receviced from the server */
+uint32_t ClientLogic::SendFileContent(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, const std::string& content)
+{
+	const auto request = Serializer::Encode(MakeSendFileRequest(meInfo, filename, content.size()));
 
-	// add the content bytes to the end
-	std::copy(content.begin(), content.end(), requestBytes + totalSize - content.size());
-	std::cout << "request size : " << totalSize << std::endl;
-	std::cout << "request in base64: " << Base64::Encode(requestBytes, totalSize) << std::endl;
-	ClientSocket socket(ip, port);
-	const auto response = socket.RetryableSendAndReceive(requestBytes, totalSize, 3, "Failed to send request send file to server");
-	delete[] requestBytes;
+	// send the request bytes and the content bytes after them without copying to one buffer
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(content) };
+	const auto response = socket.RetryableSendAndReceive(requestBuffers, 3, "Failed to send request send file to server");
+	return OnSendFileResponse(response);
+}
 
-	if (response == nullptr)
-	{
-		return 0;
-	}
+awaitable<uint32_t> ClientLogic::AsyncSendFileContent(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, const std::string& content)
+{
+	const auto request = Serializer::Encode(MakeSendFileRequest(meInfo, filename, content.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(content) };
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(requestBuffers, 3, "Failed to send request send file to server");
+	co_return OnSendFileResponse(response);
+}
 
+uint32_t ClientLogic::OnSendFileResponse(const ResponseView& response)
+{
 	uint32_t crc = 0;
-	ResponseHeader* resHeader = (ResponseHeader*)response;
-	if (resHeader->code == RESPONSE_VALID_CRC)
+	if (response.Code() == RESPONSE_VALID_CRC)
 	{
-		if (ClientLogic::ValidateResponse(*(ResponseHeader*)(response), RESPONSE_VALID_CRC))
+		if (ClientLogic::ValidateResponse(response.Header(), RESPONSE_VALID_CRC))
 		{
-			ResponseValidCrc* validCrc = (ResponseValidCrc*)(response);
-			crc = validCrc->payload.crc;
+			crc = response.As<ResponseValidCrc>().payload.crc;
 		}
 	}
 
-	delete[] response;
-	return 0;
+	return crc;
 }
 
-std::shared_ptr<AESWrapper> ClientLogic::SendReconnect(const std::shared_ptr<MeInfo>& meInfo, const std::string& ip, int port)
+RequestReconnect ClientLogic::MakeReconnectRequest(const std::shared_ptr<MeInfo>& meInfo)
 {
 	RequestReconnect request(meInfo->GetClientID());
 	const auto clientName = meInfo->GetClientName();
 	std::copy(clientName.name, clientName.name + NAME_SIZE, std::begin(request.clientName.name));
+	return request;
+}
+
+std::shared_ptr<AESWrapper> ClientLogic::SendReconnect(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo)
+{
+	const auto request = Serializer::Encode(MakeReconnectRequest(meInfo));
+	const auto response = socket.RetryableSendAndReceive(request.data(), request.size(), 3, "Failed to send reconnect to server");
+	return OnReconnectResponse(meInfo, response);
+}
 
-	ClientSocket socket(ip, port);
-	const auto response = socket.RetryableSendAndReceive((uint8_t*)&request, sizeof(RequestReconnect), 3, "Failed to send reconnect to server");
-	ResponseHeader* resHeader = (ResponseHeader*)response;
-	if (resHeader->code == RESPONSE_RECONNECT_REJECTED)
+awaitable<std::shared_ptr<AESWrapper>> ClientLogic::AsyncSendReconnect(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo)
+{
+	const auto request = Serializer::Encode(MakeReconnectRequest(meInfo));
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(request.data(), request.size(), 3, "Failed to send reconnect to server");
+	co_return OnReconnectResponse(meInfo, response);
+}
+
+std::shared_ptr<AESWrapper> ClientLogic::OnReconnectResponse(const std::shared_ptr<MeInfo>& meInfo, const ResponseView& response)
+{
+	if (response.Code() == RESPONSE_RECONNECT_REJECTED)
 	{
-		if (ClientLogic::ValidateResponse(*(ResponseHeader*)(response), RESPONSE_RECONNECT_REJECTED))
+		if (ClientLogic::ValidateResponse(response.Header(), RESPONSE_RECONNECT_REJECTED))
 		{
-			delete[] response;
 			return nullptr;
 		}
 	}
-	else if (resHeader->code == RESPONSE_RECONNECT_ALLOWED)
+	else if (response.Code() == RESPONSE_RECONNECT_ALLOWED)
+	{
+		return ExtractAesFromResponse(meInfo, response, RESPONSE_RECONNECT_ALLOWED);
+	}
+
+	throw FatalException("Received unexpected response code " + std::to_string(response.Code()));
+}
+
+// Save the ticket of the session key, a server that doesn't issue tickets answers with a global error and the client keeps using RSA
+bool ClientLogic::OnResumptionTicketResponse(const ResponseView& response, const AESWrapper& aesWrapper)
+{
+	if (!response || response.Code() != RESPONSE_RESUMPTION_TICKET)
+	{
+		LOG_INFO("Server doesn't issue resumption tickets");
+		return false;
+	}
+	if (!ClientLogic::ValidateResponse(response.Header(), RESPONSE_RESUMPTION_TICKET))
+	{
+		return false;
+	}
+
+	const auto payload = response.As<ResponseResumptionTicket>().payload;
+	SessionTicket(payload.ticket, aesWrapper.Key(), aesWrapper.KeySize(), payload.lifetime).Save();
+	return true;
+}
+
+bool ClientLogic::RequestTicket(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper)
+{
+	const auto request = Serializer::Encode(RequestResumptionTicket(meInfo->GetClientID()));
+	const auto response = socket.SendAndReceive(request.data(), request.size());
+	return OnResumptionTicketResponse(response, aesWrapper);
+}
+
+awaitable<bool> ClientLogic::AsyncRequestTicket(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper)
+{
+	const auto request = Serializer::Encode(RequestResumptionTicket(meInfo->GetClientID()));
+	const const_buffer requestBuffer(request.data(), request.size());
+	const auto response = co_await socket.AsyncSendAndReceive(std::span<const const_buffer>(&requestBuffer, 1));
+	co_return OnResumptionTicketResponse(response, *aesWrapper);
+}
+
+RequestResume ClientLogic::MakeResumeRequest(const std::shared_ptr<MeInfo>& meInfo, const SessionTicket& ticket)
+{
+	RequestResume request(meInfo->GetClientID());
+	CryptoPP::AutoSeededRandomPool rng;
+	rng.GenerateBlock(request.payload.clientNonce, sizeof(request.payload.clientNonce));
+	std::copy(ticket.Ticket(), ticket.Ticket() + TICKET_SIZE, std::begin(request.payload.ticket));
+	return request;
+}
+
+/* Return session key derived from the ticket, nullptr if the server rejected it and the client has to reconnect with RSA */
+std::shared_ptr<AESWrapper> ClientLogic::OnResumeResponse(const SessionTicket& ticket, const RequestResume& request, const ResponseView& response)
+{
+	if (!response || response.Code() != RESPONSE_RESUME_ALLOWED || !ClientLogic::ValidateResponse(response.Header(), RESPONSE_RESUME_ALLOWED))
+	{
+		LOG_WARNING("Resumption ticket rejected, reconnect with RSA");
+		SessionTicket::Remove();
+		return nullptr;
+	}
+
+	const auto payload = response.As<ResponseResumeAllowed>().payload;
+	const auto key = ticket.ResumedKey(request.payload.clientNonce, payload.serverNonce);
+	SessionTicket(payload.ticket, key.data(), key.size(), payload.lifetime).Save();
+	return std::make_shared<AESWrapper>(key.data(), key.size());
+}
+
+std::shared_ptr<AESWrapper> ClientLogic::SendResume(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo)
+{
+	const auto ticket = SessionTicket::Load();
+	if (ticket == nullptr)
+	{
+		return nullptr;
+	}
+
+	const auto request = MakeResumeRequest(meInfo, *ticket);
+	const auto wire = Serializer::Encode(request);
+	const auto response = socket.SendAndReceive(wire.data(), wire.size());
+	return OnResumeResponse(*ticket, request, response);
+}
+
+awaitable<std::shared_ptr<AESWrapper>> ClientLogic::AsyncSendResume(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo)
+{
+	const auto ticket = SessionTicket::Load();
+	if (ticket == nullptr)
+	{
+		co_return nullptr;
+	}
+
+	const auto request = MakeResumeRequest(meInfo, *ticket);
+	const auto wire = Serializer::Encode(request);
+	const const_buffer requestBuffer(wire.data(), wire.size());
+	const auto response = co_await socket.AsyncSendAndReceive(std::span<const const_buffer>(&requestBuffer, 1));
+	co_return OnResumeResponse(*ticket, request, response);
+}
+
+/* Return the plain bytes of the file that the server acknowledged, the upload continues from there */
+uint64_t ClientLogic::OnUploadStateResponse(const ResponseView& response, const std::string& errorDesc)
+{
+	if (!ClientLogic::ValidateResponse(response.Header(), RESPONSE_UPLOAD_STATE))
+	{
+		throw FatalException(errorDesc);
+	}
+
+	return response.As<ResponseUploadState>().payload.offset;
+}
+
+/* Return crc of the whole file that received from the server */
+uint32_t ClientLogic::OnUploadCrcResponse(const ResponseView& response, const FileName& filename)
+{
+	if (!ClientLogic::ValidateResponse(response.Header(), RESPONSE_UPLOAD_CRC))
+	{
+		throw FatalException("Server refused to commit upload of " + filename.ToString());
+	}
+
+	return response.As<ResponseUploadCrc>().payload.crc;
+}
+
+ContentDigest ClientLogic::DigestContent(const FileSource& source)
+{
+	ContentDigest digest;
+	const auto bytes = source.Bytes();
+	CryptoPP::SHA256().CalculateDigest(digest.digest, bytes.data(), bytes.size());
+	return digest;
+}
+
+// The precheck content is sealed under the session key, the server matches the digest only after the tag proves the request is of the client
+RequestUploadPrecheck ClientLogic::MakeUploadPrecheckRequest(const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper, const FileName& filename, uint64_t fileSize, const ContentDigest& digest)
+{
+	UploadPrecheckContent content;
+	content.fileName = filename;
+	content.fileSize = fileSize;
+	content.digest = digest;
+	const auto plain = Serializer::Encode(content);
+
+	RequestUploadPrecheck request(meInfo->GetClientID());
+	CryptoPP::AutoSeededRandomPool rng;
+	rng.GenerateBlock(request.payload.nonce, sizeof(request.payload.nonce));
+	aesWrapper.EncryptSegments(plain.data(), plain.size(), 0, request.payload.nonce, request.payload.sealed);
+	return request;
+}
+
+/* The server answers message received if it should get the content, and upload crc if it stored the file from content it had */
+UploadPrecheck ClientLogic::OnUploadPrecheckResponse(const ResponseView& response, const FileName& filename)
+{
+	UploadPrecheck precheck;
+	if (!response || (response.Code() != RESPONSE_MSG_RECEIVED && response.Code() != RESPONSE_UPLOAD_CRC))
+	{
+		LOG_DEBUG("Server doesn't store uploads by content, upload " << filename);
+		return precheck; // an older server answers the unknown request with a global error
+	}
+
+	precheck.supported = ValidateResponse(response.Header(), static_cast<ResponseCode>(response.Code()));
+	if (precheck.supported && response.Code() == RESPONSE_UPLOAD_CRC)
+	{
+		precheck.storedCrc = OnUploadCrcResponse(response, filename);
+		LOG_INFO("Server already has the content of " << filename << ", stored it without upload");
+	}
+	return precheck;
+}
+
+/* Ask the server to store the file from content it already has, not retried since an older server answers with a global error */
+UploadPrecheck ClientLogic::PrecheckUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper, const FileName& filename, uint64_t fileSize, const ContentDigest& digest)
+{
+	const auto wire = Serializer::Encode(MakeUploadPrecheckRequest(meInfo, aesWrapper, filename, fileSize, digest));
+	const auto response = socket.SendAndReceive(wire.data(), wire.size());
+	return OnUploadPrecheckResponse(response, filename);
+}
+
+awaitable<UploadPrecheck> ClientLogic::AsyncPrecheckUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper, FileName filename, uint64_t fileSize, ContentDigest digest)
+{
+	const auto wire = Serializer::Encode(MakeUploadPrecheckRequest(meInfo, *aesWrapper, filename, fileSize, digest));
+	const const_buffer request(wire.data(), wire.size());
+	const auto response = co_await socket.AsyncSendAndReceive(std::span<const const_buffer>(&request, 1));
+	co_return OnUploadPrecheckResponse(response, filename);
+}
+
+/* Ask whether the server stores uploads by content at all, so an older server costs no digest pass over the file. The probe is a precheck of the zero digest, no content has it */
+bool ClientLogic::ProbeUploadPrecheck(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper, const FileName& filename, uint64_t fileSize)
+{
+	return PrecheckUpload(socket, meInfo, aesWrapper, filename, fileSize, ContentDigest()).supported;
+}
+
+awaitable<bool> ClientLogic::AsyncProbeUploadPrecheck(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper, FileName filename, uint64_t fileSize)
+{
+	co_return (co_await AsyncPrecheckUpload(socket, meInfo, aesWrapper, filename, fileSize, ContentDigest())).supported;
+}
+
+uint64_t ClientLogic::BeginUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t fileSize)
+{
+	RequestUploadBegin request(meInfo->GetClientID());
+	request.payload.fileName = filename;
+	request.payload.fileSize = fileSize;
+
+	const auto wire = Serializer::Encode(request);
+	const auto response = socket.RetryableSendAndReceive(wire.data(), wire.size(), 3, "Failed to send upload begin to server");
+	return OnUploadStateResponse(response, "Server refused to begin upload of " + filename.ToString());
+}
+
+// Cipher of a new upload of source, its chunks are compressed unless the file is already compressed
+UploadCipher ClientLogic::NewUploadCipher(const FileSource& source)
+{
+	UploadCipher cipher;
+	CryptoPP::AutoSeededRandomPool rng;
+	rng.GenerateBlock(cipher.nonce.data(), cipher.nonce.size());
+	cipher.codec = Compression::IsCompressible(source) ? CODEC_ZLIB : CODEC_NONE;
+	return cipher;
+}
+
+RequestUploadBeginCipher ClientLogic::MakeUploadBeginCipherRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t fileSize, const UploadCipher& cipher)
+{
+	RequestUploadBeginCipher request(meInfo->GetClientID());
+	request.payload.fileName = filename;
+	request.payload.fileSize = fileSize;
+	request.payload.cipherMode = cipher.mode;
+	std::copy(cipher.nonce.begin(), cipher.nonce.end(), std::begin(request.payload.nonce));
+	return request;
+}
+
+// Return true if the server accepted the cipher, otherwise the upload falls back to CBC
+bool ClientLogic::OnUploadBeginCipherResponse(const ResponseView& response, UploadCipher& cipher)
+{
+	if (response && response.Code() == RESPONSE_UPLOAD_STATE)
+	{
+		return true;
+	}
+
+	LOG_WARNING("Server didn't accept the segmented cipher, upload with CBC");
+	cipher.mode = CIPHER_AES_CBC;
+	return false;
+}
+
+RequestUploadBeginCodec ClientLogic::MakeUploadBeginCodecRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t fileSize, const UploadCipher& cipher)
+{
+	RequestUploadBeginCodec request(meInfo->GetClientID());
+	request.payload.fileName = filename;
+	request.payload.fileSize = fileSize;
+	request.payload.cipherMode = cipher.mode;
+	std::copy(cipher.nonce.begin(), cipher.nonce.end(), std::begin(request.payload.nonce));
+	request.payload.codec = cipher.codec;
+	return request;
+}
+
+// Return true if the server accepted the codec and numbers the sends, otherwise the chunks are sent uncompressed and unnumbered
+bool ClientLogic::OnUploadBeginCodecResponse(const ResponseView& response, UploadCipher& cipher)
+{
+	if (response && response.Code() == RESPONSE_UPLOAD_STATE)
+	{
+		cipher.numbered = true;
+		return true;
+	}
+
+	LOG_WARNING("Server didn't accept numbered chunks, upload them uncompressed");
+	cipher.codec = CODEC_NONE;
+	return false;
+}
+
+/* Begin upload with cipher.mode and cipher.codec, an older server that doesn't know them gets plain chunks or CBC and cipher is updated.
+   The codec request is sent even for CODEC_NONE, a server that takes it numbers the sends of the upload */
+uint64_t ClientLogic::BeginUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t fileSize, UploadCipher& cipher)
+{
+	if (cipher.mode != CIPHER_AES_CBC)
+	{
+		const auto wire = Serializer::Encode(MakeUploadBeginCodecRequest(meInfo, filename, fileSize, cipher));
+		const auto response = socket.SendAndReceive(wire.data(), wire.size());
+		if (OnUploadBeginCodecResponse(response, cipher))
+		{
+			return OnUploadStateResponse(response, "Server refused to begin upload of " + filename.ToString());
+		}
+	}
+
+	if (cipher.mode != CIPHER_AES_CBC)
+	{
+		const auto wire = Serializer::Encode(MakeUploadBeginCipherRequest(meInfo, filename, fileSize, cipher));
+		const auto response = socket.SendAndReceive(wire.data(), wire.size());
+		if (OnUploadBeginCipherResponse(response, cipher))
+		{
+			return OnUploadStateResponse(response, "Server refused to begin upload of " + filename.ToString());
+		}
+	}
+
+	return BeginUpload(socket, meInfo, filename, fileSize);
+}
+
+awaitable<uint64_t> ClientLogic::AsyncBeginUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t fileSize)
+{
+	RequestUploadBegin request(meInfo->GetClientID());
+	request.payload.fileName = filename;
+	request.payload.fileSize = fileSize;
+
+	const auto wire = Serializer::Encode(request);
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(wire.data(), wire.size(), 3, "Failed to send upload begin to server");
+	co_return OnUploadStateResponse(response, "Server refused to begin upload of " + filename.ToString());
+}
+
+awaitable<uint64_t> ClientLogic::AsyncBeginUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t fileSize, UploadCipher& cipher)
+{
+	if (cipher.mode != CIPHER_AES_CBC)
 	{
-		const auto aesWrapper = ExtractAesFromResponse(meInfo, response, RESPONSE_RECONNECT_ALLOWED);
-		delete[] response;
-		return aesWrapper;
+		const auto wire = Serializer::Encode(MakeUploadBeginCodecRequest(meInfo, filename, fileSize, cipher));
+		const const_buffer request(wire.data(), wire.size());
+		const auto response = co_await socket.AsyncSendAndReceive(std::span<const const_buffer>(&request, 1));
+		if (OnUploadBeginCodecResponse(response, cipher))
+		{
+			co_return OnUploadStateResponse(response, "Server refused to begin upload of " + filename.ToString());
+		}
 	}
 
-	throw FatalException("Received unexpected response code " + std::to_string(resHeader->code));
+	if (cipher.mode != CIPHER_AES_CBC)
+	{
+		const auto wire = Serializer::Encode(MakeUploadBeginCipherRequest(meInfo, filename, fileSize, cipher));
+		const const_buffer request(wire.data(), wire.size());
+		const auto response = co_await socket.AsyncSendAndReceive(std::span<const const_buffer>(&request, 1));
+		if (OnUploadBeginCipherResponse(response, cipher))
+		{
+			co_return OnUploadStateResponse(response, "Server refused to begin upload of " + filename.ToString());
+		}
+	}
+
+	co_return co_await AsyncBeginUpload(socket, meInfo, filename, fileSize);
 }
 
+RequestUploadChunkWithoutContent ClientLogic::MakeUploadChunkRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, size_t chunkSize)
+{
+	RequestUploadChunkWithoutContent request(meInfo->GetClientID());
+	request.payload.fileName = filename;
+	request.payload.offset = offset;
+	request.payload.contentSize = static_cast<uint32_t>(chunkSize);
+	request.header.payloadSize += static_cast<uint32_t>(chunkSize);
+	return request;
+}
+
+uint64_t ClientLogic::SendUploadChunk(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, std::span<const uint8_t> encryptedChunk)
+{
+	const auto request = Serializer::Encode(MakeUploadChunkRequest(meInfo, filename, offset, encryptedChunk.size()));
+
+	// send the request bytes and the chunk bytes after them without copying to one buffer
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedChunk.data(), encryptedChunk.size()) };
+	const auto response = socket.RetryableSendAndReceive(requestBuffers, 3, "Failed to send upload chunk to server");
+	return OnUploadStateResponse(response, "Server refused upload chunk at offset " + std::to_string(offset));
+}
+
+awaitable<uint64_t> ClientLogic::AsyncSendUploadChunk(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, std::span<const uint8_t> encryptedChunk)
+{
+	const auto request = Serializer::Encode(MakeUploadChunkRequest(meInfo, filename, offset, encryptedChunk.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedChunk.data(), encryptedChunk.size()) };
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(requestBuffers, 3, "Failed to send upload chunk to server");
+	co_return OnUploadStateResponse(response, "Server refused upload chunk at offset " + std::to_string(offset));
+}
+
+RequestUploadNumberedChunkWithoutContent ClientLogic::MakeUploadNumberedChunkRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, Codec codec, size_t chunkSize)
+{
+	RequestUploadNumberedChunkWithoutContent request(meInfo->GetClientID());
+	request.payload.fileName = filename;
+	request.payload.offset = offset;
+	request.payload.send = send;
+	request.payload.codec = codec;
+	request.payload.contentSize = static_cast<uint32_t>(chunkSize);
+	request.header.payloadSize += static_cast<uint32_t>(chunkSize);
+	return request;
+}
+
+uint64_t ClientLogic::SendUploadNumberedChunk(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, Codec codec, std::span<const uint8_t> encryptedChunk)
+{
+	const auto request = Serializer::Encode(MakeUploadNumberedChunkRequest(meInfo, filename, offset, send, codec, encryptedChunk.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedChunk.data(), encryptedChunk.size()) };
+	const auto response = socket.RetryableSendAndReceive(requestBuffers, 3, "Failed to send upload chunk to server");
+	return OnUploadStateResponse(response, "Server refused upload chunk at offset " + std::to_string(offset));
+}
+
+awaitable<uint64_t> ClientLogic::AsyncSendUploadNumberedChunk(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, uint32_t send, Codec codec, std::span<const uint8_t> encryptedChunk)
+{
+	const auto request = Serializer::Encode(MakeUploadNumberedChunkRequest(meInfo, filename, offset, send, codec, encryptedChunk.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedChunk.data(), encryptedChunk.size()) };
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(requestBuffers, 3, "Failed to send upload chunk to server");
+	co_return OnUploadStateResponse(response, "Server refused upload chunk at offset " + std::to_string(offset));
+}
+
+/* Return the block signatures of the stored version of the file, nullopt if there is none or the server doesn't take deltas */
+std::optional<Delta::Base> ClientLogic::OnUploadSignaturesResponse(const ResponseView& response)
+{
+	// an older server answers the unknown request with a global error
+	if (!response || response.Code() != RESPONSE_UPLOAD_SIGNATURES || !ClientLogic::ValidateResponse(response.Header(), RESPONSE_UPLOAD_SIGNATURES))
+	{
+		return std::nullopt;
+	}
+
+	const auto payload = response.As<ResponseUploadSignaturesWithoutSignatures>().payload;
+	if (payload.count == 0)
+	{
+		return std::nullopt;
+	}
+	if (payload.blockSize == 0 || payload.count != (payload.baseSize + payload.blockSize - 1) / payload.blockSize
+		|| response.PayloadSize() != PAYLOAD_SIZE<ResponseUploadSignaturesWithoutSignatures> + static_cast<uint64_t>(payload.count) * sizeof(BlockSignature)
+		|| response.Size() < sizeof(ResponseUploadSignaturesWithoutSignatures) + static_cast<uint64_t>(payload.count) * sizeof(BlockSignature))
+	{
+		throw FatalException("Received " + std::to_string(payload.count) + " block signatures of " + std::to_string(payload.blockSize) + " bytes for a file of " + std::to_string(payload.baseSize) + " bytes");
+	}
+
+	Delta::Base base{ payload.baseSize, payload.blockSize };
+	base.blocks.reserve(payload.count);
+	const uint8_t* signatures = response.Payload() + sizeof(payload);
+	for (size_t i = 0; i < payload.count; ++i)
+	{
+		base.blocks.push_back(Serializer::Decode<BlockSignature>(signatures + i * sizeof(BlockSignature)));
+	}
+	return base;
+}
+
+std::optional<Delta::Base> ClientLogic::GetUploadSignatures(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename)
+{
+	RequestUploadSignatures request(meInfo->GetClientID());
+	request.fileName = filename;
+
+	// not retried, a server that doesn't take deltas answers with a global error
+	const auto wire = Serializer::Encode(request);
+	const auto response = socket.SendAndReceive(wire.data(), wire.size());
+	return OnUploadSignaturesResponse(response);
+}
+
+awaitable<std::optional<Delta::Base>> ClientLogic::AsyncGetUploadSignatures(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename)
+{
+	RequestUploadSignatures request(meInfo->GetClientID());
+	request.fileName = filename;
+
+	const auto wire = Serializer::Encode(request);
+	const const_buffer buffer(wire.data(), wire.size());
+	const auto response = co_await socket.AsyncSendAndReceive(std::span<const const_buffer>(&buffer, 1));
+	co_return OnUploadSignaturesResponse(response);
+}
+
+RequestUploadDeltaWithoutContent ClientLogic::MakeUploadDeltaRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, size_t contentSize)
+{
+	RequestUploadDeltaWithoutContent request(meInfo->GetClientID());
+	request.payload.fileName = filename;
+	request.payload.offset = offset;
+	request.payload.contentSize = static_cast<uint32_t>(contentSize);
+	request.header.payloadSize += static_cast<uint32_t>(contentSize);
+	return request;
+}
+
+uint64_t ClientLogic::SendUploadDelta(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, std::span<const uint8_t> encryptedDelta)
+{
+	const auto request = Serializer::Encode(MakeUploadDeltaRequest(meInfo, filename, offset, encryptedDelta.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedDelta.data(), encryptedDelta.size()) };
+	const auto response = socket.RetryableSendAndReceive(requestBuffers, 3, "Failed to send upload delta to server");
+	return OnUploadStateResponse(response, "Server refused upload delta at offset " + std::to_string(offset));
+}
+
+awaitable<uint64_t> ClientLogic::AsyncSendUploadDelta(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, std::span<const uint8_t> encryptedDelta)
+{
+	const auto request = Serializer::Encode(MakeUploadDeltaRequest(meInfo, filename, offset, encryptedDelta.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedDelta.data(), encryptedDelta.size()) };
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(requestBuffers, 3, "Failed to send upload delta to server");
+	co_return OnUploadStateResponse(response, "Server refused upload delta at offset " + std::to_string(offset));
+}
+
+RequestUploadNumberedDeltaWithoutContent ClientLogic::MakeUploadNumberedDeltaRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, size_t contentSize)
+{
+	RequestUploadNumberedDeltaWithoutContent request(meInfo->GetClientID());
+	request.payload.fileName = filename;
+	request.payload.offset = offset;
+	request.payload.send = send;
+	request.payload.codec = CODEC_NONE;
+	request.payload.contentSize = static_cast<uint32_t>(contentSize);
+	request.header.payloadSize += static_cast<uint32_t>(contentSize);
+	return request;
+}
+
+uint64_t ClientLogic::SendUploadNumberedDelta(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, std::span<const uint8_t> encryptedDelta)
+{
+	const auto request = Serializer::Encode(MakeUploadNumberedDeltaRequest(meInfo, filename, offset, send, encryptedDelta.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedDelta.data(), encryptedDelta.size()) };
+	const auto response = socket.RetryableSendAndReceive(requestBuffers, 3, "Failed to send upload delta to server");
+	return OnUploadStateResponse(response, "Server refused upload delta at offset " + std::to_string(offset));
+}
+
+awaitable<uint64_t> ClientLogic::AsyncSendUploadNumberedDelta(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, uint32_t send, std::span<const uint8_t> encryptedDelta)
+{
+	const auto request = Serializer::Encode(MakeUploadNumberedDeltaRequest(meInfo, filename, offset, send, encryptedDelta.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedDelta.data(), encryptedDelta.size()) };
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(requestBuffers, 3, "Failed to send upload delta to server");
+	co_return OnUploadStateResponse(response, "Server refused upload delta at offset " + std::to_string(offset));
+}
+
+/* Delta of the file from offset against the stored version, nullopt if there is no stored version or the delta doesn't pay off */
+std::optional<std::vector<Delta::Op>> ClientLogic::ComputeUploadDelta(const FileName& filename, const FileSource& source, uint64_t offset, const std::optional<Delta::Base>& base)
+{
+	if (!base)
+	{
+		return std::nullopt;
+	}
+
+	const uint64_t maxLiteralBytes = (source.Size() - offset) * DELTA_MAX_LITERAL_PERCENT / 100;
+	auto ops = Delta::Compute(source.Bytes(), offset, *base, maxLiteralBytes);
+	if (!ops)
+	{
+		LOG_DEBUG("Delta of " << filename << " against its stored version doesn't pay off, upload its chunks");
+		return std::nullopt;
+	}
+
+	uint64_t literalBytes = 0;
+	for (const auto& op : *ops)
+	{
+		literalBytes += op.blockCount == 0 ? op.length : 0;
+	}
+	LOG_INFO("Upload " << filename << " as delta of its stored version, " << literalBytes << " of " << source.Size() - offset << " bytes are new");
+	return ops;
+}
+
+/*
+ * Send the file from offset as a delta against the version the server stored before: copies of its blocks and the new bytes.
+ * Return the offset the server acknowledged, the chunks are sent from there. It is still offset if there is no stored version or the delta doesn't pay off.
+ * A numbered upload encrypts each message with the upload cipher under a send of its own, its segments count from 0 since the delta bytes are not the file bytes at offset.
+ * Otherwise the messages are encrypted with CBC, a server without numbered sends has no other nonces for them
+ */
+uint64_t ClientLogic::UploadDelta(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper, const UploadCipher& cipher, const FileName& filename,
+	const FileSource& source, uint64_t offset, int& resyncsLeft, uint32_t& sends)
+{
+	if (offset >= source.Size())
+	{
+		return offset;
+	}
+	const auto ops = ComputeUploadDelta(filename, source, offset, GetUploadSignatures(socket, meInfo, filename));
+	if (!ops)
+	{
+		return offset;
+	}
+
+	std::vector<uint8_t> message;
+	std::vector<uint8_t> encrypted;
+	for (size_t next = 0; next < ops->size(); )
+	{
+		const uint64_t length = Delta::EncodeMessage(*ops, next, source.Bytes(), message);
+		uint64_t acknowledged;
+		if (cipher.numbered)
+		{
+			const uint32_t send = ++sends;
+			acknowledged = SendUploadNumberedDelta(socket, meInfo, filename, offset, send, EncryptUploadSegments(aesWrapper, cipher, 0, message, encrypted, send));
+		}
+		else
+		{
+			encrypted.resize(AESWrapper::CipherSize(message.size()));
+			const size_t encryptedSize = aesWrapper.Encrypt(message.data(), message.size(), encrypted.data(), encrypted.size());
+			acknowledged = SendUploadDelta(socket, meInfo, filename, offset, { encrypted.data(), encryptedSize });
+		}
+		CheckAcknowledged(filename, offset + length, acknowledged, source.Size(), resyncsLeft);
+		if (acknowledged != offset + length)
+		{
+			return acknowledged;
+		}
+		offset = acknowledged;
+	}
+	return offset;
+}
+
+awaitable<uint64_t> ClientLogic::AsyncUploadDelta(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper, UploadCipher cipher, FileName filename,
+	const FileSource& source, uint64_t offset, int& resyncsLeft, uint32_t& sends)
+{
+	if (offset >= source.Size())
+	{
+		co_return offset;
+	}
+	auto& transport = Transport::Instance();
+	const auto base = co_await AsyncGetUploadSignatures(socket, meInfo, filename);
+	const auto ops = co_await transport.Compute([&]() { return ComputeUploadDelta(filename, source, offset, base); });
+	if (!ops)
+	{
+		co_return offset;
+	}
+
+	std::vector<uint8_t> message;
+	std::vector<uint8_t> encrypted;
+	for (size_t next = 0; next < ops->size(); )
+	{
+		uint64_t length = 0;
+		const uint32_t send = cipher.numbered ? ++sends : 0;
+		const auto encryptedDelta = co_await transport.Compute([&]() -> std::span<const uint8_t>
+			{
+				length = Delta::EncodeMessage(*ops, next, source.Bytes(), message);
+				if (cipher.numbered)
+				{
+					return EncryptUploadSegments(*aesWrapper, cipher, 0, message, encrypted, send);
+				}
+				encrypted.resize(AESWrapper::CipherSize(message.size()));
+				return { encrypted.data(), aesWrapper->Encrypt(message.data(), message.size(), encrypted.data(), encrypted.size()) };
+			});
+		const uint64_t acknowledged = cipher.numbered ? co_await AsyncSendUploadNumberedDelta(socket, meInfo, filename, offset, send, encryptedDelta)
+			: co_await AsyncSendUploadDelta(socket, meInfo, filename, offset, encryptedDelta);
+		CheckAcknowledged(filename, offset + length, acknowledged, source.Size(), resyncsLeft);
+		if (acknowledged != offset + length)
+		{
+			co_return acknowledged;
+		}
+		offset = acknowledged;
+	}
+	co_return offset;
+}
+
+RequestUploadRepairChunkWithoutContent ClientLogic::MakeUploadRepairChunkRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, size_t chunkSize)
+{
+	RequestUploadRepairChunkWithoutContent request(meInfo->GetClientID());
+	request.payload.fileName = filename;
+	request.payload.offset = offset;
+	request.payload.contentSize = static_cast<uint32_t>(chunkSize);
+	request.header.payloadSize += static_cast<uint32_t>(chunkSize);
+	return request;
+}
+
+uint64_t ClientLogic::SendUploadRepairChunk(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, std::span<const uint8_t> encryptedChunk)
+{
+	const auto request = Serializer::Encode(MakeUploadRepairChunkRequest(meInfo, filename, offset, encryptedChunk.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedChunk.data(), encryptedChunk.size()) };
+	const auto response = socket.RetryableSendAndReceive(requestBuffers, 3, "Failed to send upload repair chunk to server");
+	return OnUploadStateResponse(response, "Server refused to repair chunk at offset " + std::to_string(offset));
+}
+
+awaitable<uint64_t> ClientLogic::AsyncSendUploadRepairChunk(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, std::span<const uint8_t> encryptedChunk)
+{
+	const auto request = Serializer::Encode(MakeUploadRepairChunkRequest(meInfo, filename, offset, encryptedChunk.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedChunk.data(), encryptedChunk.size()) };
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(requestBuffers, 3, "Failed to send upload repair chunk to server");
+	co_return OnUploadStateResponse(response, "Server refused to repair chunk at offset " + std::to_string(offset));
+}
+
+RequestUploadNumberedRepairChunkWithoutContent ClientLogic::MakeUploadNumberedRepairChunkRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, size_t chunkSize)
+{
+	RequestUploadNumberedRepairChunkWithoutContent request(meInfo->GetClientID());
+	request.payload.fileName = filename;
+	request.payload.offset = offset;
+	request.payload.send = send;
+	request.payload.codec = CODEC_NONE;
+	request.payload.contentSize = static_cast<uint32_t>(chunkSize);
+	request.header.payloadSize += static_cast<uint32_t>(chunkSize);
+	return request;
+}
+
+uint64_t ClientLogic::SendUploadNumberedRepairChunk(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, std::span<const uint8_t> encryptedChunk)
+{
+	const auto request = Serializer::Encode(MakeUploadNumberedRepairChunkRequest(meInfo, filename, offset, send, encryptedChunk.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedChunk.data(), encryptedChunk.size()) };
+	const auto response = socket.RetryableSendAndReceive(requestBuffers, 3, "Failed to send upload repair chunk to server");
+	return OnUploadStateResponse(response, "Server refused to repair chunk at offset " + std::to_string(offset));
+}
+
+awaitable<uint64_t> ClientLogic::AsyncSendUploadNumberedRepairChunk(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, uint32_t send, std::span<const uint8_t> encryptedChunk)
+{
+	const auto request = Serializer::Encode(MakeUploadNumberedRepairChunkRequest(meInfo, filename, offset, send, encryptedChunk.size()));
+	const std::array<const_buffer, 2> requestBuffers{ boost::asio::buffer(request), boost::asio::buffer(encryptedChunk.data(), encryptedChunk.size()) };
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(requestBuffers, 3, "Failed to send upload repair chunk to server");
+	co_return OnUploadStateResponse(response, "Server refused to repair chunk at offset " + std::to_string(offset));
+}
+
+/* Return the offsets of the chunks the server received with a different crc than chunkCrcs, nullopt if the server can't verify chunks */
+std::optional<std::vector<uint64_t>> ClientLogic::OnUploadChunkCrcsResponse(const ResponseView& response, const std::vector<uint32_t>& chunkCrcs)
+{
+	// an older server answers the unknown request with a global error, the crc of the whole file is still checked on commit
+	if (!response || response.Code() != RESPONSE_UPLOAD_CHUNK_CRCS || !ClientLogic::ValidateResponse(response.Header(), RESPONSE_UPLOAD_CHUNK_CRCS))
+	{
+		LOG_WARNING("Server didn't verify the upload chunks, commit without verification");
+		return std::nullopt;
+	}
+
+	const auto payload = response.As<ResponseUploadChunkCrcsWithoutCrcs>().payload;
+	if (payload.chunkSize != UPLOAD_CHUNK_SIZE || payload.count != chunkCrcs.size()
+		|| response.PayloadSize() != PAYLOAD_SIZE<ResponseUploadChunkCrcsWithoutCrcs> + payload.count * sizeof(uint32_t)
+		|| response.Size() < sizeof(ResponseUploadChunkCrcsWithoutCrcs) + payload.count * sizeof(uint32_t))
+	{
+		throw FatalException("Received " + std::to_string(payload.count) + " chunk crcs of " + std::to_string(payload.chunkSize) + " bytes, expected " + std::to_string(chunkCrcs.size()));
+	}
+
+	std::vector<uint64_t> damaged;
+	const uint8_t* crcs = response.Payload() + sizeof(payload);
+	for (size_t i = 0; i < chunkCrcs.size(); ++i)
+	{
+		uint32_t crc;
+		memcpy(&crc, crcs + i * sizeof(crc), sizeof(crc));
+		Endianess::ToLittle(reinterpret_cast<uint8_t*>(&crc), sizeof(crc));
+		if (crc != chunkCrcs[i])
+		{
+			damaged.push_back(i * UPLOAD_CHUNK_SIZE);
+		}
+	}
+	return damaged;
+}
+
+std::optional<std::vector<uint64_t>> ClientLogic::VerifyUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, const std::vector<uint32_t>& chunkCrcs)
+{
+	RequestUploadVerify request(meInfo->GetClientID());
+	request.fileName = filename;
+
+	// not retried, a server that can't verify chunks answers with a global error
+	const auto wire = Serializer::Encode(request);
+	const auto response = socket.SendAndReceive(wire.data(), wire.size());
+	return OnUploadChunkCrcsResponse(response, chunkCrcs);
+}
+
+awaitable<std::optional<std::vector<uint64_t>>> ClientLogic::AsyncVerifyUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, const std::vector<uint32_t>& chunkCrcs)
+{
+	RequestUploadVerify request(meInfo->GetClientID());
+	request.fileName = filename;
+
+	const auto wire = Serializer::Encode(request);
+	const const_buffer buffer(wire.data(), wire.size());
+	const auto response = co_await socket.AsyncSendAndReceive(std::span<const const_buffer>(&buffer, 1));
+	co_return OnUploadChunkCrcsResponse(response, chunkCrcs);
+}
+
+uint32_t ClientLogic::CommitUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename)
+{
+	RequestUploadCommit request(meInfo->GetClientID());
+	request.fileName = filename;
+
+	const auto wire = Serializer::Encode(request);
+	const auto response = socket.RetryableSendAndReceive(wire.data(), wire.size(), 3, "Failed to send upload commit to server");
+	return OnUploadCrcResponse(response, filename);
+}
+
+awaitable<uint32_t> ClientLogic::AsyncCommitUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename)
+{
+	RequestUploadCommit request(meInfo->GetClientID());
+	request.fileName = filename;
+
+	const auto wire = Serializer::Encode(request);
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(wire.data(), wire.size(), 3, "Failed to send upload commit to server");
+	co_return OnUploadCrcResponse(response, filename);
+}
+
+// Encrypt plain with the upload cipher to the encrypted buffer, its segments numbered from firstSegment. Return the encrypted bytes.
+// The segments are encrypted under the nonces of send, the file nonce with its first 4 bytes xor the big endian send. Unnumbered sends are send 0
+std::span<const uint8_t> ClientLogic::EncryptUploadSegments(const AESWrapper& aesWrapper, const UploadCipher& cipher, uint64_t firstSegment, std::span<const uint8_t> plain, std::vector<uint8_t>& encrypted, uint32_t send)
+{
+	if (cipher.mode == CIPHER_AES_GCM_SEGMENTS)
+	{
+		auto nonce = cipher.nonce;
+		for (size_t i = 0; i < sizeof(send); ++i)
+		{
+			nonce[sizeof(send) - 1 - i] ^= static_cast<uint8_t>(send >> (8 * i));
+		}
+		encrypted.resize(AESWrapper::SegmentedCipherSize(plain.size()));
+		const size_t encryptedSize = aesWrapper.EncryptSegments(plain.data(), plain.size(), firstSegment, nonce.data(), encrypted.data());
+		return { encrypted.data(), encryptedSize };
+	}
+
+	encrypted.resize(AESWrapper::CipherSize(plain.size()));
+	const size_t encryptedSize = aesWrapper.Encrypt(plain.data(), plain.size(), encrypted.data(), encrypted.size());
+	return { encrypted.data(), encryptedSize };
+}
+
+// Encrypt the plain chunk at offset to the encrypted buffer, straight from the file source. Return the encrypted bytes
+std::span<const uint8_t> ClientLogic::EncryptUploadChunk(const AESWrapper& aesWrapper, const UploadCipher& cipher, uint64_t offset, std::span<const uint8_t> plain, std::vector<uint8_t>& encrypted, uint32_t send)
+{
+	return EncryptUploadSegments(aesWrapper, cipher, offset / CIPHER_SEGMENT_SIZE, plain, encrypted, send);
+}
+
+// Compress the plain chunk with the upload codec at level if it gets smaller, then encrypt it as send. Return the encrypted bytes, codec tells which of the two they are.
+// The caller never passes a send twice in a numbered upload: the bytes of another level, or of a file written meanwhile, may go to the same segment indexes,
+// and GCM must not see two plaintexts under one nonce
+std::span<const uint8_t> ClientLogic::EncodeUploadChunk(const AESWrapper& aesWrapper, const UploadCipher& cipher, uint64_t offset, std::span<const uint8_t> plain, int level, uint32_t send,
+	std::vector<uint8_t>& compressed, std::vector<uint8_t>& encrypted, Codec& codec)
+{
+	const size_t compressedSize = cipher.codec == CODEC_ZLIB ? Compression::Compress(plain, level, compressed) : 0;
+	codec = compressedSize > 0 ? CODEC_ZLIB : CODEC_NONE;
+	return EncryptUploadChunk(aesWrapper, cipher, offset, compressedSize > 0 ? std::span<const uint8_t>(compressed.data(), compressedSize) : plain, encrypted, send);
+}
+
+// Check the offset the server acknowledged after a chunk, a different offset than expected (e.g. its ack got lost) is followed a limited number of times
+void ClientLogic::CheckAcknowledged(const FileName& filename, uint64_t expected, uint64_t acknowledged, uint64_t fileSize, int& resyncsLeft)
+{
+	if (acknowledged != expected && (acknowledged > fileSize || resyncsLeft-- == 0))
+	{
+		throw FatalException("Upload of " + filename.ToString() + " is out of sync with the server");
+	}
+}
+
+// Extend the crcs of the file start up to end, whether the bytes were just sent or skipped by a resume or resync. Rewinds are already covered.
+// The server acknowledges whole chunks, so the crcs always end at a chunk boundary or at the end of the file
+void ClientLogic::UpdateUploadCrcs(const FileSource& source, UploadCrcs& crcs, uint64_t end)
+{
+	const uint64_t start = crcs.file.Length();
+	if (end <= start)
+	{
+		return;
+	}
+
+	const size_t first = crcs.chunks.size();
+	const size_t count = static_cast<size_t>((end - start + UPLOAD_CHUNK_SIZE - 1) / UPLOAD_CHUNK_SIZE);
+	crcs.chunks.resize(first + count);
+	WorkerPool::Shared().ParallelFor(count, [&](size_t i) // parallel for a long skip
+		{
+			const uint64_t offset = start + i * UPLOAD_CHUNK_SIZE;
+			const auto bytes = source.Bytes(offset, std::min<uint64_t>(UPLOAD_CHUNK_SIZE, end - offset));
+			crcs.chunks[first + i] = Crc32::Calculate(bytes.data(), bytes.size());
+		});
+	for (size_t i = first; i < crcs.chunks.size(); ++i)
+	{
+		crcs.file.Combine(crcs.chunks[i], std::min<uint64_t>(UPLOAD_CHUNK_SIZE, end - crcs.file.Length()));
+	}
+}
+
+/*
+ * Compare the crc of every chunk the server received with chunkCrcs and resend only the chunks that differ,
+ * so the retry of a damaged upload costs the damaged chunks and not the whole file. Stop after MAX_UPLOAD_REPAIRS rounds,
+ * the commit crc then tells the caller the upload is still damaged
+ */
+void ClientLogic::RepairUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper, const UploadCipher& cipher, const FileName& filename,
+	const FileSource& source, const std::vector<uint32_t>& chunkCrcs, uint32_t& sends)
+{
+	std::vector<uint8_t> encrypted;
+	for (int round = 0; round < MAX_UPLOAD_REPAIRS; ++round)
+	{
+		const auto damaged = VerifyUpload(socket, meInfo, filename, chunkCrcs);
+		if (!damaged || damaged->empty())
+		{
+			return;
+		}
+
+		LOG_WARNING("Server received " << damaged->size() << " damaged chunks of " << filename << ", resend them");
+		for (const uint64_t offset : *damaged)
+		{
+			const auto chunk = source.Bytes(offset, std::min<uint64_t>(UPLOAD_CHUNK_SIZE, source.Size() - offset));
+			if (cipher.numbered)
+			{
+				const uint32_t send = ++sends;
+				SendUploadNumberedRepairChunk(socket, meInfo, filename, offset, send, EncryptUploadChunk(aesWrapper, cipher, offset, chunk, encrypted, send));
+			}
+			else
+			{
+				SendUploadRepairChunk(socket, meInfo, filename, offset, EncryptUploadChunk(aesWrapper, cipher, offset, chunk, encrypted));
+			}
+		}
+	}
+}
+
+awaitable<void> ClientLogic::AsyncRepairUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper, UploadCipher cipher, FileName filename,
+	const FileSource& source, const std::vector<uint32_t>& chunkCrcs, uint32_t& sends)
+{
+	std::vector<uint8_t> encrypted;
+	for (int round = 0; round < MAX_UPLOAD_REPAIRS; ++round)
+	{
+		const auto damaged = co_await AsyncVerifyUpload(socket, meInfo, filename, chunkCrcs);
+		if (!damaged || damaged->empty())
+		{
+			co_return;
+		}
+
+		LOG_WARNING("Server received " << damaged->size() << " damaged chunks of " << filename << ", resend them");
+		for (const uint64_t offset : *damaged)
+		{
+			const uint32_t send = cipher.numbered ? ++sends : 0;
+			const auto encryptedChunk = co_await Transport::Instance().Compute([&]()
+				{
+					return EncryptUploadChunk(*aesWrapper, cipher, offset, source.Bytes(offset, std::min<uint64_t>(UPLOAD_CHUNK_SIZE, source.Size() - offset)), encrypted, send);
+				});
+			if (cipher.numbered)
+			{
+				co_await AsyncSendUploadNumberedRepairChunk(socket, meInfo, filename, offset, send, encryptedChunk);
+			}
+			else
+			{
+				co_await AsyncSendUploadRepairChunk(socket, meInfo, filename, offset, encryptedChunk);
+			}
+		}
+	}
+}
+
+/*
+ * Upload file that may be larger than memory in chunks of UPLOAD_CHUNK_SIZE, each chunk encrypted on its own.
+ * The chunks are encrypted in parallel segments if the server accepts CIPHER_AES_GCM_SEGMENTS, otherwise with CBC.
+ * Unless the file is already compressed, chunks are compressed before they are encrypted if the server accepts CODEC_ZLIB.
+ * Resume from the offset the server already acknowledged, so a dropped connection or restart doesn't start over.
+ * The chunks are read, checksummed and encrypted by an UploadPipeline of memoryBudget bytes while earlier chunks are sent.
+ * A file the server stored before is sent as a delta against it when most of it is unchanged.
+ * Before commit the chunks the server received damaged are found by their crcs and sent again.
+ * Return crc that received from the server, fileCrc is the crc of the file computed while its chunks are read
+ */
+uint32_t ClientLogic::UploadFile(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const std::shared_ptr<AESWrapper>& aesWrapper, const FileName& filename,
+	const FileSource& source, uint32_t& fileCrc, size_t memoryBudget)
+{
+	const uint64_t fileSize = source.Size();
+
+	int resyncsLeft = MAX_UPLOAD_RESYNCS;
+	auto cipher = NewUploadCipher(source);
+	uint64_t offset = BeginUpload(socket, meInfo, filename, fileSize, cipher);
+	if (offset > 0)
+	{
+		LOG_INFO("Resume upload of " << filename << " from offset " << offset);
+	}
+
+	uint32_t sends = 0;
+	offset = UploadDelta(socket, meInfo, *aesWrapper, cipher, filename, source, offset, resyncsLeft, sends);
+
+	UploadPipeline pipeline(source, *aesWrapper, cipher, memoryBudget, sends);
+	pipeline.Start(offset);
+	while (offset < fileSize)
+	{
+		const auto chunk = pipeline.Next();
+		if (chunk == nullptr)
+		{
+			throw std::runtime_error("Upload of " + filename.ToString() + " ended before offset " + std::to_string(offset));
+		}
+		const uint64_t expected = chunk->offset + chunk->plain.size();
+		const uint64_t acknowledged = cipher.numbered ? SendUploadNumberedChunk(socket, meInfo, filename, chunk->offset, chunk->send, chunk->codec, chunk->payload)
+			: SendUploadChunk(socket, meInfo, filename, chunk->offset, chunk->payload);
+		pipeline.Release(chunk);
+		CheckAcknowledged(filename, expected, acknowledged, fileSize, resyncsLeft);
+		if (acknowledged != expected && acknowledged < fileSize)
+		{
+			pipeline.Start(acknowledged); // the chunks read ahead are from the wrong offset
+		}
+		offset = acknowledged;
+	}
+
+	fileCrc = pipeline.FileCrc();
+	RepairUpload(socket, meInfo, *aesWrapper, cipher, filename, source, pipeline.ChunkCrcs(), sends);
+	return CommitUpload(socket, meInfo, filename);
+}
+
+awaitable<uint32_t> ClientLogic::AsyncUploadFile(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper, FileName filename,
+	const FileSource& source, uint32_t& fileCrc)
+{
+	const uint64_t fileSize = source.Size();
+
+	int resyncsLeft = MAX_UPLOAD_RESYNCS;
+	auto cipher = NewUploadCipher(source);
+	uint64_t offset = co_await AsyncBeginUpload(socket, meInfo, filename, fileSize, cipher);
+	if (offset > 0)
+	{
+		LOG_INFO("Resume upload of " << filename << " from offset " << offset);
+	}
+
+	uint32_t sends = 0;
+	offset = co_await AsyncUploadDelta(socket, meInfo, aesWrapper, cipher, filename, source, offset, resyncsLeft, sends);
+
+	// the crcs, compression and encryption of each chunk run on a compute thread, the io_context thread keeps serving the other transfers.
+	// The level adapts like in the upload pipeline: up while a chunk takes the network longer than its encoding, down while the encoding takes longer
+	auto& transport = Transport::Instance();
+	UploadCrcs crcs;
+	std::vector<uint8_t> compressed;
+	std::vector<uint8_t> encrypted;
+	int level = Compression::MIN_LEVEL;
+	while (offset < fileSize)
+	{
+		const uint64_t length = std::min<uint64_t>(UPLOAD_CHUNK_SIZE, fileSize - offset);
+		Codec codec = CODEC_NONE;
+		const uint32_t send = cipher.numbered ? ++sends : 0;
+		const auto encodeStart = std::chrono::steady_clock::now();
+		const auto encryptedChunk = co_await transport.Compute([&]()
+			{
+				UpdateUploadCrcs(source, crcs, offset + length);
+				return EncodeUploadChunk(*aesWrapper, cipher, offset, source.Bytes(offset, length), level, send, compressed, encrypted, codec);
+			});
+		const auto sendStart = std::chrono::steady_clock::now();
+		const uint64_t acknowledged = cipher.numbered ? co_await AsyncSendUploadNumberedChunk(socket, meInfo, filename, offset, send, codec, encryptedChunk)
+			: co_await AsyncSendUploadChunk(socket, meInfo, filename, offset, encryptedChunk);
+		const auto encodeTime = sendStart - encodeStart;
+		const auto sendTime = std::chrono::steady_clock::now() - sendStart;
+		level = Compression::NextLevel(level, sendTime >= 2 * encodeTime, encodeTime > sendTime);
+		CheckAcknowledged(filename, offset + length, acknowledged, fileSize, resyncsLeft);
+		offset = acknowledged;
+	}
+
+	co_await transport.Compute([&]() { UpdateUploadCrcs(source, crcs, fileSize); });
+	fileCrc = crcs.file.Value();
+	co_await AsyncRepairUpload(socket, meInfo, aesWrapper, cipher, filename, source, crcs.chunks, sends);
+	co_return co_await AsyncCommitUpload(socket, meInfo, filename);
+}
+
+// Final crc result of an uploaded file, valid or invalid for the last time, both acknowledged by the server
+std::array<uint8_t, sizeof(RequestValidCrc)> ClientLogic::MakeCrcResultRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, bool valid)
+{
+	if (valid)
+	{
+		RequestValidCrc request(meInfo->GetClientID());
+		request.fileName = filename;
+		return Serializer::Encode(request);
+	}
+
+	RequestInvalidCrcFinish request(meInfo->GetClientID());
+	request.fileName = filename;
+	return Serializer::Encode(request);
+}
+
+/* Return true if the server acknowledged the crc result */
+awaitable<bool> ClientLogic::AsyncSendCrcResult(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, bool valid)
+{
+	const auto wire = MakeCrcResultRequest(meInfo, filename, valid);
+	const auto response = co_await socket.AsyncRetryableSendAndReceive(wire.data(), wire.size(), 3, "Failed to send crc result to server");
+	co_return response && ValidateResponse(response.Header(), RESPONSE_MSG_RECEIVED);
+}
@@ -2,18 +2,144 @@
 #include "Protocol.h"
 #include "AESWrapper.h"
 #include "MeInfo.hpp"
+#include "ClientSocket.h"
+#include "SessionTicket.h"
+#include "Crc32.h"
+#include "FileSource.h"
+#include "Delta.h"
+#include <vector>
+#include <array>
+#include <span>
+#include <optional>
 
-// Client logical functional, each method send request and extract data from server response
+// Cipher of one upload and the compression of its chunks before they are encrypted, negotiated with the server on upload begin
+struct UploadCipher
+{
+	CipherMode mode = CIPHER_AES_GCM_SEGMENTS;
+	std::array<uint8_t, CIPHER_NONCE_SIZE> nonce{};
+	Codec codec = CODEC_NONE;
+	bool numbered = false; // the server took REQUEST_UPLOAD_BEGIN_CODEC, each chunk, repair and delta message is encrypted under a send of its own
+};
+
+// Answer of the server to an upload precheck
+struct UploadPrecheck
+{
+	bool supported = false;            // the server stores uploads by the digest of their content
+	std::optional<uint32_t> storedCrc; // the server already had the content and stored the file from it, crc of the stored file
+};
+
+// Crcs of an upload, of the whole file and of every UPLOAD_CHUNK_SIZE chunk, computed up to file.Length()
+struct UploadCrcs
+{
+	Crc32 file;
+	std::vector<uint32_t> chunks;
+};
+
+// Client logical functional, each method send request over the given socket and extract data from server response.
+// The Async methods do the same without blocking the thread, many of them can run concurrently on the io_context of their sockets.
+// Their arguments are taken by value where they are kept in the coroutine frame.
 class ClientLogic
 {
 	ClientLogic() = delete;
+	friend class UploadPipeline; // its stages read, checksum and encrypt chunks like UploadFile
+
+	constexpr static int MAX_UPLOAD_RESYNCS = 3;
+	constexpr static int MAX_UPLOAD_REPAIRS = 3; // rounds of verify and resend of the damaged chunks before commit
+	constexpr static uint64_t DELTA_MAX_LITERAL_PERCENT = 50; // a delta with more literal bytes of the file is sent as chunks, encrypted in parallel
+
+	static bool OnRegisterResponse(const ResponseView& response, ClientID& clientID);
+	static RequestPublicKey MakePublicKeyRequest(const std::shared_ptr<MeInfo>& meInfo, const std::string& publicKey);
+	static RequestVariablePublicKeyWithoutKey MakeVariablePublicKeyRequest(const std::shared_ptr<MeInfo>& meInfo, const std::string& publicKey);
+	static RequestSendFileWithoutContent MakeSendFileRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, size_t contentSize);
+	static uint32_t OnSendFileResponse(const ResponseView& response);
+	static RequestReconnect MakeReconnectRequest(const std::shared_ptr<MeInfo>& meInfo);
+	static std::shared_ptr<AESWrapper> OnReconnectResponse(const std::shared_ptr<MeInfo>& meInfo, const ResponseView& response);
+	static uint64_t OnUploadStateResponse(const ResponseView& response, const std::string& errorDesc);
+	static uint32_t OnUploadCrcResponse(const ResponseView& response, const FileName& filename);
+	static RequestUploadChunkWithoutContent MakeUploadChunkRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, size_t chunkSize);
+	static RequestUploadNumberedChunkWithoutContent MakeUploadNumberedChunkRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, Codec codec, size_t chunkSize);
+	static UploadCipher NewUploadCipher(const FileSource& source);
+	static RequestUploadBeginCipher MakeUploadBeginCipherRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t fileSize, const UploadCipher& cipher);
+	static bool OnUploadBeginCipherResponse(const ResponseView& response, UploadCipher& cipher);
+	static RequestUploadBeginCodec MakeUploadBeginCodecRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t fileSize, const UploadCipher& cipher);
+	static bool OnUploadBeginCodecResponse(const ResponseView& response, UploadCipher& cipher);
+	static std::span<const uint8_t> EncryptUploadSegments(const AESWrapper& aesWrapper, const UploadCipher& cipher, uint64_t firstSegment, std::span<const uint8_t> plain, std::vector<uint8_t>& encrypted, uint32_t send);
+	static std::span<const uint8_t> EncryptUploadChunk(const AESWrapper& aesWrapper, const UploadCipher& cipher, uint64_t offset, std::span<const uint8_t> plain, std::vector<uint8_t>& encrypted, uint32_t send = 0);
+	static std::span<const uint8_t> EncodeUploadChunk(const AESWrapper& aesWrapper, const UploadCipher& cipher, uint64_t offset, std::span<const uint8_t> plain, int level, uint32_t send,
+		std::vector<uint8_t>& compressed, std::vector<uint8_t>& encrypted, Codec& codec);
+	static bool OnResumptionTicketResponse(const ResponseView& response, const AESWrapper& aesWrapper);
+	static RequestResume MakeResumeRequest(const std::shared_ptr<MeInfo>& meInfo, const SessionTicket& ticket);
+	static std::shared_ptr<AESWrapper> OnResumeResponse(const SessionTicket& ticket, const RequestResume& request, const ResponseView& response);
+	static void CheckAcknowledged(const FileName& filename, uint64_t expected, uint64_t acknowledged, uint64_t fileSize, int& resyncsLeft);
+	static void UpdateUploadCrcs(const FileSource& source, UploadCrcs& crcs, uint64_t end);
+	static RequestUploadPrecheck MakeUploadPrecheckRequest(const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper, const FileName& filename, uint64_t fileSize, const ContentDigest& digest);
+	static UploadPrecheck OnUploadPrecheckResponse(const ResponseView& response, const FileName& filename);
+	static std::optional<Delta::Base> OnUploadSignaturesResponse(const ResponseView& response);
+	static RequestUploadDeltaWithoutContent MakeUploadDeltaRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, size_t contentSize);
+	static RequestUploadNumberedDeltaWithoutContent MakeUploadNumberedDeltaRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, size_t contentSize);
+	static std::optional<std::vector<Delta::Op>> ComputeUploadDelta(const FileName& filename, const FileSource& source, uint64_t offset, const std::optional<Delta::Base>& base);
+	static uint64_t UploadDelta(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper, const UploadCipher& cipher, const FileName& filename,
+		const FileSource& source, uint64_t offset, int& resyncsLeft, uint32_t& sends);
+	static awaitable<uint64_t> AsyncUploadDelta(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper, UploadCipher cipher, FileName filename,
+		const FileSource& source, uint64_t offset, int& resyncsLeft, uint32_t& sends);
+	static RequestUploadRepairChunkWithoutContent MakeUploadRepairChunkRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, size_t chunkSize);
+	static RequestUploadNumberedRepairChunkWithoutContent MakeUploadNumberedRepairChunkRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, size_t chunkSize);
+	static std::optional<std::vector<uint64_t>> OnUploadChunkCrcsResponse(const ResponseView& response, const std::vector<uint32_t>& chunkCrcs);
+	static void RepairUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper, const UploadCipher& cipher, const FileName& filename,
+		const FileSource& source, const std::vector<uint32_t>& chunkCrcs, uint32_t& sends);
+	static awaitable<void> AsyncRepairUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper, UploadCipher cipher, FileName filename,
+		const FileSource& source, const std::vector<uint32_t>& chunkCrcs, uint32_t& sends);
+	static std::array<uint8_t, sizeof(RequestValidCrc)> MakeCrcResultRequest(const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, bool valid);
+
 public:
+	constexpr static size_t DEFAULT_UPLOAD_MEMORY_BUDGET = 16 * 1024 * 1024; // chunk buffers of the upload pipeline
+
 	static bool IsGlobalError(const ResponseHeader& header);
 	static bool ValidateResponse(const ResponseHeader& header, const ResponseCode expectedCode);
-	static bool Register(const ClientName& clientName, const std::string& ip, int port, ClientID& clientID);
-	static std::shared_ptr<AESWrapper> ExtractAesFromResponse(const std::shared_ptr<MeInfo>& meInfo, uint8_t* response, ResponseCode excpectedCode);
-	static std::shared_ptr<AESWrapper> SendPublicKey(const std::shared_ptr<MeInfo>& meInfo, const std::string& ip, int port);
-	static uint32_t SendFileContent(const std::shared_ptr<MeInfo>& meInfo, const std::string& ip, int port, const FileName& filename, const std::string& content);
-	static std::shared_ptr<AESWrapper> SendReconnect(const std::shared_ptr<MeInfo>& meInfo, const std::string& ip, int port);
-};
+	static bool Register(ClientSocket& socket, const ClientName& clientName, ClientID& clientID);
+	static std::shared_ptr<AESWrapper> ExtractAesFromResponse(const std::shared_ptr<MeInfo>& meInfo, const ResponseView& response, ResponseCode excpectedCode);
+	static std::shared_ptr<AESWrapper> SendPublicKey(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo);
+	static uint32_t SendFileContent(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, const std::string& content);
+	static std::shared_ptr<AESWrapper> SendReconnect(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo);
+	static bool RequestTicket(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper);
+	static std::shared_ptr<AESWrapper> SendResume(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo);
+	static ContentDigest DigestContent(const FileSource& source);
+	static bool ProbeUploadPrecheck(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper, const FileName& filename, uint64_t fileSize);
+	static UploadPrecheck PrecheckUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const AESWrapper& aesWrapper, const FileName& filename, uint64_t fileSize, const ContentDigest& digest);
+	static uint64_t BeginUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t fileSize);
+	static uint64_t BeginUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t fileSize, UploadCipher& cipher);
+	static uint64_t SendUploadChunk(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, std::span<const uint8_t> encryptedChunk);
+	static uint64_t SendUploadNumberedChunk(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, Codec codec, std::span<const uint8_t> encryptedChunk);
+	static std::optional<Delta::Base> GetUploadSignatures(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename);
+	static uint64_t SendUploadDelta(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, std::span<const uint8_t> encryptedDelta);
+	static uint64_t SendUploadNumberedDelta(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, std::span<const uint8_t> encryptedDelta);
+	static std::optional<std::vector<uint64_t>> VerifyUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, const std::vector<uint32_t>& chunkCrcs);
+	static uint64_t SendUploadRepairChunk(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, std::span<const uint8_t> encryptedChunk);
+	static uint64_t SendUploadNumberedRepairChunk(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename, uint64_t offset, uint32_t send, std::span<const uint8_t> encryptedChunk);
+	static uint32_t CommitUpload(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const FileName& filename);
+	static uint32_t UploadFile(ClientSocket& socket, const std::shared_ptr<MeInfo>& meInfo, const std::shared_ptr<AESWrapper>& aesWrapper, const FileName& filename,
+		const FileSource& source, uint32_t& fileCrc, size_t memoryBudget = DEFAULT_UPLOAD_MEMORY_BUDGET);
 
+	static awaitable<bool> AsyncRegister(ClientSocket& socket, const ClientName& clientName, ClientID& clientID);
+	static awaitable<std::shared_ptr<AESWrapper>> AsyncSendPublicKey(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo);
+	static awaitable<uint32_t> AsyncSendFileContent(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, const std::string& content);
+	static awaitable<std::shared_ptr<AESWrapper>> AsyncSendReconnect(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo);
+	static awaitable<bool> AsyncRequestTicket(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper);
+	static awaitable<std::shared_ptr<AESWrapper>> AsyncSendResume(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo);
+	static awaitable<bool> AsyncProbeUploadPrecheck(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper, FileName filename, uint64_t fileSize);
+	static awaitable<UploadPrecheck> AsyncPrecheckUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper, FileName filename, uint64_t fileSize, ContentDigest digest);
+	static awaitable<uint64_t> AsyncBeginUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t fileSize);
+	static awaitable<uint64_t> AsyncBeginUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t fileSize, UploadCipher& cipher);
+	static awaitable<uint64_t> AsyncSendUploadChunk(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, std::span<const uint8_t> encryptedChunk);
+	static awaitable<uint64_t> AsyncSendUploadNumberedChunk(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, uint32_t send, Codec codec, std::span<const uint8_t> encryptedChunk);
+	static awaitable<std::optional<Delta::Base>> AsyncGetUploadSignatures(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename);
+	static awaitable<uint64_t> AsyncSendUploadDelta(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, std::span<const uint8_t> encryptedDelta);
+	static awaitable<uint64_t> AsyncSendUploadNumberedDelta(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, uint32_t send, std::span<const uint8_t> encryptedDelta);
+	static awaitable<std::optional<std::vector<uint64_t>>> AsyncVerifyUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, const std::vector<uint32_t>& chunkCrcs);
+	static awaitable<uint64_t> AsyncSendUploadRepairChunk(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, std::span<const uint8_t> encryptedChunk);
+	static awaitable<uint64_t> AsyncSendUploadNumberedRepairChunk(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, uint64_t offset, uint32_t send, std::span<const uint8_t> encryptedChunk);
+	static awaitable<uint32_t> AsyncCommitUpload(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename);
+	static awaitable<uint32_t> AsyncUploadFile(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, std::shared_ptr<AESWrapper> aesWrapper, FileName filename,
+		const FileSource& source, uint32_t& fileCrc);
+	static awaitable<bool> AsyncSendCrcResult(ClientSocket& socket, std::shared_ptr<MeInfo> meInfo, FileName filename, bool valid);
+};
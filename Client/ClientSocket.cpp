@@ -1,15 +1,38 @@
 #include "ClientSocket.h"
-#include "Endianess.h"
 #include <boost/asio.hpp>
 #include "Protocol.h"
-#include <iostream>
 #include "ClientLogic.h"
 #include "FatalError.h"
+#include "ResolverCache.h"
+#include "Log.h"
+#include <array>
+#include <vector>
+#include <thread>
+#include <boost/asio/steady_timer.hpp>
 
 using boost::asio::ip::tcp;
 using boost::asio::io_context;
+using boost::asio::use_awaitable;
+using boost::asio::redirect_error;
 
-ClientSocket::ClientSocket(const std::string& address, const std::string& port)
+static const uint8_t PACKET_PADDING[PACKET_SIZE] = { 0 }; // Zeros that pad a request to whole packets
+
+ClientSocket::ClientSocket(const std::string& address, const std::string& port, bool sessionMode) : m_ioContext(std::make_unique<io_context>()), m_sessionMode(sessionMode)
+{
+	Init(*m_ioContext, address, port);
+}
+
+ClientSocket::ClientSocket(const std::string& address, int port, bool sessionMode) : ClientSocket(address, std::to_string(port), sessionMode)
+{
+}
+
+// Socket on a shared io_context, many sockets can run their async requests concurrently on the thread that runs it
+ClientSocket::ClientSocket(io_context& ioContext, const std::string& address, const std::string& port, bool sessionMode) : m_sessionMode(sessionMode)
+{
+	Init(ioContext, address, port);
+}
+
+void ClientSocket::Init(io_context& ioContext, const std::string& address, const std::string& port)
 {
 	if (!IsValidAddress(address))
 	{
@@ -23,13 +46,9 @@ ClientSocket::ClientSocket(const std::string& address, const std::string& port)
 
 	m_address = address;
 	m_port = port;
-	m_ioContext = std::make_unique<io_context>();
-	m_resolver = std::make_unique<tcp::resolver>(*m_ioContext);
-	m_socket = std::make_unique<tcp::socket>(*m_ioContext);
-}
-
-ClientSocket::ClientSocket(const std::string& address, int port) : ClientSocket(address, std::to_string(port))
-{
+	m_resolver = std::make_unique<tcp::resolver>(ioContext);
+	m_socket = std::make_unique<tcp::socket>(ioContext);
+	m_breaker = CircuitBreaker::ForEndpoint(address + ":" + port);
 }
 
 ClientSocket::~ClientSocket()
@@ -68,22 +87,77 @@ bool ClientSocket::IsValidPort(const std::string& port)
 }
 
 
-// Clear socket and connect to new socket
+// Clear socket and connect to new socket, the address is resolved only when its cached endpoints expired
 bool ClientSocket::Connect()
 {
 	try
 	{
-		boost::asio::connect(*m_socket, m_resolver->resolve(m_address, m_port, tcp::resolver::query::canonical_name));
+		boost::asio::connect(*m_socket, ResolverCache::Shared().Resolve(*m_resolver, m_address, m_port));
 		m_socket->non_blocking(false);
 		m_connected = true;
 	}
 	catch(...)
 	{
+		ResolverCache::Shared().Invalidate(m_address, m_port);
 		m_connected = false;
 	}
 	return m_connected;
 }
 
+// Connect asynchronously, return false if failed
+awaitable<bool> ClientSocket::AsyncConnect()
+{
+	boost::system::error_code errorCode;
+	auto endpoints = ResolverCache::Shared().Find(m_address, m_port);
+	if (!endpoints)
+	{
+		endpoints = co_await m_resolver->async_resolve(m_address, m_port, redirect_error(use_awaitable, errorCode));
+		if (!errorCode)
+		{
+			ResolverCache::Shared().Store(m_address, m_port, *endpoints);
+		}
+	}
+	if (!errorCode)
+	{
+		co_await boost::asio::async_connect(*m_socket, *endpoints, redirect_error(use_awaitable, errorCode));
+	}
+	if (errorCode)
+	{
+		ResolverCache::Shared().Invalidate(m_address, m_port);
+	}
+	m_connected = !errorCode;
+	co_return m_connected;
+}
+
+// True if the open connection belongs to a confirmed session that is not idle for too long and can be reused
+bool ClientSocket::IsReusable() const
+{
+	return m_connected && m_keepAlive && (std::chrono::steady_clock::now() - m_lastActivity) < SESSION_IDLE_TIMEOUT;
+}
+
+// Reuse the open connection of a confirmed session, otherwise connect again
+bool ClientSocket::EnsureConnected()
+{
+	if (IsReusable())
+	{
+		return true;
+	}
+
+	Close();
+	return Connect();
+}
+
+awaitable<bool> ClientSocket::AsyncEnsureConnected()
+{
+	if (IsReusable())
+	{
+		co_return true;
+	}
+
+	Close();
+	co_return co_await AsyncConnect();
+}
+
 
 // Close socket and clear it
 void ClientSocket::Close()
@@ -95,159 +169,356 @@ void ClientSocket::Close()
 	}
 	catch (...) {} // Do Nothing
 	m_connected = false;
+	m_keepAlive = false;
+}
+
+// Done with the current request, keep the connection open only if the server confirmed the session
+void ClientSocket::Release()
+{
+	if (!m_keepAlive)
+	{
+		Close();
+		return;
+	}
+	m_lastActivity = std::chrono::steady_clock::now();
 }
 
 
 /**
- * Receive size bytes from _socket to buffer.
- * Return false if unable to receive expected size bytes.
+ * Receive wireSize bytes from _socket, the first size bytes straight to buffer in wire order and the rest are packet padding that is dropped.
+ * Return false if unable to receive expected wireSize bytes.
  */
-bool ClientSocket::Receive(uint8_t* const buffer, const size_t size, size_t packetSize) const
+bool ClientSocket::Receive(uint8_t* const buffer, const size_t size, const size_t wireSize)
 {
-	if (m_socket == nullptr || buffer == nullptr || size == 0 || !m_connected)
+	if (m_socket == nullptr || (buffer == nullptr && size > 0) || wireSize < size || !m_connected)
 	{
 		return false;
 	}
 
-	size_t bytesLeft = size;
-	uint8_t* ptr = buffer;
-	while (bytesLeft > 0)
+	boost::system::error_code errorCode; // read() will not throw exception when error_code is passed as argument.
+	if (size > 0)
 	{
-		uint8_t* tempBuffer = new uint8_t[packetSize] { 0 };
-		boost::system::error_code errorCode; // read() will not throw exception when error_code is passed as argument.
-		
-		size_t bytesRead = read(*m_socket, boost::asio::buffer(tempBuffer, packetSize), errorCode); // receive bytes in little endian
-		if (bytesRead == 0)
+		const size_t bytesRead = read(*m_socket, boost::asio::buffer(buffer, size), errorCode); // receive bytes in little endian
+		if (bytesRead != size)
 		{
-			delete[] tempBuffer;
 			return false;     // Failed receiving and shouldn't use buffer.
 		}
+	}
 
-		if (!Endianess::IsLittleEndian())
+	size_t paddingLeft = wireSize - size;
+	while (paddingLeft > 0)
+	{
+		const size_t paddingSize = (paddingLeft > m_padding.size()) ? m_padding.size() : paddingLeft;
+		if (read(*m_socket, boost::asio::buffer(m_padding.data(), paddingSize), errorCode) != paddingSize)
 		{
-			Endianess::Swap(tempBuffer, bytesRead); // It's required to convert from little endian to big endian.
+			return false;
 		}
-		
-		const size_t bytesToCopy = (bytesLeft > bytesRead) ? bytesRead : bytesLeft;  // prevent buffer overflow.
-		memcpy(ptr, tempBuffer, bytesToCopy);
-		ptr += bytesToCopy;
-		bytesLeft = (bytesLeft < bytesToCopy) ? 0 : (bytesLeft - bytesToCopy);  // unsigned protection.
-		delete[] tempBuffer;
-	}
-	
+		paddingLeft -= paddingSize;
+	}
+
 	return true;
 }
 
+awaitable<bool> ClientSocket::AsyncReceive(uint8_t* const buffer, const size_t size, const size_t wireSize)
+{
+	if (m_socket == nullptr || (buffer == nullptr && size > 0) || wireSize < size || !m_connected)
+	{
+		co_return false;
+	}
+
+	boost::system::error_code errorCode;
+	if (size > 0)
+	{
+		const size_t bytesRead = co_await async_read(*m_socket, boost::asio::buffer(buffer, size), redirect_error(use_awaitable, errorCode));
+		if (bytesRead != size)
+		{
+			co_return false;
+		}
+	}
+
+	size_t paddingLeft = wireSize - size;
+	while (paddingLeft > 0)
+	{
+		const size_t paddingSize = (paddingLeft > m_padding.size()) ? m_padding.size() : paddingLeft;
+		if (co_await async_read(*m_socket, boost::asio::buffer(m_padding.data(), paddingSize), redirect_error(use_awaitable, errorCode)) != paddingSize)
+		{
+			co_return false;
+		}
+		paddingLeft -= paddingSize;
+	}
+
+	co_return true;
+}
+
 /**
- * Send size bytes from buffer to _socket.
- * Return false if unable to send expected size bytes.
+ * Handle the response header received to the response buffer and make room for the payload.
+ * The response version tells its framing, exact for the current version or padded to whole packets for an older server.
+ * Set wireSize to the bytes left of the response on the wire (payload and padding), return false if the header is broken.
  */
-bool ClientSocket::Send(const uint8_t* const buffer, const size_t size) const
+bool ClientSocket::OnResponseHeader(size_t& wireSize)
 {
-	if (m_socket == nullptr || !m_connected || buffer == nullptr || size == 0)
+	uint8_t& version = m_responseBuffer[offsetof(ResponseHeader, version)];
+	m_keepAlive = m_sessionMode && (version & VERSION_FLAG_KEEP_ALIVE);
+	version &= VERSION_MASK;
+	const auto resHeader = Serializer::Decode<ResponseHeader>(m_responseBuffer.data());
+	const uint32_t payloadSize = resHeader.payloadSize;
+	if (payloadSize > MAX_RESPONSE_PAYLOAD_SIZE || resHeader.version > CLIENT_VERSION)
+	{
 		return false;
-	
-	size_t bytesLeft   = size;
-	const uint8_t* ptr = buffer;
-	while (bytesLeft > 0)
+	}
+
+	// an older server doesn't understand exact framing, speak its version from now on
+	m_peerVersion = resHeader.version;
+	m_responseBuffer.resize(sizeof(ResponseHeader) + payloadSize);
+	wireSize = payloadSize;
+	if (IsPadded(resHeader.version))
 	{
-		boost::system::error_code errorCode; // write() will not throw exception when error_code is passed as argument.
-		uint8_t tempBuffer[PACKET_SIZE] = { 0 };
-		const size_t bytesToSend = (bytesLeft > PACKET_SIZE) ? PACKET_SIZE : bytesLeft;
-		
-		memcpy(tempBuffer, ptr, bytesToSend);
+		// consume the padding so a kept alive connection stays aligned
+		const size_t framedSize = ((sizeof(ResponseHeader) + payloadSize + PACKET_SIZE - 1) / PACKET_SIZE) * PACKET_SIZE;
+		wireSize = framedSize - sizeof(ResponseHeader);
+	}
+	return true;
+}
 
-		Endianess::ToLittle(tempBuffer, bytesToSend); // need to send data in little endian for compatibility between client and server
+// Receive one response to the reused response buffer, return empty view if failed
+ResponseView ClientSocket::ReceiveResponse()
+{
+	m_responseBuffer.resize(sizeof(ResponseHeader));
+	if (!Receive(m_responseBuffer.data(), sizeof(ResponseHeader), sizeof(ResponseHeader)))
+	{
+		return {};
+	}
 
-		const size_t bytesWritten = write(*m_socket, boost::asio::buffer(tempBuffer, PACKET_SIZE), errorCode);
-		if (bytesWritten == 0)
-		{
-			return false;
-		}
+	size_t wireSize = 0;
+	if (!OnResponseHeader(wireSize) || !Receive(m_responseBuffer.data() + sizeof(ResponseHeader), m_responseBuffer.size() - sizeof(ResponseHeader), wireSize))
+	{
+		return {};
+	}
+	return ResponseView(m_responseBuffer.data(), m_responseBuffer.size());
+}
+
+awaitable<ResponseView> ClientSocket::AsyncReceiveResponse()
+{
+	m_responseBuffer.resize(sizeof(ResponseHeader));
+	if (!co_await AsyncReceive(m_responseBuffer.data(), sizeof(ResponseHeader), sizeof(ResponseHeader)))
+	{
+		co_return ResponseView();
+	}
+
+	size_t wireSize = 0;
+	if (!OnResponseHeader(wireSize) || !co_await AsyncReceive(m_responseBuffer.data() + sizeof(ResponseHeader), m_responseBuffer.size() - sizeof(ResponseHeader), wireSize))
+	{
+		co_return ResponseView();
+	}
+	co_return ResponseView(m_responseBuffer.data(), m_responseBuffer.size());
+}
+
+/**
+ * Build the wire buffers of one request without copying the request buffers, which are already in wire byte order.
+ * The request header at the start of the first buffer gets the negotiated version and the session flag.
+ * Only a request to an older server is padded to whole packets.
+ * Return false if the request buffers are invalid.
+ */
+bool ClientSocket::BuildFrame(std::span<const const_buffer> buffers, RequestFrame& frame) const
+{
+	if (buffers.empty() || buffers.size() > MAX_GATHER_BUFFERS || buffers[0].size() < sizeof(RequestHeader))
+		return false;
+
+	const size_t size = boost::asio::buffer_size(buffers);
+	const size_t padding = IsPadded(m_peerVersion) ? (PACKET_SIZE - (size % PACKET_SIZE)) % PACKET_SIZE : 0;
+	const uint8_t version = m_sessionMode ? (m_peerVersion | VERSION_FLAG_KEEP_ALIVE) : m_peerVersion; // ask to keep the connection
+	frame.count = 0;
+	memcpy(frame.header, buffers[0].data(), sizeof(RequestHeader));
+	frame.header[offsetof(RequestHeader, version)] = version;
 
-		ptr += bytesWritten;
-		bytesLeft = (bytesLeft < bytesWritten) ? 0 : (bytesLeft - bytesWritten);  // unsigned protection.
+	frame.gather[frame.count++] = boost::asio::buffer(frame.header);
+	frame.gather[frame.count++] = buffers[0] + sizeof(RequestHeader);
+	for (size_t i = 1; i < buffers.size(); ++i)
+	{
+		frame.gather[frame.count++] = buffers[i];
+	}
+	if (padding > 0)
+	{
+		frame.gather[frame.count++] = boost::asio::buffer(PACKET_PADDING, padding);
 	}
 	return true;
 }
 
+/**
+ * Send the buffers of one request to _socket with a single gather write.
+ * Return false if unable to send all the bytes.
+ */
+bool ClientSocket::Send(std::span<const const_buffer> buffers) const
+{
+	RequestFrame frame;
+	if (m_socket == nullptr || !m_connected || !BuildFrame(buffers, frame))
+		return false;
+
+	boost::system::error_code errorCode; // write() will not throw exception when error_code is passed as argument.
+	const size_t bytesWritten = write(*m_socket, frame.Buffers(), errorCode);
+	return !errorCode && (bytesWritten == boost::asio::buffer_size(frame.Buffers()));
+}
+
+awaitable<bool> ClientSocket::AsyncSend(std::span<const const_buffer> buffers) const
+{
+	RequestFrame frame;
+	if (m_socket == nullptr || !m_connected || !BuildFrame(buffers, frame))
+		co_return false;
+
+	boost::system::error_code errorCode;
+	const size_t bytesWritten = co_await async_write(*m_socket, frame.Buffers(), redirect_error(use_awaitable, errorCode));
+	co_return !errorCode && (bytesWritten == boost::asio::buffer_size(frame.Buffers()));
+}
+
 bool ClientSocket::ConnectAndSend(const uint8_t* const toSend, const size_t size)
 {
-	if (!Connect())
+	if (!EnsureConnected())
 	{
 		return false;
 	}
-	if (!Send(toSend, size))
+	const const_buffer request(toSend, size);
+	if (!Send(std::span<const const_buffer>(&request, 1)))
 	{
 		Close();
 		return false;
 	}
 
-	Close();
+	Release();
 	return true;
 }
 
-// dynamic allocate response size
-uint8_t* ClientSocket::SendAndReceive(const uint8_t* const toSend, const size_t size)
+ResponseView ClientSocket::SendAndReceive(const uint8_t* const toSend, const size_t size)
+{
+	const const_buffer request(toSend, size);
+	return SendAndReceive(std::span<const const_buffer>(&request, 1));
+}
+
+// The returned view is valid until the next request on this socket
+ResponseView ClientSocket::SendAndReceive(std::span<const const_buffer> request)
 {
-	if (!Connect())
+	if (!EnsureConnected())
 	{
-		return nullptr;
+		return {};
 	}
-	if (!Send(toSend, size))
+	if (!Send(request))
 	{
 		Close();
-		return nullptr;
+		return {};
 	}
-	auto responseHeaderBytes = new uint8_t[sizeof(ResponseHeader)];
-	if (!Receive(responseHeaderBytes, sizeof(ResponseHeader), sizeof(ResponseHeader)))
+
+	const auto response = ReceiveResponse();
+	if (!response)
 	{
 		Close();
-		return nullptr;
+		return {};
 	}
+	Release();
+	return response;
+}
+
+ResponseView ClientSocket::RetryableSendAndReceive(const uint8_t* const toSend, const size_t size, int retries, const std::string& errorDesc)
+{
+	const const_buffer request(toSend, size);
+	return RetryableSendAndReceive(std::span<const const_buffer>(&request, 1), retries, errorDesc);
+}
 
-	ResponseHeader* resHeader = (ResponseHeader*)responseHeaderBytes;
-	auto payloadSize = resHeader->payloadSize;
-	auto response = new uint8_t[sizeof(ResponseHeader) + payloadSize];
-	std::copy(responseHeaderBytes, responseHeaderBytes + sizeof(ResponseHeader), response);
-	delete[] responseHeaderBytes;
-	if (!Receive(response + sizeof(ResponseHeader), payloadSize))
+// Fail fast without touching the network while the server is known to be unavailable
+void ClientSocket::CheckBreaker(const std::string& errorDesc)
+{
+	if (!m_breaker->AllowRequest())
 	{
-		Close();
-		return nullptr;
+		throw FatalException(errorDesc + ", server " + m_breaker->Endpoint() + " is unavailable");
 	}
-	Close();
-	return response;
 }
 
-uint8_t* ClientSocket::RetryableSendAndReceive(const uint8_t* const toSend, const size_t size, int retries, const std::string& errorDesc)
+/**
+ * Record the result of one attempt in the circuit breaker and the retry budget.
+ * Return true if the response is final, false if the request should be retried after a backoff.
+ * Throw if the attempts or the retry budget are exhausted.
+ */
+bool ClientSocket::OnAttempt(const ResponseView& response, int attempt, int retries, const std::string& errorDesc)
 {
-	uint8_t* response{};
-	bool failed = false;
-	int leftRetries = retries;
-	do
+	if (!response)
 	{
-		leftRetries--;
-		response = SendAndReceive(toSend, size);
-		if (!response)
-		{
-			std::cerr << errorDesc << std::endl;
-			failed = true;
-		}
-		else
+		LOG_WARNING(errorDesc);
+		m_breaker->OnFailure();
+	}
+	else
+	{
+		m_breaker->OnSuccess(); // a global error still means the server is up
+		if (!ClientLogic::IsGlobalError(response.Header()))
 		{
-			failed = ClientLogic::IsGlobalError(*(ResponseHeader*)response);
+			RetryBudget::Shared().OnSuccess();
+			return true;
 		}
-	} while (failed && leftRetries > 0);
+	}
 
-	if (failed)
+	if (attempt + 1 >= retries)
 	{
 		throw FatalException(errorDesc);
 	}
+	if (!RetryBudget::Shared().TryRetry())
+	{
+		throw FatalException(errorDesc + ", retry budget exhausted");
+	}
+	return false;
+}
 
-	return response;
+ResponseView ClientSocket::RetryableSendAndReceive(std::span<const const_buffer> request, int retries, const std::string& errorDesc)
+{
+	for (int attempt = 0; ; ++attempt)
+	{
+		CheckBreaker(errorDesc);
+		const auto response = SendAndReceive(request);
+		if (OnAttempt(response, attempt, retries, errorDesc))
+		{
+			return response;
+		}
+		std::this_thread::sleep_for(m_retryPolicy.Delay(attempt));
+	}
 }
 
+// The returned view is valid until the next request on this socket
+awaitable<ResponseView> ClientSocket::AsyncSendAndReceive(std::span<const const_buffer> request)
+{
+	if (!co_await AsyncEnsureConnected())
+	{
+		co_return ResponseView();
+	}
+	if (!co_await AsyncSend(request))
+	{
+		Close();
+		co_return ResponseView();
+	}
 
+	const auto response = co_await AsyncReceiveResponse();
+	if (!response)
+	{
+		Close();
+		co_return ResponseView();
+	}
+	Release();
+	co_return response;
+}
 
+awaitable<ResponseView> ClientSocket::AsyncRetryableSendAndReceive(const uint8_t* const toSend, const size_t size, int retries, const std::string& errorDesc)
+{
+	const const_buffer request(toSend, size);
+	co_return co_await AsyncRetryableSendAndReceive(std::span<const const_buffer>(&request, 1), retries, errorDesc);
+}
 
+awaitable<ResponseView> ClientSocket::AsyncRetryableSendAndReceive(std::span<const const_buffer> request, int retries, const std::string& errorDesc)
+{
+	boost::asio::steady_timer backoff(co_await boost::asio::this_coro::executor);
+	for (int attempt = 0; ; ++attempt)
+	{
+		CheckBreaker(errorDesc);
+		const auto response = co_await AsyncSendAndReceive(request);
+		if (OnAttempt(response, attempt, retries, errorDesc))
+		{
+			co_return response;
+		}
+		backoff.expires_after(m_retryPolicy.Delay(attempt));
+		co_await backoff.async_wait(use_awaitable);
+	}
+}
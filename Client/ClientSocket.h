@@ -2,35 +2,83 @@
 #include <string>
 #include <cstdint>
 #include <ostream>
+#include <chrono>
+#include <span>
+#include <array>
+#include <vector>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/awaitable.hpp>
 #include <boost/noncopyable.hpp>
+#include "ResponseView.h"
+#include "RetryPolicy.h"
+#include "CircuitBreaker.h"
 
 using boost::asio::ip::tcp;
 using boost::asio::io_context;
+using boost::asio::const_buffer;
+using boost::asio::awaitable;
 
-constexpr size_t PACKET_SIZE = 1024;
+constexpr size_t PACKET_SIZE = 1024; // Messages of CLIENT_VERSION_PADDED are padded to whole packets
+constexpr size_t MAX_GATHER_BUFFERS = 8; // Max buffers of one request for a gather write
+constexpr uint32_t MAX_RESPONSE_PAYLOAD_SIZE = 1024 * 1024; // Larger payload size in a response header is treated as a broken response
+constexpr std::chrono::seconds SESSION_IDLE_TIMEOUT(30); // Keep below the server idle timeout so an idle session is dropped by us first
 
 class ClientSocket : boost::noncopyable
 {
 private:
+	// Wire buffers of one request, shared by the sync and the async send
+	struct RequestFrame
+	{
+		uint8_t header[sizeof(RequestHeader)];
+		std::array<const_buffer, MAX_GATHER_BUFFERS + 2> gather;
+		size_t count = 0;
+
+		std::span<const const_buffer> Buffers() const { return { gather.data(), count }; }
+	};
+
 	std::string m_address;
 	std::string m_port;
-	std::unique_ptr<io_context> m_ioContext;
+	std::unique_ptr<io_context> m_ioContext; // Only when the socket doesn't run on a shared io_context
 	std::unique_ptr<tcp::resolver> m_resolver;
 	std::unique_ptr<tcp::socket> m_socket;
 	bool m_connected = false;  // True if socket opend and connected else False
+	bool m_sessionMode = false; // True if the client asks the server to keep the connection open between requests
+	bool m_keepAlive = false;   // True if the server confirmed the session on the last response
+	uint8_t m_peerVersion = CLIENT_VERSION; // Protocol version of requests, lowered to the version of an older server once it responds
+	std::chrono::steady_clock::time_point m_lastActivity;
+	std::vector<uint8_t> m_responseBuffer;        // Reused for every response, keeps its capacity between requests
+	std::array<uint8_t, PACKET_SIZE> m_padding{}; // Receives the packet padding of an older server that is dropped
+	RetryPolicy m_retryPolicy;
+	std::shared_ptr<CircuitBreaker> m_breaker; // Shared with every socket to the same endpoint
 
 	static bool IsValidAddress(const std::string& address);
 	static bool IsValidPort(const std::string& port);
 
+	void Init(io_context& ioContext, const std::string& address, const std::string& port);
 	bool Connect();
+	awaitable<bool> AsyncConnect();
+	bool IsReusable() const;
+	static bool IsPadded(uint8_t version) { return version <= CLIENT_VERSION_PADDED; }
+	bool EnsureConnected();
+	awaitable<bool> AsyncEnsureConnected();
 	void Close();
-	bool Receive(uint8_t* const buffer, const size_t size, size_t packetSize = PACKET_SIZE) const;
-	bool Send(const uint8_t* const buffer, const size_t size) const;
+	void Release();
+	bool Receive(uint8_t* const buffer, const size_t size, const size_t wireSize);
+	awaitable<bool> AsyncReceive(uint8_t* const buffer, const size_t size, const size_t wireSize);
+	bool OnResponseHeader(size_t& wireSize);
+	ResponseView ReceiveResponse();
+	awaitable<ResponseView> AsyncReceiveResponse();
+	bool BuildFrame(std::span<const const_buffer> buffers, RequestFrame& frame) const;
+	bool Send(std::span<const const_buffer> buffers) const;
+	awaitable<bool> AsyncSend(std::span<const const_buffer> buffers) const;
+	void CheckBreaker(const std::string& errorDesc);
+	bool OnAttempt(const ResponseView& response, int attempt, int retries, const std::string& errorDesc);
 
 public:
-	ClientSocket(const std::string& address, const std::string& port);
-	ClientSocket(const std::string& address, int port);
+	ClientSocket(const std::string& address, const std::string& port, bool sessionMode = false);
+	ClientSocket(const std::string& address, int port, bool sessionMode = false);
+	ClientSocket(io_context& ioContext, const std::string& address, const std::string& port, bool sessionMode = false);
 	virtual ~ClientSocket();
 
 	friend std::ostream& operator<<(std::ostream& os, const ClientSocket& socket)
@@ -39,7 +87,16 @@ public:
 		return os;
 	}
 
+	void SetRetryPolicy(const RetryPolicy& policy) { m_retryPolicy = policy; }
+
 	bool ConnectAndSend(const uint8_t* const toSend, const size_t size);
-	uint8_t* SendAndReceive(const uint8_t* const toSend, const size_t size);
-	uint8_t* RetryableSendAndReceive(const uint8_t* const toSend, const size_t size, int retries, const std::string& errorDesc);
+	ResponseView SendAndReceive(const uint8_t* const toSend, const size_t size);
+	ResponseView SendAndReceive(std::span<const const_buffer> request);
+	ResponseView RetryableSendAndReceive(const uint8_t* const toSend, const size_t size, int retries, const std::string& errorDesc);
+	ResponseView RetryableSendAndReceive(std::span<const const_buffer> request, int retries, const std::string& errorDesc);
+
+	// Same requests without blocking the thread, the io_context of the socket runs them
+	awaitable<ResponseView> AsyncSendAndReceive(std::span<const const_buffer> request);
+	awaitable<ResponseView> AsyncRetryableSendAndReceive(const uint8_t* const toSend, const size_t size, int retries, const std::string& errorDesc);
+	awaitable<ResponseView> AsyncRetryableSendAndReceive(std::span<const const_buffer> request, int retries, const std::string& errorDesc);
 };
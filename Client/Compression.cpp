@@ -0,0 +1,50 @@
+#include "Compression.h"
+#include <algorithm>
+#include <zlib.h>
+#include <filters.h>
+
+// Compress a sample at the start and one in the middle of the file, the header of a format may compress unlike its body
+bool Compression::IsCompressible(const FileSource& source)
+{
+	const uint64_t size = source.Size();
+	const uint64_t sampleSize = std::min<uint64_t>(SAMPLE_SIZE, size);
+	if (sampleSize == 0)
+	{
+		return false;
+	}
+
+	std::vector<uint8_t> compressed;
+	size_t plainSize = 0, compressedSize = 0;
+	for (const uint64_t offset : { uint64_t{ 0 }, size / 2 })
+	{
+		const auto sample = source.Bytes(std::min(offset, size - sampleSize), sampleSize);
+		const size_t sampleCompressed = Compress(sample, MIN_LEVEL, compressed);
+		plainSize += sample.size();
+		compressedSize += sampleCompressed > 0 ? sampleCompressed : sample.size();
+	}
+	return compressedSize * 100 <= plainSize * (100 - MIN_SAVING_PERCENT);
+}
+
+int Compression::NextLevel(int level, bool senderBehind, bool encoderBehind)
+{
+	if (senderBehind)
+	{
+		return std::min(level + 1, MAX_LEVEL);
+	}
+	if (encoderBehind)
+	{
+		return std::max(level - 1, MIN_LEVEL);
+	}
+	return level;
+}
+
+size_t Compression::Compress(std::span<const uint8_t> plain, int level, std::vector<uint8_t>& compressed)
+{
+	compressed.resize(plain.size());
+	auto sink = new CryptoPP::ArraySink(compressed.data(), compressed.size()); // owned by the compressor, drops what doesn't fit
+	CryptoPP::ZlibCompressor zlib(sink, level);
+	zlib.Put(plain.data(), plain.size());
+	zlib.MessageEnd();
+	const auto compressedSize = sink->TotalPutLength();
+	return compressedSize < plain.size() ? static_cast<size_t>(compressedSize) : 0;
+}
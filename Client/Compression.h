@@ -0,0 +1,25 @@
+#pragma once
+#include "FileSource.h"
+#include <cstdint>
+#include <vector>
+#include <span>
+
+/*
+ * zlib compression of upload chunks before their encryption, ciphertext doesn't compress so text shrinks only here.
+ * A file is probed on samples first, data that is already compressed (archives, media) is sent without the cost of compressing it,
+ * and a chunk that doesn't get smaller is sent as it is.
+ */
+class Compression
+{
+	Compression() = delete;
+
+public:
+	constexpr static int MIN_LEVEL = 1;  // fastest deflate, most of the gain on text
+	constexpr static int MAX_LEVEL = 6;  // zlib default, higher levels gain little for much more time
+	constexpr static size_t SAMPLE_SIZE = 64 * 1024;
+	constexpr static size_t MIN_SAVING_PERCENT = 10; // samples that save less are of data that is already compressed
+
+	static bool IsCompressible(const FileSource& source);
+	static int NextLevel(int level, bool senderBehind, bool encoderBehind); // a step up while encoded chunks wait for the network, down while the sender waits for them
+	static size_t Compress(std::span<const uint8_t> plain, int level, std::vector<uint8_t>& compressed); // 0 if it doesn't get smaller
+};
@@ -0,0 +1,277 @@
+#include "Crc32.h"
+#include "WorkerPool.h"
+#include "Protocol.h"
+#include <fstream>
+#include <vector>
+#include <array>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CRC32_X86 1
+#include <immintrin.h>
+#include <cpu.h>
+#endif
+
+#if defined(__GNUC__)
+#define CRC32_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CRC32_TARGET(isa)
+#endif
+
+static constexpr uint32_t POLYNOMIAL = 0xEDB88320; // reflected polynomial of zlib
+static constexpr size_t PARALLEL_PART_SIZE = 16 * 1024 * 1024; // smaller buffers don't gain from more cores
+
+// TABLES[k][b] is the crc of byte b followed by k zero bytes
+static constexpr auto TABLES = []()
+{
+	std::array<std::array<uint32_t, 256>, 16> tables{};
+	for (uint32_t b = 0; b < 256; ++b)
+	{
+		uint32_t crc = b;
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+		}
+		tables[0][b] = crc;
+	}
+	for (size_t k = 1; k < tables.size(); ++k)
+	{
+		for (uint32_t b = 0; b < 256; ++b)
+		{
+			tables[k][b] = (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xFF];
+		}
+	}
+	return tables;
+}();
+
+// Product of two polynomials modulo the crc polynomial, bit 31 is x^0
+static constexpr uint32_t MultModP(uint32_t a, uint32_t b)
+{
+	uint32_t product = 0;
+	for (uint32_t m = 1u << 31; m != 0; m >>= 1)
+	{
+		if (a & m)
+		{
+			product ^= b;
+		}
+		b = (b & 1) ? (b >> 1) ^ POLYNOMIAL : b >> 1;
+	}
+	return product;
+}
+
+// X2N[k] is x^(2^k) modulo the crc polynomial
+static constexpr auto X2N = []()
+{
+	std::array<uint32_t, 32> x2n{};
+	uint32_t p = 1u << 30; // x^1
+	for (auto& power : x2n)
+	{
+		power = p;
+		p = MultModP(p, p);
+	}
+	return x2n;
+}();
+
+// x^(n * 2^k) modulo the crc polynomial
+static uint32_t X2NModP(uint64_t n, size_t k)
+{
+	uint32_t p = 1u << 31; // x^0
+	for (; n != 0; n >>= 1, ++k)
+	{
+		if (n & 1)
+		{
+			p = MultModP(X2N[k % X2N.size()], p);
+		}
+	}
+	return p;
+}
+
+// Slice-by-16 on the inverted crc, 16 bytes per step through independent table lookups
+static uint32_t UpdateTables(uint32_t crc, const uint8_t* bytes, size_t length)
+{
+	for (; length >= 16; length -= 16, bytes += 16)
+	{
+		const uint32_t first = crc ^ (bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24));
+		crc = TABLES[15][first & 0xFF] ^ TABLES[14][(first >> 8) & 0xFF] ^ TABLES[13][(first >> 16) & 0xFF] ^ TABLES[12][first >> 24]
+			^ TABLES[11][bytes[4]] ^ TABLES[10][bytes[5]] ^ TABLES[9][bytes[6]] ^ TABLES[8][bytes[7]]
+			^ TABLES[7][bytes[8]] ^ TABLES[6][bytes[9]] ^ TABLES[5][bytes[10]] ^ TABLES[4][bytes[11]]
+			^ TABLES[3][bytes[12]] ^ TABLES[2][bytes[13]] ^ TABLES[1][bytes[14]] ^ TABLES[0][bytes[15]];
+	}
+	for (; length > 0; --length, ++bytes)
+	{
+		crc = (crc >> 8) ^ TABLES[0][(crc ^ *bytes) & 0xFF];
+	}
+	return crc;
+}
+
+#ifdef CRC32_X86
+
+CRC32_TARGET("sse2") static inline __m128i Load(const uint8_t* bytes)
+{
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+}
+
+// x multiplied by the constants k, the high half by the high constant and the low by the low one, added to next
+CRC32_TARGET("pclmul,sse2") static inline __m128i Fold(__m128i x, __m128i k, __m128i next)
+{
+	return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00)), next);
+}
+
+/*
+ * Folding of Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction", as in zlib of Chromium.
+ * Four 128 bit accumulators fold 64 bytes per step, then they fold to one and a Barrett reduction leaves the 32 bit crc.
+ * length is at least 64 and a multiple of 16, crc is inverted.
+ */
+CRC32_TARGET("pclmul,sse2") static uint32_t UpdateClmul(uint32_t crc, const uint8_t* bytes, size_t length)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	__m128i x1 = _mm_xor_si128(Load(bytes), _mm_cvtsi32_si128(static_cast<int>(crc)));
+	__m128i x2 = Load(bytes + 16);
+	__m128i x3 = Load(bytes + 32);
+	__m128i x4 = Load(bytes + 48);
+	bytes += 64;
+	length -= 64;
+
+	for (; length >= 64; bytes += 64, length -= 64)
+	{
+		x1 = Fold(x1, k1k2, Load(bytes));
+		x2 = Fold(x2, k1k2, Load(bytes + 16));
+		x3 = Fold(x3, k1k2, Load(bytes + 32));
+		x4 = Fold(x4, k1k2, Load(bytes + 48));
+	}
+
+	// fold the accumulators and the remaining 16 byte blocks to 128 bits
+	x1 = Fold(Fold(Fold(x1, k3k4, x2), k3k4, x3), k3k4, x4);
+	for (; length >= 16; bytes += 16, length -= 16)
+	{
+		x1 = Fold(x1, k3k4, Load(bytes));
+	}
+
+	// 128 to 64 bits
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00), _mm_srli_si128(x1, 4));
+
+	// Barrett reduction to 32 bits
+	__m128i reduced = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+	reduced = _mm_clmulepi64_si128(_mm_and_si128(reduced, low32), poly, 0x00);
+	x1 = _mm_xor_si128(x1, reduced);
+	return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+}
+
+static const bool HAS_CLMUL = CryptoPP::HasCLMUL();
+
+#endif
+
+uint32_t Crc32::Update(uint32_t crc, const uint8_t* bytes, size_t length)
+{
+	crc = ~crc;
+#ifdef CRC32_X86
+	if (HAS_CLMUL && length >= 64)
+	{
+		const size_t folded = length & ~static_cast<size_t>(15);
+		crc = UpdateClmul(crc, bytes, folded);
+		bytes += folded;
+		length -= folded;
+	}
+#endif
+	return ~UpdateTables(crc, bytes, length);
+}
+
+uint32_t Crc32::Combine(uint32_t crc1, uint32_t crc2, uint64_t length2)
+{
+	return MultModP(X2NModP(length2, 3), crc1) ^ crc2;
+}
+
+void Crc32::Update(const uint8_t* bytes, size_t length)
+{
+	m_crc = Update(m_crc, bytes, length);
+	m_length += length;
+}
+
+void Crc32::Combine(uint32_t nextCrc, uint64_t nextLength)
+{
+	m_crc = Combine(m_crc, nextCrc, nextLength);
+	m_length += nextLength;
+}
+
+uint32_t Crc32::Calculate(const std::string& str)
+{
+	return Calculate(reinterpret_cast<const uint8_t*>(str.c_str()), str.size());
+}
+
+uint32_t Crc32::Calculate(const uint8_t* bytes, size_t length)
+{
+	const size_t parts = (length + PARALLEL_PART_SIZE - 1) / PARALLEL_PART_SIZE;
+	if (parts < 2)
+	{
+		return Update(0, bytes, length);
+	}
+
+	std::vector<uint32_t> crcs(parts);
+	WorkerPool::Shared().ParallelFor(parts, [&](size_t i)
+		{
+			const size_t offset = i * PARALLEL_PART_SIZE;
+			crcs[i] = Update(0, bytes + offset, std::min(PARALLEL_PART_SIZE, length - offset));
+		});
+
+	Crc32 crc;
+	for (size_t i = 0; i < parts; ++i)
+	{
+		crc.Combine(crcs[i], std::min<uint64_t>(PARALLEL_PART_SIZE, length - i * PARALLEL_PART_SIZE));
+	}
+	return crc.Value();
+}
+
+uint32_t Crc32::CalculateFile(const std::string& path)
+{
+	std::ifstream infile(path, std::ios::binary | std::ios::ate);
+	if (!infile.is_open())
+	{
+		throw std::invalid_argument("File " + path + " not exists");
+	}
+	return CalculateFile(path, 0, static_cast<uint64_t>(infile.tellg()));
+}
+
+uint32_t Crc32::CalculateFile(const std::string& path, uint64_t offset, uint64_t length)
+{
+	const size_t parts = static_cast<size_t>((length + PARALLEL_PART_SIZE - 1) / PARALLEL_PART_SIZE);
+	std::vector<uint32_t> crcs(parts);
+	WorkerPool::Shared().ParallelFor(parts, [&](size_t i)
+		{
+			const uint64_t partOffset = offset + i * PARALLEL_PART_SIZE;
+			uint64_t left = std::min<uint64_t>(PARALLEL_PART_SIZE, offset + length - partOffset);
+
+			std::ifstream infile(path, std::ios::binary);
+			if (!infile.is_open())
+			{
+				throw std::invalid_argument("File " + path + " not exists");
+			}
+			infile.seekg(static_cast<std::streamoff>(partOffset));
+
+			std::vector<char> chunk(std::min<uint64_t>(UPLOAD_CHUNK_SIZE, left));
+			uint32_t crc = 0;
+			while (left > 0)
+			{
+				const size_t chunkSize = static_cast<size_t>(std::min<uint64_t>(chunk.size(), left));
+				if (!infile.read(chunk.data(), chunkSize))
+				{
+					throw std::runtime_error("Failed to read " + path + " at offset " + std::to_string(partOffset));
+				}
+				crc = Update(crc, reinterpret_cast<const uint8_t*>(chunk.data()), chunkSize);
+				left -= chunkSize;
+			}
+			crcs[i] = crc;
+		});
+
+	Crc32 crc;
+	for (size_t i = 0; i < parts; ++i)
+	{
+		crc.Combine(crcs[i], std::min<uint64_t>(PARALLEL_PART_SIZE, length - i * PARALLEL_PART_SIZE));
+	}
+	return crc.Value();
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+/*
+ * CRC-32 of the file content, the same checksum the server compares (zlib.crc32).
+ * Computed with PCLMULQDQ folding when the CPU has it and slice-by-16 tables otherwise.
+ * An instance accumulates the crc of consecutive parts, crcs of adjacent parts computed apart (e.g. on other cores) are merged with Combine.
+ */
+class Crc32
+{
+	uint32_t m_crc = 0;
+	uint64_t m_length = 0;
+
+public:
+	Crc32() = default;
+
+	void Update(const uint8_t* bytes, size_t length);
+	void Combine(uint32_t nextCrc, uint64_t nextLength); // append the crc of the nextLength bytes that follow
+	uint32_t Value() const { return m_crc; }
+	uint64_t Length() const { return m_length; }
+
+	static uint32_t Update(uint32_t crc, const uint8_t* bytes, size_t length);     // zlib.crc32(bytes, crc)
+	static uint32_t Combine(uint32_t crc1, uint32_t crc2, uint64_t length2);        // zlib crc32_combine
+	static uint32_t Calculate(const std::string& str);
+	static uint32_t Calculate(const uint8_t* bytes, size_t length);                  // large buffers in parallel parts
+	static uint32_t CalculateFile(const std::string& path);                          // reads the file in chunks, so it works on files larger than memory
+	static uint32_t CalculateFile(const std::string& path, uint64_t offset, uint64_t length); // parallel parts, each read by its own stream
+};
@@ -0,0 +1,164 @@
+#include "Delta.h"
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <sha.h>
+
+static constexpr uint32_t ADLER_MOD = 65521;
+static constexpr size_t ADLER_NMAX = 5552; // bytes that can be summed before the 32 bits sums must be reduced
+static constexpr size_t COPY_OP_SIZE = 1 + 2 * sizeof(uint32_t);
+static constexpr size_t LITERAL_OP_SIZE = 1 + sizeof(uint32_t);
+
+uint32_t Delta::Adler32(std::span<const uint8_t> bytes)
+{
+	uint32_t a = 1, b = 0;
+	while (!bytes.empty())
+	{
+		const size_t n = std::min(bytes.size(), ADLER_NMAX);
+		for (size_t i = 0; i < n; ++i)
+		{
+			a += bytes[i];
+			b += a;
+		}
+		a %= ADLER_MOD;
+		b %= ADLER_MOD;
+		bytes = bytes.subspan(n);
+	}
+	return (b << 16) | a;
+}
+
+// Remove out from the start of a window of length bytes and add in at its end
+uint32_t Delta::RollAdler32(uint32_t adler, size_t length, uint8_t out, uint8_t in)
+{
+	const uint64_t a = ((adler & 0xFFFF) + ADLER_MOD - out + in) % ADLER_MOD;
+	const uint64_t b = ((adler >> 16) + ADLER_MOD - (length % ADLER_MOD) * out % ADLER_MOD + a + ADLER_MOD - 1) % ADLER_MOD;
+	return static_cast<uint32_t>((b << 16) | a);
+}
+
+std::array<uint8_t, STRONG_SIGNATURE_SIZE> Delta::Strong(std::span<const uint8_t> bytes)
+{
+	std::array<uint8_t, STRONG_SIGNATURE_SIZE> strong;
+	CryptoPP::SHA256().CalculateTruncatedDigest(strong.data(), strong.size(), bytes.data(), bytes.size());
+	return strong;
+}
+
+static uint16_t Hash16(uint32_t weak)
+{
+	return static_cast<uint16_t>(weak ^ (weak >> 16));
+}
+
+static void AddLiteral(std::vector<Delta::Op>& ops, uint64_t offset, uint64_t end)
+{
+	for (; offset < end; offset += Delta::MAX_LITERAL_SIZE)
+	{
+		ops.push_back({ 0, 0, offset, std::min<uint64_t>(Delta::MAX_LITERAL_SIZE, end - offset) });
+	}
+}
+
+std::optional<std::vector<Delta::Op>> Delta::Compute(std::span<const uint8_t> file, uint64_t offset, const Base& base, uint64_t maxLiteralBytes)
+{
+	const size_t blockSize = base.blockSize;
+	const size_t fullBlocks = blockSize == 0 ? 0 : std::min<size_t>(base.blocks.size(), base.size / blockSize); // a shorter last block is never matched
+
+	// blocks of every rolling checksum, the first of equal blocks is the one copied. Most windows of a changed file match no block
+	// and are ruled out by a bit of their 16 bits hash before the map lookup
+	std::unordered_map<uint32_t, std::vector<uint32_t>> blocksOf;
+	std::vector<bool> maybeBlock(1 << 16);
+	blocksOf.reserve(fullBlocks);
+	for (uint32_t i = 0; i < fullBlocks; ++i)
+	{
+		blocksOf[base.blocks[i].weak].push_back(i);
+		maybeBlock[Hash16(base.blocks[i].weak)] = true;
+	}
+
+	std::vector<Op> ops;
+	uint64_t literal = offset; // start of the bytes not matched yet
+	uint64_t literalBytes = 0;
+	uint64_t position = offset;
+	bool rolled = false;
+	uint32_t weak = 0;
+	while (fullBlocks > 0 && position + blockSize <= file.size())
+	{
+		weak = rolled ? RollAdler32(weak, blockSize, file[position - 1], file[position + blockSize - 1]) : Adler32(file.subspan(position, blockSize));
+		rolled = true;
+
+		const auto candidates = maybeBlock[Hash16(weak)] ? blocksOf.find(weak) : blocksOf.end();
+		if (candidates != blocksOf.end())
+		{
+			const auto strong = Strong(file.subspan(position, blockSize));
+			const auto match = std::find_if(candidates->second.begin(), candidates->second.end(),
+				[&](uint32_t block) { return memcmp(base.blocks[block].strong, strong.data(), strong.size()) == 0; });
+			if (match != candidates->second.end())
+			{
+				literalBytes += position - literal;
+				AddLiteral(ops, literal, position);
+				if (!ops.empty() && ops.back().blockCount > 0 && ops.back().firstBlock + ops.back().blockCount == *match)
+				{
+					++ops.back().blockCount; // next block of the base, e.g. an unchanged file start
+					ops.back().length += blockSize;
+				}
+				else
+				{
+					ops.push_back({ *match, 1, position, blockSize });
+				}
+				position += blockSize;
+				literal = position;
+				rolled = false;
+				continue;
+			}
+		}
+
+		if (position - literal + literalBytes > maxLiteralBytes)
+		{
+			return std::nullopt;
+		}
+		++position;
+	}
+
+	literalBytes += file.size() - literal;
+	if (literalBytes > maxLiteralBytes)
+	{
+		return std::nullopt;
+	}
+	AddLiteral(ops, literal, file.size());
+	return ops;
+}
+
+static void AppendUInt32(std::vector<uint8_t>& message, uint32_t value)
+{
+	for (size_t i = 0; i < sizeof(value); ++i)
+	{
+		message.push_back(static_cast<uint8_t>(value >> (8 * i)));
+	}
+}
+
+uint64_t Delta::EncodeMessage(std::span<const Op> ops, size_t& next, std::span<const uint8_t> file, std::vector<uint8_t>& message)
+{
+	message.clear();
+	uint64_t length = 0;
+	for (; next < ops.size(); ++next)
+	{
+		const Op& op = ops[next];
+		const size_t opSize = op.blockCount > 0 ? COPY_OP_SIZE : LITERAL_OP_SIZE + op.length;
+		if (!message.empty() && message.size() + opSize > MAX_MESSAGE_SIZE)
+		{
+			break;
+		}
+
+		if (op.blockCount > 0)
+		{
+			message.push_back(DELTA_COPY);
+			AppendUInt32(message, op.firstBlock);
+			AppendUInt32(message, op.blockCount);
+		}
+		else
+		{
+			message.push_back(DELTA_LITERAL);
+			AppendUInt32(message, static_cast<uint32_t>(op.length));
+			const auto bytes = file.subspan(op.offset, op.length);
+			message.insert(message.end(), bytes.begin(), bytes.end());
+		}
+		length += op.length;
+	}
+	return length;
+}
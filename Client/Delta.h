@@ -0,0 +1,49 @@
+#pragma once
+#include "Protocol.h"
+#include <cstdint>
+#include <vector>
+#include <array>
+#include <span>
+#include <optional>
+
+/*
+ * rsync style delta of a new file against a stored version that only its block signatures are known of.
+ * Every block of the stored version has a rolling (Adler-32) and a strong (truncated SHA-256) checksum. The rolling checksum
+ * is moved over the new file a byte at a time, a match that the strong checksum confirms is a copy of the stored block,
+ * the bytes between matches are literals.
+ */
+class Delta
+{
+	Delta() = delete;
+
+public:
+	// Stored version, the base of a delta
+	struct Base
+	{
+		uint64_t size = 0;
+		uint32_t blockSize = 0;
+		std::vector<BlockSignature> blocks;
+	};
+
+	// Copy of blockCount blocks of the base from firstBlock, or literal bytes of the new file at offset if blockCount is 0
+	struct Op
+	{
+		uint32_t firstBlock = 0;
+		uint32_t blockCount = 0;
+		uint64_t offset = 0;  // in the new file
+		uint64_t length = 0;  // bytes of the new file the op makes
+	};
+
+	constexpr static size_t MAX_LITERAL_SIZE = UPLOAD_CHUNK_SIZE; // longer literals are split, so an op always fits a message
+	constexpr static size_t MAX_MESSAGE_SIZE = UPLOAD_CHUNK_SIZE + 16; // encoded ops of one request, before encryption
+
+	static uint32_t Adler32(std::span<const uint8_t> bytes);                           // zlib.adler32
+	static uint32_t RollAdler32(uint32_t adler, size_t length, uint8_t out, uint8_t in); // the same window a byte later
+	static std::array<uint8_t, STRONG_SIGNATURE_SIZE> Strong(std::span<const uint8_t> bytes);
+
+	// Ops that make the file from offset on, nullopt once the literals exceed maxLiteralBytes so the delta doesn't pay off
+	static std::optional<std::vector<Op>> Compute(std::span<const uint8_t> file, uint64_t offset, const Base& base, uint64_t maxLiteralBytes);
+
+	// Encode the ops from next that fit one message of MAX_MESSAGE_SIZE, advance next past them and return the file bytes they make
+	static uint64_t EncodeMessage(std::span<const Op> ops, size_t& next, std::span<const uint8_t> file, std::vector<uint8_t>& message);
+};
@@ -2,6 +2,7 @@
 #include <mutex>
 #include <iostream>
 #include <intrin.h>
+#include <cstring>
 
 Endianess::Endianess()
 {
@@ -37,11 +38,14 @@ void Endianess::ToLittle(uint8_t* buffer, size_t size)
 		return;
 	}
 
-	size -= (size % sizeof(uint32_t));
-	uint32_t* ptr = reinterpret_cast<uint32_t*>(buffer);
-	for (size_t i = 0; i < size; ++i)
+	// swap whole words only, the loop runs over words and not over bytes so it stays inside the buffer
+	const size_t words = size / sizeof(uint32_t);
+	for (size_t i = 0; i < words; ++i)
 	{
-		ptr[i] = _byteswap_ulong(ptr[i]);
+		uint32_t word;
+		memcpy(&word, buffer + i * sizeof(uint32_t), sizeof(word));
+		word = _byteswap_ulong(word);
+		memcpy(buffer + i * sizeof(uint32_t), &word, sizeof(word));
 	}
 }
 
@@ -53,10 +57,13 @@ void Endianess::Swap(uint8_t* buffer, size_t size)
 		return;
 	}
 
-	size -= (size % sizeof(uint32_t));
-	uint32_t* ptr = reinterpret_cast<uint32_t*>(buffer);
-	for (size_t i = 0; i < size; ++i)
+	// swap whole words only, the loop runs over words and not over bytes so it stays inside the buffer
+	const size_t words = size / sizeof(uint32_t);
+	for (size_t i = 0; i < words; ++i)
 	{
-		ptr[i] = _byteswap_ulong(ptr[i]);
+		uint32_t word;
+		memcpy(&word, buffer + i * sizeof(uint32_t), sizeof(word));
+		word = _byteswap_ulong(word);
+		memcpy(buffer + i * sizeof(uint32_t), &word, sizeof(word));
 	}
 }
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "FileSource.h"
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+
+namespace ipc = boost::interprocess;
+
+static constexpr size_t STREAM_BLOCK_SIZE = 1024 * 1024;
+static constexpr size_t PREFETCH_STRIDE = 4096; // the smallest page size
+
+FileSource::FileSource(const std::string& path)
+{
+	std::error_code error;
+	if (!std::filesystem::exists(path, error))
+	{
+		throw std::invalid_argument("File " + path + " not exists");
+	}
+
+	// an empty file has nothing to map
+	if (!std::filesystem::is_regular_file(path, error) || std::filesystem::file_size(path, error) == 0)
+	{
+		Stream(path);
+		return;
+	}
+
+	m_file = ipc::file_mapping(path.c_str(), ipc::read_only);
+	m_region = ipc::mapped_region(m_file, ipc::read_only);
+	m_region.advise(ipc::mapped_region::advice_sequential); // a hint, not supported on every platform
+	m_bytes = { static_cast<const uint8_t*>(m_region.get_address()), m_region.get_size() };
+}
+
+void FileSource::Stream(const std::string& path)
+{
+	std::ifstream infile(path, std::ios::binary);
+	if (!infile.is_open())
+	{
+		throw std::invalid_argument("File " + path + " not exists");
+	}
+
+	size_t size = 0;
+	do
+	{
+		m_buffer.resize(size + STREAM_BLOCK_SIZE); // grows geometrically, so streaming is linear in the size
+		infile.read(reinterpret_cast<char*>(m_buffer.data() + size), STREAM_BLOCK_SIZE);
+		size += static_cast<size_t>(infile.gcount());
+	} while (infile);
+
+	if (!infile.eof())
+	{
+		throw std::runtime_error("Failed to read " + path + " at offset " + std::to_string(size));
+	}
+	m_buffer.resize(size);
+	m_bytes = m_buffer;
+}
+
+std::span<const uint8_t> FileSource::Bytes(uint64_t offset, uint64_t length) const
+{
+	if (offset > m_bytes.size() || length > m_bytes.size() - offset)
+	{
+		throw std::out_of_range("Range of " + std::to_string(length) + " bytes at offset " + std::to_string(offset) + " is out of a file of " + std::to_string(m_bytes.size()) + " bytes");
+	}
+	return m_bytes.subspan(static_cast<size_t>(offset), static_cast<size_t>(length));
+}
+
+void FileSource::Prefetch(std::span<const uint8_t> bytes) const
+{
+	if (!IsMapped())
+	{
+		return;
+	}
+
+	// reading a byte of every page makes the system load it, here rather than in the thread that uses it
+	uint8_t touched = 0;
+	for (size_t i = 0; i < bytes.size(); i += PREFETCH_STRIDE)
+	{
+		touched ^= static_cast<const volatile uint8_t&>(bytes[i]);
+	}
+	static_cast<void>(touched);
+}
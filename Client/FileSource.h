@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <span>
+#include <boost/noncopyable.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+/*
+ * The bytes of a file to upload, as they are on disk (binary, no line ending translation).
+ * Regular files are memory mapped with a sequential access hint, so the crc and the encryption read the page cache directly.
+ * Other files, such as pipes, can't be mapped and the upload needs their size up front, so they are streamed once to memory.
+ */
+class FileSource : boost::noncopyable
+{
+	boost::interprocess::file_mapping m_file;
+	boost::interprocess::mapped_region m_region;
+	std::vector<uint8_t> m_buffer; // content of a file that isn't mapped
+	std::span<const uint8_t> m_bytes;
+
+	void Stream(const std::string& path);
+
+public:
+	explicit FileSource(const std::string& path);
+
+	bool IsMapped() const { return m_region.get_address() != nullptr; }
+	uint64_t Size() const { return m_bytes.size(); }
+	std::span<const uint8_t> Bytes() const { return m_bytes; }
+	std::span<const uint8_t> Bytes(uint64_t offset, uint64_t length) const; // throws if the range is out of the file
+	void Prefetch(std::span<const uint8_t> bytes) const;                     // fault mapped pages in ahead of their use
+};
@@ -0,0 +1,49 @@
+#include "Log.h"
+#include "Base64.h"
+#include <iostream>
+#include <mutex>
+#include <array>
+#include <cstdlib>
+#include <algorithm>
+
+std::atomic<LogLevel> Log::s_level{ Log::DEFAULT_LEVEL };
+std::atomic<size_t> Log::s_dumpLimit{ Log::DEFAULT_DUMP_LIMIT };
+
+static constexpr std::array<const char*, 6> LEVEL_NAMES = { "trace", "debug", "info", "warning", "error", "off" };
+
+void Log::Configure()
+{
+	if (const char* level = std::getenv("LOG_LEVEL"))
+	{
+		for (size_t i = 0; i < LEVEL_NAMES.size(); ++i)
+		{
+			if (LEVEL_NAMES[i] == std::string(level))
+			{
+				SetLevel(static_cast<LogLevel>(i));
+			}
+		}
+	}
+	if (const char* dumpBytes = std::getenv("LOG_DUMP_BYTES"))
+	{
+		SetDumpLimit(std::strtoull(dumpBytes, nullptr, 10));
+	}
+}
+
+void Log::Write(LogLevel level, const std::string& message)
+{
+	static std::mutex writeMutex;
+	std::lock_guard<std::mutex> lock(writeMutex);
+	auto& stream = level >= LogLevel::Warning ? std::cerr : std::cout;
+	stream << message << std::endl;
+}
+
+std::ostream& operator<<(std::ostream& os, const Log::Dump& dump)
+{
+	const size_t prefix = std::min(dump.size, Log::DumpLimit());
+	os << Base64::Encode(dump.bytes, prefix);
+	if (prefix < dump.size)
+	{
+		os << "... (" << dump.size << " bytes)";
+	}
+	return os;
+}
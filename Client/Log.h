@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <ostream>
+
+enum class LogLevel { Trace, Debug, Info, Warning, Error, Off };
+
+// Levels below this one are compiled out, e.g. build with /DLOG_COMPILED_LEVEL=2 to drop trace and debug
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL 0
+#endif
+
+/*
+ * Leveled logging of the client. A message is formatted only if its level is enabled at compile time and at run time,
+ * warnings and errors go to stderr and the rest to stdout. Payloads are logged with Log::Dump that formats a prefix only.
+ */
+class Log
+{
+	Log() = delete;
+
+	static std::atomic<LogLevel> s_level;
+	static std::atomic<size_t> s_dumpLimit;
+
+public:
+	constexpr static LogLevel DEFAULT_LEVEL = LogLevel::Info;
+	constexpr static size_t DEFAULT_DUMP_LIMIT = 64;
+
+	// Base64 of the first DumpLimit() bytes of a payload and its size
+	struct Dump
+	{
+		const uint8_t* bytes;
+		size_t size;
+
+		Dump(const uint8_t* bytes, size_t size) : bytes(bytes), size(size) {}
+		explicit Dump(const std::string& str) : Dump(reinterpret_cast<const uint8_t*>(str.data()), str.size()) {}
+	};
+
+	static void Configure(); // level and dump limit from the LOG_LEVEL (trace .. off) and LOG_DUMP_BYTES environment variables
+	static void SetLevel(LogLevel level) { s_level = level; }
+	static void SetDumpLimit(size_t bytes) { s_dumpLimit = bytes; }
+	static size_t DumpLimit() { return s_dumpLimit.load(std::memory_order_relaxed); }
+
+	static bool Enabled(LogLevel level)
+	{
+		return static_cast<int>(level) >= LOG_COMPILED_LEVEL && level >= s_level.load(std::memory_order_relaxed);
+	}
+
+	static void Write(LogLevel level, const std::string& message); // one line, not interleaved with lines of other threads
+};
+
+std::ostream& operator<<(std::ostream& os, const Log::Dump& dump);
+
+// message is a stream expression, e.g. LOG_DEBUG("content: " << Log::Dump(content)), evaluated only if level is enabled
+#define LOG(level, message) \
+	do { if (Log::Enabled(level)) { std::ostringstream logStream; logStream << message; Log::Write(level, logStream.str()); } } while (false)
+#define LOG_TRACE(message) LOG(LogLevel::Trace, message)
+#define LOG_DEBUG(message) LOG(LogLevel::Debug, message)
+#define LOG_INFO(message) LOG(LogLevel::Info, message)
+#define LOG_WARNING(message) LOG(LogLevel::Warning, message)
+#define LOG_ERROR(message) LOG(LogLevel::Error, message)
@@ -1,6 +1,7 @@
 #include "MeInfo.hpp"
 #include <sstream>
 #include "Base64.h"
+#include "RSAKeyPool.h"
 
 const std::string MeInfo::ME_FILE = "me.info";
 
@@ -44,8 +45,13 @@ MeInfo::MeInfo()
 	m_rsa = std::make_shared<RSAPrivateWrapper>(Base64::Decode(lines[2]));
 }
 
+bool MeInfo::Exists()
+{
+	return std::ifstream(ME_FILE).is_open();
+}
+
 // Create object and save to file
-MeInfo::MeInfo(const ClientName& name, const ClientID& uuid) : m_name(name), m_uuid(uuid), m_rsa(std::make_shared<RSAPrivateWrapper>())
+MeInfo::MeInfo(const ClientName& name, const ClientID& uuid) : m_name(name), m_uuid(uuid), m_rsa(RSAKeyPool::Shared().Take())
 {
 	std::ofstream infile(ME_FILE);
 	infile << m_name << "\n" << m_uuid << "\n" << Base64::Encode(m_rsa->getPrivateKey());
@@ -20,6 +20,8 @@ public:
 	MeInfo();
 	MeInfo(const ClientName& name, const ClientID& uuid);
 
+	static bool Exists(); // True if a registered client saved its info
+
 	ClientName GetClientName() { return m_name; }
 	ClientID GetClientID() { return m_uuid; }
 	std::shared_ptr<RSAPrivateWrapper> GetRsaObject() { return m_rsa; }
@@ -10,23 +10,51 @@ constexpr int DEFAULT_INT_VAL = 0; // Default value for integers fields in Reque
 typedef uint32_t messageID_t;
 
 // Constants 
-constexpr uint8_t CLIENT_VERSION = 3;
+constexpr uint8_t CLIENT_VERSION = 4;
+constexpr uint8_t CLIENT_VERSION_PADDED = 3; // Last version that pads every message to whole packets, later versions send exactly header and payload
+constexpr uint8_t VERSION_FLAG_KEEP_ALIVE = 0x80; // Flag bit in the header version, request asks to keep the connection open and response confirms it
+constexpr uint8_t VERSION_MASK = 0x7F;            // Masks out the flag bits from the header version
 constexpr size_t CLIENT_ID_SIZE = 16;
 constexpr size_t NAME_SIZE = 255;
-constexpr size_t PUBLIC_KEY_SIZE = 160;
+constexpr size_t PUBLIC_KEY_SIZE = 160;      // Public key of REQUEST_SEND_PUBLIC_KEY, only a 1024 bits key fits
+constexpr size_t MAX_PUBLIC_KEY_SIZE = 1024; // Public key of REQUEST_SEND_VARIABLE_PUBLIC_KEY
 constexpr size_t AES_KEY_SIZE = 16;   
 constexpr size_t REQUEST_OPTIONS = 5;
 constexpr size_t RESPONSE_OPTIONS = 6;
+constexpr size_t UPLOAD_CHUNK_SIZE = 1024 * 1024; // Plain bytes in each chunk of a chunked upload
+constexpr size_t CIPHER_SEGMENT_SIZE = 64 * 1024;  // Plain bytes of each independently encrypted segment of CIPHER_AES_GCM_SEGMENTS
+constexpr size_t CIPHER_NONCE_SIZE = 12;           // Random nonce of a file, each segment nonce is it xor the segment index
+constexpr size_t CIPHER_TAG_SIZE = 16;             // Authentication tag after each segment
+constexpr size_t TICKET_SIZE = 68;       // Resumption ticket, opaque to the client, sealed by the server with a key only it knows
+constexpr size_t RESUME_NONCE_SIZE = 16; // Random nonce of each side, both are mixed into the resumed session key
+constexpr size_t CONTENT_DIGEST_SIZE = 32; // SHA-256 of the plain file content, the server finds content it already stored by it
+constexpr size_t STRONG_SIGNATURE_SIZE = 16; // SHA-256 of a block truncated, confirms a match of the rolling checksum of a delta upload
 
 enum RequestCode
 {
 	REQUEST_REGISTRATION   = 1100,  
 	REQUEST_SEND_PUBLIC_KEY = 1101,   
+	REQUEST_SEND_VARIABLE_PUBLIC_KEY = 1102,
 	REQUEST_RECONNECT = 1002,   
 	REQUEST_SEND_FILE = 1003,
 	REQUEST_VALID_CRC = 1004,
 	REQUEST_INVALID_CRC_RETRY = 1005,   
-	REQUEST_INVALID_CRC_FINISH = 1006
+	REQUEST_INVALID_CRC_FINISH = 1006,
+	REQUEST_UPLOAD_BEGIN = 1007,
+	REQUEST_UPLOAD_CHUNK = 1008,
+	REQUEST_UPLOAD_COMMIT = 1009,
+	REQUEST_UPLOAD_BEGIN_CIPHER = 1010,
+	REQUEST_RESUMPTION_TICKET = 1011,
+	REQUEST_RESUME = 1012,
+	REQUEST_UPLOAD_VERIFY = 1013,
+	REQUEST_UPLOAD_REPAIR_CHUNK = 1014,
+	REQUEST_UPLOAD_PRECHECK = 1015,
+	REQUEST_UPLOAD_SIGNATURES = 1016,
+	REQUEST_UPLOAD_DELTA = 1017,
+	REQUEST_UPLOAD_BEGIN_CODEC = 1018,
+	REQUEST_UPLOAD_NUMBERED_CHUNK = 1019,
+	REQUEST_UPLOAD_NUMBERED_REPAIR_CHUNK = 1020,
+	REQUEST_UPLOAD_NUMBERED_DELTA = 1021
 };
 
 enum ResponseCode
@@ -39,6 +67,33 @@ enum ResponseCode
 	RESPONSE_RECONNECT_ALLOWED = 2105,
 	RESPONSE_RECONNECT_REJECTED = 2106,
 	RESPONSE_GLOBAL_ERROR = 2107,
+	RESPONSE_UPLOAD_STATE = 2108,
+	RESPONSE_UPLOAD_CRC = 2109,
+	RESPONSE_RESUMPTION_TICKET = 2110,
+	RESPONSE_RESUME_ALLOWED = 2111,
+	RESPONSE_UPLOAD_CHUNK_CRCS = 2112,
+	RESPONSE_UPLOAD_SIGNATURES = 2113
+};
+
+// Cipher of upload chunks, negotiated by REQUEST_UPLOAD_BEGIN_CIPHER. A server that doesn't know it gets CBC
+enum CipherMode : uint8_t
+{
+	CIPHER_AES_CBC = 0,          // each chunk in AES-CBC with zero iv and PKCS#7 padding
+	CIPHER_AES_GCM_SEGMENTS = 1  // each chunk in segments of CIPHER_SEGMENT_SIZE, AES-GCM each and followed by its tag
+};
+
+// Compression of upload chunks before their encryption, negotiated by REQUEST_UPLOAD_BEGIN_CODEC. A server that doesn't know it gets plain chunks
+enum Codec : uint8_t
+{
+	CODEC_NONE = 0,
+	CODEC_ZLIB = 1  // chunks that get smaller are sent as a zlib stream, the others as they are
+};
+
+// Instructions of a delta upload, each is the op byte and its little endian fields
+enum DeltaOp : uint8_t
+{
+	DELTA_COPY = 0,    // uint32_t first block and uint32_t block count of the stored version
+	DELTA_LITERAL = 1  // uint32_t size and the bytes
 };
 
 #pragma pack(push, 1)
@@ -96,7 +151,7 @@ struct FileName
 		return os;
 	}
 
-	std::string ToString() { return reinterpret_cast<const char*>(name);}
+	std::string ToString() const { return reinterpret_cast<const char*>(name);}
 };
 
 struct PublicKey
@@ -111,6 +166,12 @@ struct AesKey
 	AesKey() : aesKey{ DEFAULT_INT_VAL } {}
 };
 
+struct ContentDigest
+{
+	uint8_t digest[CONTENT_DIGEST_SIZE];
+	ContentDigest() : digest{ DEFAULT_INT_VAL } {}
+};
+
 struct RequestHeader
 {
 	ClientID clientId;
@@ -193,6 +254,70 @@ struct RequestPublicKey
 	}
 };
 
+/* public key of any size, need after serialization add the key bytes to the end */
+struct RequestVariablePublicKeyWithoutKey
+{
+	RequestHeader header;
+	struct
+	{
+		ClientName clientName;
+		uint16_t keySize;
+	}payload;
+
+	RequestVariablePublicKeyWithoutKey(const ClientID& id, uint16_t keySize) : header(id, REQUEST_SEND_VARIABLE_PUBLIC_KEY), payload{}
+	{
+		payload.keySize = keySize;
+		header.payloadSize = sizeof(payload) + keySize;
+	}
+};
+
+/* ask for a ticket of the current session key, the header is the whole request */
+struct RequestResumptionTicket
+{
+	RequestHeader header;
+	RequestResumptionTicket(const ClientID& id) : header(id, REQUEST_RESUMPTION_TICKET) {}
+};
+
+struct ResponseResumptionTicket
+{
+	ResponseHeader header;
+	struct
+	{
+		ClientID clientId;
+		uint32_t lifetime; // seconds the ticket is valid
+		uint8_t ticket[TICKET_SIZE];
+	}payload;
+};
+
+/* reconnect with a ticket instead of RSA, the session key is derived from the key in the ticket and both nonces */
+struct RequestResume
+{
+	RequestHeader header;
+	struct
+	{
+		uint8_t clientNonce[RESUME_NONCE_SIZE];
+		uint8_t ticket[TICKET_SIZE];
+	}payload;
+
+	RequestResume(const ClientID& id) : header(id, REQUEST_RESUME), payload{}
+	{
+		header.payloadSize = sizeof(payload);
+	}
+};
+
+/* the ticket is a new one of the derived session key, a rejected resume is answered by RESPONSE_RECONNECT_REJECTED */
+struct ResponseResumeAllowed
+{
+	ResponseHeader header;
+	struct
+	{
+		ClientID clientId;
+		uint8_t serverNonce[RESUME_NONCE_SIZE];
+		uint32_t lifetime;
+		uint8_t ticket[TICKET_SIZE];
+	}payload;
+};
+
 /* struct for response that contains only client id in the payload such as:
 	RESPONSE_MSG_RECEIVED = 2104
 	RESPONSE_RECONNECT_ALLOWED = 2105 (the dynamic field of symmtric key handled outside the struct)
@@ -215,7 +340,7 @@ struct RequestSendFileWithoutContent
 	RequestHeader header;
 	struct
 	{
-		int contentSize;
+		uint32_t contentSize;
 		FileName fileName;
 
 	}payload;
@@ -238,4 +363,278 @@ struct ResponseValidCrc
 	}payload;
 };
 
+struct RequestUploadBegin
+{
+	RequestHeader header;
+	struct
+	{
+		FileName fileName;
+		uint64_t fileSize;  // plain file size
+	}payload;
+
+	RequestUploadBegin(const ClientID& id) : header(id, REQUEST_UPLOAD_BEGIN), payload{}
+	{
+		header.payloadSize = sizeof(payload);
+	}
+};
+
+/* upload begin that also negotiates the cipher of the chunks, the server responds with upload state if it accepts the cipher */
+struct RequestUploadBeginCipher
+{
+	RequestHeader header;
+	struct
+	{
+		FileName fileName;
+		uint64_t fileSize;  // plain file size
+		uint8_t cipherMode;
+		uint8_t nonce[CIPHER_NONCE_SIZE];
+	}payload;
+
+	RequestUploadBeginCipher(const ClientID& id) : header(id, REQUEST_UPLOAD_BEGIN_CIPHER), payload{}
+	{
+		header.payloadSize = sizeof(payload);
+	}
+};
+
+/* upload begin cipher that also negotiates the compression of the chunks, the server responds with upload state if it accepts both */
+struct RequestUploadBeginCodec
+{
+	RequestHeader header;
+	struct
+	{
+		FileName fileName;
+		uint64_t fileSize;  // plain file size
+		uint8_t cipherMode;
+		uint8_t nonce[CIPHER_NONCE_SIZE];
+		uint8_t codec;
+	}payload;
+
+	RequestUploadBeginCodec(const ClientID& id) : header(id, REQUEST_UPLOAD_BEGIN_CODEC), payload{}
+	{
+		header.payloadSize = sizeof(payload);
+	}
+};
+
+/* need after serialization add encrypted chunk bytes to the end and update payloadSize */
+struct RequestUploadChunkWithoutContent
+{
+	RequestHeader header;
+	struct
+	{
+		FileName fileName;
+		uint64_t offset;       // offset of the chunk in the plain file
+		uint32_t contentSize;  // encrypted chunk size
+	}payload;
+
+	RequestUploadChunkWithoutContent(const ClientID& id) : header(id, REQUEST_UPLOAD_CHUNK), payload{}
+	{
+		header.payloadSize = sizeof(payload);
+	}
+};
+
+/* chunk of an upload begun with REQUEST_UPLOAD_BEGIN_CODEC, need after serialization add encrypted chunk bytes to the end and update payloadSize.
+   Under CIPHER_AES_GCM_SEGMENTS its segments use the file nonce with its first 4 bytes xor the big endian send as well. Every send takes a new number,
+   so bytes that differ between two sends of one offset (another compression level after a rewind, a file written meanwhile) never share a nonce */
+struct RequestUploadNumberedChunkWithoutContent
+{
+	RequestHeader header;
+	struct
+	{
+		FileName fileName;
+		uint64_t offset;       // offset of the chunk in the plain file
+		uint32_t send;         // sends of the upload count from 1, a number is never repeated under one upload nonce
+		uint8_t codec;         // of the content, CODEC_NONE for a chunk that didn't get smaller
+		uint32_t contentSize;  // encrypted chunk size
+	}payload;
+
+	RequestUploadNumberedChunkWithoutContent(const ClientID& id) : header(id, REQUEST_UPLOAD_NUMBERED_CHUNK), payload{}
+	{
+		header.payloadSize = sizeof(payload);
+	}
+};
+
+struct RequestUploadCommit
+{
+	RequestHeader header;
+	FileName fileName;
+	RequestUploadCommit(const ClientID& id) : header(id, REQUEST_UPLOAD_COMMIT)
+	{
+		header.payloadSize = sizeof(FileName);
+	}
+};
+
+// Content of an upload precheck, sealed in the request so only the holder of the session key can ask and nobody else learns the digest
+struct UploadPrecheckContent
+{
+	FileName fileName;
+	uint64_t fileSize;  // plain file size
+	ContentDigest digest;
+};
+
+/* ask the server to store the file from content it already has, it responds with upload crc if it had the content, otherwise with message received.
+   The content is one AES-GCM segment under the session key with a random nonce, followed by its tag */
+struct RequestUploadPrecheck
+{
+	RequestHeader header;
+	struct
+	{
+		uint8_t nonce[CIPHER_NONCE_SIZE];
+		uint8_t sealed[sizeof(UploadPrecheckContent) + CIPHER_TAG_SIZE];
+	}payload;
+
+	RequestUploadPrecheck(const ClientID& id) : header(id, REQUEST_UPLOAD_PRECHECK), payload{}
+	{
+		header.payloadSize = sizeof(payload);
+	}
+};
+
+/* ask for the crc of every chunk of a completed upload before it is committed */
+struct RequestUploadVerify
+{
+	RequestHeader header;
+	FileName fileName;
+	RequestUploadVerify(const ClientID& id) : header(id, REQUEST_UPLOAD_VERIFY)
+	{
+		header.payloadSize = sizeof(FileName);
+	}
+};
+
+/* rewrite a chunk the server already received, at a chunk offset. need after serialization add encrypted chunk bytes to the end and update payloadSize */
+struct RequestUploadRepairChunkWithoutContent
+{
+	RequestHeader header;
+	struct
+	{
+		FileName fileName;
+		uint64_t offset;       // offset of the chunk in the plain file
+		uint32_t contentSize;  // encrypted chunk size
+	}payload;
+
+	RequestUploadRepairChunkWithoutContent(const ClientID& id) : header(id, REQUEST_UPLOAD_REPAIR_CHUNK), payload{}
+	{
+		header.payloadSize = sizeof(payload);
+	}
+};
+
+/* response for upload verify, count crcs of uint32_t follow, one for each chunkSize plain bytes of the received file */
+/* repair chunk of an upload begun with REQUEST_UPLOAD_BEGIN_CODEC, under the nonces of a new send like a numbered chunk */
+struct RequestUploadNumberedRepairChunkWithoutContent
+{
+	RequestHeader header;
+	struct
+	{
+		FileName fileName;
+		uint64_t offset;       // offset of the chunk in the plain file
+		uint32_t send;         // sends of the upload count from 1, a number is never repeated under one upload nonce
+		uint8_t codec;         // of the content
+		uint32_t contentSize;  // encrypted chunk size
+	}payload;
+
+	RequestUploadNumberedRepairChunkWithoutContent(const ClientID& id) : header(id, REQUEST_UPLOAD_NUMBERED_REPAIR_CHUNK), payload{}
+	{
+		header.payloadSize = sizeof(payload);
+	}
+};
+
+struct ResponseUploadChunkCrcsWithoutCrcs
+{
+	ResponseHeader header;
+	struct
+	{
+		ClientID clientId;
+		uint32_t chunkSize;
+		uint32_t count;
+	}payload;
+};
+
+/* ask for the block signatures of the stored version of the file, the base of a delta upload */
+struct RequestUploadSignatures
+{
+	RequestHeader header;
+	FileName fileName;
+	RequestUploadSignatures(const ClientID& id) : header(id, REQUEST_UPLOAD_SIGNATURES)
+	{
+		header.payloadSize = sizeof(FileName);
+	}
+};
+
+struct BlockSignature
+{
+	uint32_t weak;                          // Adler-32 of the block, rolled over the new file
+	uint8_t strong[STRONG_SIGNATURE_SIZE];
+};
+
+/* response for upload signatures, count BlockSignature of every blockSize bytes of the stored version follow. count is 0 if there is no stored version */
+struct ResponseUploadSignaturesWithoutSignatures
+{
+	ResponseHeader header;
+	struct
+	{
+		ClientID clientId;
+		uint64_t baseSize;   // size of the stored version, its last block may be shorter
+		uint32_t blockSize;
+		uint32_t count;
+	}payload;
+};
+
+/* delta instructions that continue an upload at offset from the stored version. need after serialization add the encrypted instructions to the end and update payloadSize */
+struct RequestUploadDeltaWithoutContent
+{
+	RequestHeader header;
+	struct
+	{
+		FileName fileName;
+		uint64_t offset;       // plain offset the instructions start at
+		uint32_t contentSize;  // encrypted instructions size
+	}payload;
+
+	RequestUploadDeltaWithoutContent(const ClientID& id) : header(id, REQUEST_UPLOAD_DELTA), payload{}
+	{
+		header.payloadSize = sizeof(payload);
+	}
+};
+
+/* delta instructions of an upload begun with REQUEST_UPLOAD_BEGIN_CODEC, encrypted with the upload cipher instead of CBC.
+   Under CIPHER_AES_GCM_SEGMENTS its segments count from 0 under the nonces of its own send, the same payload as a numbered chunk */
+struct RequestUploadNumberedDeltaWithoutContent
+{
+	RequestHeader header;
+	struct
+	{
+		FileName fileName;
+		uint64_t offset;       // plain offset the instructions start at
+		uint32_t send;         // sends of the upload count from 1, a number is never repeated under one upload nonce
+		uint8_t codec;         // CODEC_NONE, the instructions are sent as they are
+		uint32_t contentSize;  // encrypted instructions size
+	}payload;
+
+	RequestUploadNumberedDeltaWithoutContent(const ClientID& id) : header(id, REQUEST_UPLOAD_NUMBERED_DELTA), payload{}
+	{
+		header.payloadSize = sizeof(payload);
+	}
+};
+
+/* response for upload begin and upload chunk, offset is the plain bytes the server already acknowledged */
+struct ResponseUploadState
+{
+	ResponseHeader header;
+	struct
+	{
+		ClientID clientId;
+		uint64_t offset;
+	}payload;
+};
+
+struct ResponseUploadCrc
+{
+	ResponseHeader header;
+	struct
+	{
+		ClientID clientId;
+		uint64_t contentSize;
+		FileName filename;
+		uint32_t crc;
+	}payload;
+};
+
 #pragma pack(pop)
@@ -0,0 +1,87 @@
+#include "RSAKeyPool.h"
+#include <stdexcept>
+#include <algorithm>
+
+RSAKeyPool::~RSAKeyPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+	if (m_generator.joinable())
+	{
+		m_generator.join(); // waits for a key in generation, it can't be interrupted
+	}
+}
+
+RSAKeyPool& RSAKeyPool::Shared()
+{
+	static RSAKeyPool pool;
+	return pool;
+}
+
+void RSAKeyPool::Prefetch(size_t bits, size_t count)
+{
+	if (!RSAPrivateWrapper::IsValidBits(bits))
+	{
+		throw std::invalid_argument("RSA key size " + std::to_string(bits) + " bits is not supported");
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (bits != m_bits)
+		{
+			m_bits = bits;
+			m_keys.clear();
+		}
+		m_pending = std::min(m_pending + count, MAX_PREFETCHED_RSA_KEYS - std::min(m_keys.size(), MAX_PREFETCHED_RSA_KEYS));
+		if (!m_generator.joinable())
+		{
+			m_generator = std::thread(&RSAKeyPool::Generate, this);
+		}
+	}
+	m_condition.notify_all();
+}
+
+void RSAKeyPool::Generate()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		m_condition.wait(lock, [this]() { return m_stopping || m_pending > 0; });
+		if (m_stopping)
+		{
+			return;
+		}
+
+		const size_t bits = m_bits;
+		lock.unlock();
+		auto key = std::make_shared<RSAPrivateWrapper>(bits);
+		lock.lock();
+
+		// a key of the size before Prefetch changed it is dropped, the pending count is of the new size
+		if (bits == m_bits)
+		{
+			m_keys.push_back(std::move(key));
+			--m_pending;
+			m_condition.notify_all();
+		}
+	}
+}
+
+std::shared_ptr<RSAPrivateWrapper> RSAKeyPool::Take()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_keys.empty() && m_pending == 0)
+	{
+		const size_t bits = m_bits;
+		lock.unlock();
+		return std::make_shared<RSAPrivateWrapper>(bits);
+	}
+
+	m_condition.wait(lock, [this]() { return !m_keys.empty(); });
+	auto key = std::move(m_keys.front());
+	m_keys.pop_front();
+	return key;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <boost/noncopyable.hpp>
+#include "RSAWrapper.h"
+
+constexpr size_t MAX_PREFETCHED_RSA_KEYS = 8; // Keypairs generated ahead at most, each takes a while and stays in memory
+
+// Generates RSA keypairs on a background thread, so registration takes a ready key instead of generating one
+class RSAKeyPool : boost::noncopyable
+{
+	std::thread m_generator;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<std::shared_ptr<RSAPrivateWrapper>> m_keys;
+	size_t m_bits = DEFAULT_RSA_BITS;
+	size_t m_pending = 0; // Keys to generate, the one in generation included
+	bool m_stopping = false;
+
+	void Generate();
+
+public:
+	RSAKeyPool() = default;
+	~RSAKeyPool();
+
+	static RSAKeyPool& Shared();
+
+	// Generate count more keys of bits in the background, pooled keys of another size are dropped
+	void Prefetch(size_t bits = DEFAULT_RSA_BITS, size_t count = 1);
+
+	// Return a pooled key, wait for the one in generation, or generate a key now if none is prefetched
+	std::shared_ptr<RSAPrivateWrapper> Take();
+};
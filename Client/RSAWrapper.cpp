@@ -16,9 +16,13 @@ std::string RSAPublicWrapper::encrypt(const uint8_t* plain, size_t length)
 	return cipher;
 }
 
-RSAPrivateWrapper::RSAPrivateWrapper()
+RSAPrivateWrapper::RSAPrivateWrapper() : RSAPrivateWrapper(DEFAULT_RSA_BITS)
 {
-	m_privateKey.Initialize(m_rng, BITS);
+}
+
+RSAPrivateWrapper::RSAPrivateWrapper(size_t bits)
+{
+	m_privateKey.Initialize(m_rng, static_cast<unsigned int>(bits));
 }
 
 RSAPrivateWrapper::RSAPrivateWrapper(const std::string& key)
@@ -4,7 +4,8 @@
 #include <string>
 #include "protocol.h"
 
-static constexpr size_t BITS = 1024;
+static constexpr size_t DEFAULT_RSA_BITS = 2048;
+static constexpr size_t LEGACY_RSA_BITS = 1024; // The only size whose public key fits PUBLIC_KEY_SIZE of older servers
 
 class RSAPublicWrapper
 {
@@ -35,8 +36,11 @@ private:
 
 public:
 	RSAPrivateWrapper();
+	explicit RSAPrivateWrapper(size_t bits);
 	RSAPrivateWrapper(const std::string& key);
 
+	static bool IsValidBits(size_t bits) { return bits == LEGACY_RSA_BITS || bits == 2048 || bits == 3072; }
+
 	virtual ~RSAPrivateWrapper() = default;
 	RSAPrivateWrapper(const RSAPrivateWrapper& other) = delete;
 	RSAPrivateWrapper(RSAPrivateWrapper&& other) noexcept = delete;
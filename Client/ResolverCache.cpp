@@ -0,0 +1,47 @@
+#include "ResolverCache.h"
+
+ResolverCache& ResolverCache::Shared()
+{
+	static ResolverCache cache;
+	return cache;
+}
+
+std::optional<tcp::resolver::results_type> ResolverCache::Find(const std::string& address, const std::string& port)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const auto entry = m_entries.find(Key(address, port));
+	if (entry == m_entries.end())
+	{
+		return std::nullopt;
+	}
+	if (std::chrono::steady_clock::now() - entry->second.resolvedAt >= RESOLVE_TTL)
+	{
+		m_entries.erase(entry);
+		return std::nullopt;
+	}
+	return entry->second.endpoints;
+}
+
+void ResolverCache::Store(const std::string& address, const std::string& port, const tcp::resolver::results_type& endpoints)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries[Key(address, port)] = Entry{ endpoints, std::chrono::steady_clock::now() };
+}
+
+void ResolverCache::Invalidate(const std::string& address, const std::string& port)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.erase(Key(address, port));
+}
+
+tcp::resolver::results_type ResolverCache::Resolve(tcp::resolver& resolver, const std::string& address, const std::string& port)
+{
+	if (const auto endpoints = Find(address, port))
+	{
+		return *endpoints;
+	}
+
+	const auto endpoints = resolver.resolve(address, port, tcp::resolver::query::canonical_name);
+	Store(address, port, endpoints);
+	return endpoints;
+}
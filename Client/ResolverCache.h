@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <optional>
+#include <boost/asio/ip/tcp.hpp>
+
+using boost::asio::ip::tcp;
+
+constexpr std::chrono::seconds RESOLVE_TTL(60); // Resolved endpoints are reused for this long before resolving again
+
+// Process wide cache of resolved endpoints, so a connect doesn't resolve the address again on every request
+class ResolverCache
+{
+	struct Entry
+	{
+		tcp::resolver::results_type endpoints;
+		std::chrono::steady_clock::time_point resolvedAt;
+	};
+
+	std::mutex m_mutex;
+	std::map<std::string, Entry> m_entries; // by address:port
+
+	static std::string Key(const std::string& address, const std::string& port) { return address + ":" + port; }
+
+public:
+	static ResolverCache& Shared();
+
+	std::optional<tcp::resolver::results_type> Find(const std::string& address, const std::string& port);
+	void Store(const std::string& address, const std::string& port, const tcp::resolver::results_type& endpoints);
+	void Invalidate(const std::string& address, const std::string& port); // after a failed connect, the address may have moved
+
+	// Cached endpoints or resolve with resolver and cache them, throw as resolve does if failed
+	tcp::resolver::results_type Resolve(tcp::resolver& resolver, const std::string& address, const std::string& port);
+};
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <typeinfo>
+#include "Protocol.h"
+#include "Serializer.h"
+#include "FatalError.h"
+
+// Non owning view of a received response, the bytes are owned by the socket that received them
+// and stay valid until the next request on that socket. The bytes are kept in wire order, typed access decodes them
+class ResponseView
+{
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+
+public:
+	ResponseView() = default;
+	ResponseView(const uint8_t* data, size_t size) : m_data(size >= sizeof(ResponseHeader) ? data : nullptr), m_size(size) {}
+
+	explicit operator bool() const { return m_data != nullptr; }
+
+	ResponseHeader Header() const { return Serializer::Decode<ResponseHeader>(m_data); }
+	uint16_t Code() const { return Header().code; }
+	const uint8_t* Payload() const { return m_data + sizeof(ResponseHeader); }
+	uint32_t PayloadSize() const { return Header().payloadSize; }
+	size_t Size() const { return m_size; }
+
+	// Decoded copy of a response struct, throw if the received bytes are shorter than the struct
+	template <typename T>
+	T As() const
+	{
+		if (m_data == nullptr || m_size < sizeof(T))
+		{
+			throw FatalException("Response of " + std::to_string(m_size) + " bytes is too short for " + typeid(T).name());
+		}
+		return Serializer::Decode<T>(m_data);
+	}
+};
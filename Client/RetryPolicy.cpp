@@ -0,0 +1,44 @@
+#include "RetryPolicy.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+constexpr double RETRY_BUDGET_MAX_TOKENS = 10.0;       // Retries allowed in a row when all requests fail
+constexpr double RETRY_BUDGET_TOKENS_PER_SUCCESS = 0.1; // Each successful request earns a tenth of a retry
+
+std::chrono::milliseconds RetryPolicy::Delay(int attempt) const
+{
+	thread_local std::mt19937 generator{ std::random_device{}() };
+
+	const double exponential = static_cast<double>(baseDelay.count()) * std::pow(multiplier, attempt);
+	const double cap = std::min(static_cast<double>(maxDelay.count()), exponential);
+	std::uniform_real_distribution<double> jitter(0.0, cap);
+	return std::chrono::milliseconds(static_cast<long long>(jitter(generator)));
+}
+
+RetryBudget::RetryBudget(double maxTokens, double tokensPerSuccess) : m_tokens(maxTokens), m_maxTokens(maxTokens), m_tokensPerSuccess(tokensPerSuccess)
+{
+}
+
+RetryBudget& RetryBudget::Shared()
+{
+	static RetryBudget budget(RETRY_BUDGET_MAX_TOKENS, RETRY_BUDGET_TOKENS_PER_SUCCESS);
+	return budget;
+}
+
+void RetryBudget::OnSuccess()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_tokens = std::min(m_maxTokens, m_tokens + m_tokensPerSuccess);
+}
+
+bool RetryBudget::TryRetry()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_tokens < 1.0)
+	{
+		return false;
+	}
+	m_tokens -= 1.0;
+	return true;
+}
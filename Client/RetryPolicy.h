@@ -0,0 +1,33 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+
+// Backoff between attempts of a retryable request, the delay grows exponentially and is fully jittered
+// so many clients that failed together don't retry together
+struct RetryPolicy
+{
+	std::chrono::milliseconds baseDelay{ 100 };
+	std::chrono::milliseconds maxDelay{ 5000 };
+	double multiplier = 2.0;
+
+	// Random delay in [0, min(maxDelay, baseDelay * multiplier^attempt)] before the retry that follows attempt (0 based)
+	std::chrono::milliseconds Delay(int attempt) const;
+};
+
+// Limits retries to a fraction of the successful requests, so a failing server gets less load and not more.
+// Shared by all sockets of the process.
+class RetryBudget
+{
+	std::mutex m_mutex;
+	double m_tokens;
+	const double m_maxTokens;
+	const double m_tokensPerSuccess;
+
+public:
+	RetryBudget(double maxTokens, double tokensPerSuccess);
+
+	static RetryBudget& Shared();
+
+	void OnSuccess();
+	bool TryRetry(); // take a token for a retry, false if the budget is exhausted
+};
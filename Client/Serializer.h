@@ -0,0 +1,372 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <intrin.h>
+#include "Protocol.h"
+
+// Field of a protocol struct on the wire, only multi byte integers are swapped on a big endian host
+struct WireField
+{
+	size_t offset;
+	size_t size;
+	bool integer;
+};
+
+// Fields of a protocol struct in order, specialized below for every struct in Protocol.h
+template <typename T>
+struct WireLayout;
+
+namespace WireLayouts
+{
+	// Fields of a member at offset, a nested struct is expanded to its own fields
+	template <typename Member>
+	constexpr auto FieldsOf(size_t offset)
+	{
+		using T = std::remove_cv_t<Member>;
+		if constexpr (std::is_integral_v<T> || std::is_enum_v<T>)
+		{
+			return std::array<WireField, 1>{ WireField{ offset, sizeof(T), sizeof(T) > 1 } };
+		}
+		else if constexpr (std::is_array_v<T> && sizeof(std::remove_extent_t<T>) == 1)
+		{
+			return std::array<WireField, 1>{ WireField{ offset, sizeof(T), false } };
+		}
+		else
+		{
+			auto fields = WireLayout<T>::FIELDS;
+			for (auto& field : fields)
+			{
+				field.offset += offset;
+			}
+			return fields;
+		}
+	}
+
+	template <size_t... N>
+	constexpr auto Concat(const std::array<WireField, N>&... parts)
+	{
+		std::array<WireField, (N + ...)> fields{};
+		size_t i = 0;
+		auto append = [&](const auto& part)
+		{
+			for (const auto& field : part)
+			{
+				fields[i++] = field;
+			}
+		};
+		(append(parts), ...);
+		return fields;
+	}
+
+	// True if the fields cover every byte of T in order, so a field added to a struct can't be missed by its layout
+	template <typename T>
+	constexpr bool CoversStruct()
+	{
+		size_t offset = 0;
+		for (const auto& field : WireLayout<T>::FIELDS)
+		{
+			if (field.offset != offset)
+			{
+				return false;
+			}
+			offset += field.size;
+		}
+		return offset == sizeof(T);
+	}
+
+	template <typename T>
+	constexpr size_t CountIntegers()
+	{
+		size_t count = 0;
+		for (const auto& field : WireLayout<T>::FIELDS)
+		{
+			count += field.integer ? 1 : 0;
+		}
+		return count;
+	}
+
+	template <typename T>
+	constexpr auto Integers()
+	{
+		std::array<WireField, CountIntegers<T>()> integers{};
+		size_t i = 0;
+		for (const auto& field : WireLayout<T>::FIELDS)
+		{
+			if (field.integer)
+			{
+				integers[i++] = field;
+			}
+		}
+		return integers;
+	}
+
+	// Multi byte integers of T, the only fields that differ between host and wire byte order
+	template <typename T>
+	constexpr auto INTEGERS = Integers<T>();
+}
+
+#define WIRE_FIELD(Type, member) WireLayouts::FieldsOf<decltype(Type::member)>(offsetof(Type, member))
+
+template <> struct WireLayout<ClientID> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ClientID, uuid)); };
+template <> struct WireLayout<ClientName> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ClientName, name)); };
+template <> struct WireLayout<FileName> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(FileName, name)); };
+template <> struct WireLayout<PublicKey> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(PublicKey, publicKey)); };
+template <> struct WireLayout<AesKey> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(AesKey, aesKey)); };
+template <> struct WireLayout<ContentDigest> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ContentDigest, digest)); };
+
+template <> struct WireLayout<RequestHeader>
+{
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestHeader, clientId), WIRE_FIELD(RequestHeader, version), WIRE_FIELD(RequestHeader, code), WIRE_FIELD(RequestHeader, payloadSize));
+};
+
+template <> struct WireLayout<ResponseHeader>
+{
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ResponseHeader, version), WIRE_FIELD(ResponseHeader, code), WIRE_FIELD(ResponseHeader, payloadSize));
+};
+
+template <> struct WireLayout<RequestRegistration> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestRegistration, header), WIRE_FIELD(RequestRegistration, clientName)); };
+template <> struct WireLayout<RequestReconnect> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestReconnect, header), WIRE_FIELD(RequestReconnect, clientName)); };
+template <> struct WireLayout<RequestValidCrc> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestValidCrc, header), WIRE_FIELD(RequestValidCrc, fileName)); };
+template <> struct WireLayout<RequestInvalidCrc> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestInvalidCrc, header), WIRE_FIELD(RequestInvalidCrc, fileName)); };
+template <> struct WireLayout<RequestInvalidCrcFinish> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestInvalidCrcFinish, header), WIRE_FIELD(RequestInvalidCrcFinish, fileName)); };
+template <> struct WireLayout<RequestUploadCommit> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadCommit, header), WIRE_FIELD(RequestUploadCommit, fileName)); };
+template <> struct WireLayout<ResponseWithClientID> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ResponseWithClientID, header), WIRE_FIELD(ResponseWithClientID, clientId)); };
+template <> struct WireLayout<RequestResumptionTicket> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestResumptionTicket, header)); };
+template <> struct WireLayout<ResponseRegistrationFailed> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ResponseRegistrationFailed, header)); };
+
+template <> struct WireLayout<decltype(RequestPublicKey::payload)>
+{
+	using T = decltype(RequestPublicKey::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, clientName), WIRE_FIELD(T, clientPublicKey));
+};
+template <> struct WireLayout<RequestPublicKey> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestPublicKey, header), WIRE_FIELD(RequestPublicKey, payload)); };
+
+template <> struct WireLayout<decltype(RequestVariablePublicKeyWithoutKey::payload)>
+{
+	using T = decltype(RequestVariablePublicKeyWithoutKey::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, clientName), WIRE_FIELD(T, keySize));
+};
+template <> struct WireLayout<RequestVariablePublicKeyWithoutKey> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestVariablePublicKeyWithoutKey, header), WIRE_FIELD(RequestVariablePublicKeyWithoutKey, payload)); };
+
+template <> struct WireLayout<decltype(RequestSendFileWithoutContent::payload)>
+{
+	using T = decltype(RequestSendFileWithoutContent::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, contentSize), WIRE_FIELD(T, fileName));
+};
+template <> struct WireLayout<RequestSendFileWithoutContent> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestSendFileWithoutContent, header), WIRE_FIELD(RequestSendFileWithoutContent, payload)); };
+
+template <> struct WireLayout<decltype(ResponseValidCrc::payload)>
+{
+	using T = decltype(ResponseValidCrc::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, clientId), WIRE_FIELD(T, contentSize), WIRE_FIELD(T, filename), WIRE_FIELD(T, crc));
+};
+template <> struct WireLayout<ResponseValidCrc> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ResponseValidCrc, header), WIRE_FIELD(ResponseValidCrc, payload)); };
+
+template <> struct WireLayout<decltype(RequestUploadBegin::payload)>
+{
+	using T = decltype(RequestUploadBegin::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, fileName), WIRE_FIELD(T, fileSize));
+};
+template <> struct WireLayout<RequestUploadBegin> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadBegin, header), WIRE_FIELD(RequestUploadBegin, payload)); };
+
+template <> struct WireLayout<decltype(RequestUploadBeginCipher::payload)>
+{
+	using T = decltype(RequestUploadBeginCipher::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, fileName), WIRE_FIELD(T, fileSize), WIRE_FIELD(T, cipherMode), WIRE_FIELD(T, nonce));
+};
+template <> struct WireLayout<RequestUploadBeginCipher> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadBeginCipher, header), WIRE_FIELD(RequestUploadBeginCipher, payload)); };
+
+template <> struct WireLayout<decltype(RequestUploadBeginCodec::payload)>
+{
+	using T = decltype(RequestUploadBeginCodec::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, fileName), WIRE_FIELD(T, fileSize), WIRE_FIELD(T, cipherMode), WIRE_FIELD(T, nonce), WIRE_FIELD(T, codec));
+};
+template <> struct WireLayout<RequestUploadBeginCodec> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadBeginCodec, header), WIRE_FIELD(RequestUploadBeginCodec, payload)); };
+
+template <> struct WireLayout<decltype(RequestUploadChunkWithoutContent::payload)>
+{
+	using T = decltype(RequestUploadChunkWithoutContent::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, fileName), WIRE_FIELD(T, offset), WIRE_FIELD(T, contentSize));
+};
+template <> struct WireLayout<RequestUploadChunkWithoutContent> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadChunkWithoutContent, header), WIRE_FIELD(RequestUploadChunkWithoutContent, payload)); };
+
+template <> struct WireLayout<decltype(RequestUploadNumberedChunkWithoutContent::payload)>
+{
+	using T = decltype(RequestUploadNumberedChunkWithoutContent::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, fileName), WIRE_FIELD(T, offset), WIRE_FIELD(T, send), WIRE_FIELD(T, codec), WIRE_FIELD(T, contentSize));
+};
+template <> struct WireLayout<RequestUploadNumberedChunkWithoutContent> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadNumberedChunkWithoutContent, header), WIRE_FIELD(RequestUploadNumberedChunkWithoutContent, payload)); };
+
+template <> struct WireLayout<UploadPrecheckContent>
+{
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(UploadPrecheckContent, fileName), WIRE_FIELD(UploadPrecheckContent, fileSize), WIRE_FIELD(UploadPrecheckContent, digest));
+};
+template <> struct WireLayout<decltype(RequestUploadPrecheck::payload)>
+{
+	using T = decltype(RequestUploadPrecheck::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, nonce), WIRE_FIELD(T, sealed));
+};
+template <> struct WireLayout<RequestUploadPrecheck> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadPrecheck, header), WIRE_FIELD(RequestUploadPrecheck, payload)); };
+
+template <> struct WireLayout<RequestUploadVerify> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadVerify, header), WIRE_FIELD(RequestUploadVerify, fileName)); };
+
+template <> struct WireLayout<decltype(RequestUploadRepairChunkWithoutContent::payload)>
+{
+	using T = decltype(RequestUploadRepairChunkWithoutContent::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, fileName), WIRE_FIELD(T, offset), WIRE_FIELD(T, contentSize));
+};
+template <> struct WireLayout<RequestUploadRepairChunkWithoutContent> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadRepairChunkWithoutContent, header), WIRE_FIELD(RequestUploadRepairChunkWithoutContent, payload)); };
+
+template <> struct WireLayout<decltype(RequestUploadNumberedRepairChunkWithoutContent::payload)>
+{
+	using T = decltype(RequestUploadNumberedRepairChunkWithoutContent::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, fileName), WIRE_FIELD(T, offset), WIRE_FIELD(T, send), WIRE_FIELD(T, codec), WIRE_FIELD(T, contentSize));
+};
+template <> struct WireLayout<RequestUploadNumberedRepairChunkWithoutContent> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadNumberedRepairChunkWithoutContent, header), WIRE_FIELD(RequestUploadNumberedRepairChunkWithoutContent, payload)); };
+
+template <> struct WireLayout<decltype(ResponseUploadChunkCrcsWithoutCrcs::payload)>
+{
+	using T = decltype(ResponseUploadChunkCrcsWithoutCrcs::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, clientId), WIRE_FIELD(T, chunkSize), WIRE_FIELD(T, count));
+};
+template <> struct WireLayout<ResponseUploadChunkCrcsWithoutCrcs> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ResponseUploadChunkCrcsWithoutCrcs, header), WIRE_FIELD(ResponseUploadChunkCrcsWithoutCrcs, payload)); };
+
+template <> struct WireLayout<RequestUploadSignatures> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadSignatures, header), WIRE_FIELD(RequestUploadSignatures, fileName)); };
+template <> struct WireLayout<BlockSignature> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(BlockSignature, weak), WIRE_FIELD(BlockSignature, strong)); };
+
+template <> struct WireLayout<decltype(ResponseUploadSignaturesWithoutSignatures::payload)>
+{
+	using T = decltype(ResponseUploadSignaturesWithoutSignatures::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, clientId), WIRE_FIELD(T, baseSize), WIRE_FIELD(T, blockSize), WIRE_FIELD(T, count));
+};
+template <> struct WireLayout<ResponseUploadSignaturesWithoutSignatures> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ResponseUploadSignaturesWithoutSignatures, header), WIRE_FIELD(ResponseUploadSignaturesWithoutSignatures, payload)); };
+
+template <> struct WireLayout<decltype(RequestUploadDeltaWithoutContent::payload)>
+{
+	using T = decltype(RequestUploadDeltaWithoutContent::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, fileName), WIRE_FIELD(T, offset), WIRE_FIELD(T, contentSize));
+};
+template <> struct WireLayout<RequestUploadDeltaWithoutContent> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadDeltaWithoutContent, header), WIRE_FIELD(RequestUploadDeltaWithoutContent, payload)); };
+
+template <> struct WireLayout<decltype(RequestUploadNumberedDeltaWithoutContent::payload)>
+{
+	using T = decltype(RequestUploadNumberedDeltaWithoutContent::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, fileName), WIRE_FIELD(T, offset), WIRE_FIELD(T, send), WIRE_FIELD(T, codec), WIRE_FIELD(T, contentSize));
+};
+template <> struct WireLayout<RequestUploadNumberedDeltaWithoutContent> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestUploadNumberedDeltaWithoutContent, header), WIRE_FIELD(RequestUploadNumberedDeltaWithoutContent, payload)); };
+
+template <> struct WireLayout<decltype(ResponseUploadState::payload)>
+{
+	using T = decltype(ResponseUploadState::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, clientId), WIRE_FIELD(T, offset));
+};
+template <> struct WireLayout<ResponseUploadState> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ResponseUploadState, header), WIRE_FIELD(ResponseUploadState, payload)); };
+
+template <> struct WireLayout<decltype(ResponseUploadCrc::payload)>
+{
+	using T = decltype(ResponseUploadCrc::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, clientId), WIRE_FIELD(T, contentSize), WIRE_FIELD(T, filename), WIRE_FIELD(T, crc));
+};
+template <> struct WireLayout<ResponseUploadCrc> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ResponseUploadCrc, header), WIRE_FIELD(ResponseUploadCrc, payload)); };
+
+template <> struct WireLayout<decltype(ResponseResumptionTicket::payload)>
+{
+	using T = decltype(ResponseResumptionTicket::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, clientId), WIRE_FIELD(T, lifetime), WIRE_FIELD(T, ticket));
+};
+template <> struct WireLayout<ResponseResumptionTicket> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ResponseResumptionTicket, header), WIRE_FIELD(ResponseResumptionTicket, payload)); };
+
+template <> struct WireLayout<decltype(RequestResume::payload)>
+{
+	using T = decltype(RequestResume::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, clientNonce), WIRE_FIELD(T, ticket));
+};
+template <> struct WireLayout<RequestResume> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(RequestResume, header), WIRE_FIELD(RequestResume, payload)); };
+
+template <> struct WireLayout<decltype(ResponseResumeAllowed::payload)>
+{
+	using T = decltype(ResponseResumeAllowed::payload);
+	static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(T, clientId), WIRE_FIELD(T, serverNonce), WIRE_FIELD(T, lifetime), WIRE_FIELD(T, ticket));
+};
+template <> struct WireLayout<ResponseResumeAllowed> { static constexpr auto FIELDS = WireLayouts::Concat(WIRE_FIELD(ResponseResumeAllowed, header), WIRE_FIELD(ResponseResumeAllowed, payload)); };
+
+/*
+ * Converts protocol structs between host and wire (little endian) byte order by their WireLayout.
+ * On a little endian host both directions are a plain memcpy, on a big endian host only the multi byte integers
+ * are swapped, with the list of integers unrolled at compile time.
+ */
+class Serializer
+{
+	template <size_t Size>
+	static void SwapAt(uint8_t* bytes)
+	{
+		if constexpr (Size == sizeof(uint16_t))
+		{
+			uint16_t value;
+			memcpy(&value, bytes, Size);
+			value = _byteswap_ushort(value);
+			memcpy(bytes, &value, Size);
+		}
+		else if constexpr (Size == sizeof(uint32_t))
+		{
+			uint32_t value;
+			memcpy(&value, bytes, Size);
+			value = _byteswap_ulong(value);
+			memcpy(bytes, &value, Size);
+		}
+		else
+		{
+			static_assert(Size == sizeof(uint64_t), "Unsupported integer size on the wire");
+			uint64_t value;
+			memcpy(&value, bytes, Size);
+			value = _byteswap_uint64(value);
+			memcpy(bytes, &value, Size);
+		}
+	}
+
+	template <typename T, size_t... I>
+	static void SwapIntegers(uint8_t* bytes, std::index_sequence<I...>)
+	{
+		(SwapAt<WireLayouts::INTEGERS<T>[I].size>(bytes + WireLayouts::INTEGERS<T>[I].offset), ...);
+	}
+
+public:
+	Serializer() = delete;
+
+	// Convert bytes of T in place, the conversion is the same in both directions
+	template <typename T>
+	static void Convert(uint8_t* bytes)
+	{
+		static_assert(WireLayouts::CoversStruct<T>(), "WireLayout doesn't match the struct fields");
+		if constexpr (std::endian::native != std::endian::little)
+		{
+			SwapIntegers<T>(bytes, std::make_index_sequence<WireLayouts::INTEGERS<T>.size()>{});
+		}
+	}
+
+	// Wire bytes of value
+	template <typename T>
+	static std::array<uint8_t, sizeof(T)> Encode(const T& value)
+	{
+		std::array<uint8_t, sizeof(T)> bytes;
+		memcpy(bytes.data(), &value, sizeof(T));
+		Convert<T>(bytes.data());
+		return bytes;
+	}
+
+	// Host value of sizeof(T) wire bytes
+	template <typename T>
+	static T Decode(const uint8_t* bytes)
+	{
+		static_assert(std::is_default_constructible_v<T> && std::is_trivially_copyable_v<T>, "Only responses are decoded");
+		T value;
+		memcpy(&value, bytes, sizeof(T));
+		Convert<T>(reinterpret_cast<uint8_t*>(&value));
+		return value;
+	}
+};
@@ -0,0 +1,80 @@
+#include "SessionTicket.h"
+#include <fstream>
+#include <cstdio>
+#include <stdexcept>
+#include <hkdf.h>
+#include <sha.h>
+#include "Base64.h"
+
+const std::string SessionTicket::TICKET_FILE = "ticket.info";
+
+static const std::string RESUME_KEY_INFO = "resume session key";
+
+SessionTicket::SessionTicket(const uint8_t* ticket, const uint8_t* key, size_t keySize, uint32_t lifetime) : m_expiry(std::chrono::system_clock::now() + std::chrono::seconds(lifetime))
+{
+	if (keySize != AES_KEY_SIZE)
+	{
+		throw std::invalid_argument("Session key of " + std::to_string(keySize) + " bytes, expected " + std::to_string(AES_KEY_SIZE));
+	}
+	std::copy(ticket, ticket + TICKET_SIZE, m_ticket.begin());
+	std::copy(key, key + keySize, m_key.begin());
+}
+
+// Read ticket, key and expiry from file, an unreadable ticket is treated as missing so the client reconnects with RSA
+std::unique_ptr<SessionTicket> SessionTicket::Load()
+{
+	std::ifstream infile(TICKET_FILE);
+	if (!infile.is_open())
+	{
+		return nullptr;
+	}
+
+	std::string ticket, key, expiry;
+	if (!std::getline(infile, ticket) || !std::getline(infile, key) || !std::getline(infile, expiry))
+	{
+		return nullptr;
+	}
+
+	try
+	{
+		ticket = Base64::Decode(ticket);
+		key = Base64::Decode(key);
+		const auto expiryTime = std::chrono::system_clock::time_point(std::chrono::seconds(std::stoll(expiry)));
+		if (ticket.size() != TICKET_SIZE || expiryTime <= std::chrono::system_clock::now())
+		{
+			return nullptr;
+		}
+
+		auto loaded = std::make_unique<SessionTicket>(reinterpret_cast<const uint8_t*>(ticket.data()), reinterpret_cast<const uint8_t*>(key.data()), key.size(), 0);
+		loaded->m_expiry = expiryTime;
+		return loaded;
+	}
+	catch (const std::exception&)
+	{
+		return nullptr;
+	}
+}
+
+void SessionTicket::Remove()
+{
+	std::remove(TICKET_FILE.c_str());
+}
+
+void SessionTicket::Save() const
+{
+	std::ofstream outfile(TICKET_FILE);
+	outfile << Base64::Encode(m_ticket.data(), m_ticket.size()) << "\n" << Base64::Encode(m_key.data(), m_key.size()) << "\n"
+		<< std::chrono::duration_cast<std::chrono::seconds>(m_expiry.time_since_epoch()).count();
+}
+
+std::array<uint8_t, AES_KEY_SIZE> SessionTicket::ResumedKey(const uint8_t* clientNonce, const uint8_t* serverNonce) const
+{
+	uint8_t salt[2 * RESUME_NONCE_SIZE];
+	std::copy(clientNonce, clientNonce + RESUME_NONCE_SIZE, salt);
+	std::copy(serverNonce, serverNonce + RESUME_NONCE_SIZE, salt + RESUME_NONCE_SIZE);
+
+	std::array<uint8_t, AES_KEY_SIZE> resumed{};
+	CryptoPP::HKDF<CryptoPP::SHA256> hkdf;
+	hkdf.DeriveKey(resumed.data(), resumed.size(), m_key.data(), m_key.size(), salt, sizeof(salt), reinterpret_cast<const CryptoPP::byte*>(RESUME_KEY_INFO.data()), RESUME_KEY_INFO.size());
+	return resumed;
+}
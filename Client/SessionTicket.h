@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <array>
+#include <chrono>
+#include <memory>
+#include "protocol.h"
+
+// Resumption ticket the server issued for a session key, kept on the disk next to me.info for the next run
+class SessionTicket
+{
+	static const std::string TICKET_FILE;
+	std::array<uint8_t, TICKET_SIZE> m_ticket;
+	std::array<uint8_t, AES_KEY_SIZE> m_key; // Session key sealed in the ticket, the resumed key is derived from it
+	std::chrono::system_clock::time_point m_expiry;
+
+public:
+	SessionTicket(const uint8_t* ticket, const uint8_t* key, size_t keySize, uint32_t lifetime);
+
+	static std::unique_ptr<SessionTicket> Load(); // nullptr if there is no ticket or it expired
+	static void Remove();
+	void Save() const;
+
+	const uint8_t* Ticket() const { return m_ticket.data(); }
+
+	// Session key of a resume, HKDF-SHA256 of the ticket key salted with the client and then the server nonce
+	std::array<uint8_t, AES_KEY_SIZE> ResumedKey(const uint8_t* clientNonce, const uint8_t* serverNonce) const;
+};
@@ -0,0 +1,68 @@
+#include "Transport.h"
+#include <thread>
+#include <algorithm>
+
+Transport::Lease::Lease(Transport& transport, const std::string& key, std::unique_ptr<ClientSocket> socket) : m_transport(&transport), m_key(key), m_socket(std::move(socket))
+{
+}
+
+Transport::Lease& Transport::Lease::operator=(Lease&& other) noexcept
+{
+	if (this != &other)
+	{
+		if (m_transport != nullptr && m_socket != nullptr)
+		{
+			m_transport->Return(m_key, std::move(m_socket));
+		}
+		m_transport = other.m_transport;
+		m_key = std::move(other.m_key);
+		m_socket = std::move(other.m_socket);
+	}
+	return *this;
+}
+
+Transport::Lease::~Lease()
+{
+	if (m_transport != nullptr && m_socket != nullptr)
+	{
+		m_transport->Return(m_key, std::move(m_socket));
+	}
+}
+
+Transport::Transport() : m_computePool(std::max(1u, std::thread::hardware_concurrency()))
+{
+}
+
+Transport& Transport::Instance()
+{
+	static Transport transport;
+	return transport;
+}
+
+// Borrow an idle socket of the endpoint, or a new one on the shared io_context if none is idle
+Transport::Lease Transport::Acquire(const std::string& address, const std::string& port, bool sessionMode)
+{
+	const std::string key = address + ":" + port + (sessionMode ? "/session" : "");
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto& idle = m_idle[key];
+		if (!idle.empty())
+		{
+			auto socket = std::move(idle.back());
+			idle.pop_back();
+			return Lease(*this, key, std::move(socket));
+		}
+	}
+
+	return Lease(*this, key, std::make_unique<ClientSocket>(m_ioContext, address, port, sessionMode));
+}
+
+void Transport::Return(const std::string& key, std::unique_ptr<ClientSocket> socket)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto& idle = m_idle[key];
+	if (idle.size() < MAX_IDLE_CONNECTIONS)
+	{
+		idle.push_back(std::move(socket));
+	}
+}
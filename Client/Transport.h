@@ -0,0 +1,62 @@
+#pragma once
+#include <string>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include "ClientSocket.h"
+
+constexpr size_t MAX_IDLE_CONNECTIONS = 4; // Idle sockets kept per endpoint, more are closed when returned
+
+/*
+ * Process wide transport, one io_context for all sockets and a pool of warm sockets per endpoint.
+ * A flow borrows a socket for its requests and the socket returns to the pool with its open session when the lease ends.
+ * The CPU bound stages of the flows (digests, deltas, compression, encryption and crcs) run on compute threads, the io_context thread only moves bytes.
+ */
+class Transport : boost::noncopyable
+{
+public:
+	// Borrowed socket, returned to the pool on destruction
+	class Lease
+	{
+		Transport* m_transport = nullptr;
+		std::string m_key;
+		std::unique_ptr<ClientSocket> m_socket;
+
+	public:
+		Lease(Transport& transport, const std::string& key, std::unique_ptr<ClientSocket> socket);
+		Lease(Lease&& other) noexcept = default;
+		Lease& operator=(Lease&& other) noexcept; // returns the socket it held before
+		~Lease();
+
+		ClientSocket& operator*() const { return *m_socket; }
+		ClientSocket* operator->() const { return m_socket.get(); }
+	};
+
+	static Transport& Instance();
+
+	io_context& Context() { return m_ioContext; }
+	Lease Acquire(const std::string& address, const std::string& port, bool sessionMode = true);
+
+	// Run task on a compute thread and resume the awaiting coroutine on its own executor when it returns, rethrow what the task threw
+	template <typename Task>
+	awaitable<std::invoke_result_t<Task&>> Compute(Task task)
+	{
+		co_return co_await boost::asio::co_spawn(m_computePool, [&task]() -> awaitable<std::invoke_result_t<Task&>> { co_return task(); }, boost::asio::use_awaitable);
+	}
+
+private:
+	io_context m_ioContext;
+	boost::asio::thread_pool m_computePool; // one thread per hardware thread
+	std::mutex m_mutex;
+	std::map<std::string, std::vector<std::unique_ptr<ClientSocket>>> m_idle; // by address:port and session mode
+
+	Transport();
+	void Return(const std::string& key, std::unique_ptr<ClientSocket> socket);
+};
@@ -0,0 +1,151 @@
+#include "UploadPipeline.h"
+#include "ClientLogic.h"
+#include "Compression.h"
+#include <algorithm>
+
+static size_t ChunkMemory(const UploadCipher& cipher)
+{
+	const size_t compressed = cipher.codec != CODEC_NONE ? UPLOAD_CHUNK_SIZE : 0;
+	return compressed + (cipher.mode == CIPHER_AES_GCM_SEGMENTS ? AESWrapper::SegmentedCipherSize(UPLOAD_CHUNK_SIZE) : AESWrapper::CipherSize(UPLOAD_CHUNK_SIZE));
+}
+
+UploadPipeline::UploadPipeline(const FileSource& source, const AESWrapper& aesWrapper, const UploadCipher& cipher, size_t memoryBudget, uint32_t& sends) :
+	m_source(source), m_aesWrapper(aesWrapper), m_cipher(cipher),
+	m_chunks(std::max(MIN_CHUNKS, memoryBudget / ChunkMemory(cipher))), m_free(m_chunks.size()), m_read(m_chunks.size()), m_ready(m_chunks.size()),
+	m_level(Compression::MIN_LEVEL), m_sends(sends)
+{
+}
+
+UploadPipeline::~UploadPipeline()
+{
+	Stop();
+}
+
+void UploadPipeline::Stop()
+{
+	m_free.Cancel();
+	m_read.Cancel();
+	m_ready.Cancel();
+	if (m_reader.joinable())
+	{
+		m_reader.join();
+	}
+	if (m_computer.joinable())
+	{
+		m_computer.join();
+	}
+}
+
+void UploadPipeline::Start(uint64_t offset)
+{
+	Stop();
+	m_free.Reset();
+	m_read.Reset();
+	m_ready.Reset();
+	m_readError = nullptr;
+	m_computeError = nullptr;
+	for (auto& chunk : m_chunks)
+	{
+		m_free.Push(&chunk);
+	}
+
+	m_reader = std::thread(&UploadPipeline::Read, this, offset);
+	m_computer = std::thread(&UploadPipeline::Compute, this);
+}
+
+void UploadPipeline::Read(uint64_t offset)
+{
+	try
+	{
+		while (offset < m_source.Size())
+		{
+			const auto chunk = m_free.Pop();
+			if (!chunk)
+			{
+				return; // stopped
+			}
+			(*chunk)->offset = offset;
+			(*chunk)->plain = m_source.Bytes(offset, std::min<uint64_t>(UPLOAD_CHUNK_SIZE, m_source.Size() - offset));
+			m_source.Prefetch((*chunk)->plain);
+			offset += (*chunk)->plain.size();
+			if (!m_read.Push(*chunk))
+			{
+				return;
+			}
+		}
+		m_read.Close();
+	}
+	catch (...)
+	{
+		m_readError = std::current_exception();
+		m_read.Cancel();
+		m_ready.Cancel();
+	}
+}
+
+void UploadPipeline::Compute()
+{
+	try
+	{
+		while (const auto chunk = m_read.Pop())
+		{
+			Chunk& c = **chunk;
+			ClientLogic::UpdateUploadCrcs(m_source, m_crcs, c.offset + c.plain.size());
+			const size_t waiting = m_ready.Size();
+			m_level = Compression::NextLevel(m_level, waiting * 2 >= m_chunks.size(), waiting == 0);
+			c.send = m_cipher.numbered ? ++m_sends : 0; // a rewind encodes the same offset again, maybe at another level or from changed bytes
+			c.payload = ClientLogic::EncodeUploadChunk(m_aesWrapper, m_cipher, c.offset, c.plain, m_level, c.send, c.compressed, c.encrypted, c.codec);
+			if (!m_ready.Push(&c))
+			{
+				return;
+			}
+		}
+		m_ready.Close();
+	}
+	catch (...)
+	{
+		m_computeError = std::current_exception();
+		m_free.Cancel();
+		m_read.Cancel();
+		m_ready.Cancel();
+	}
+}
+
+UploadPipeline::Chunk* UploadPipeline::Next()
+{
+	const auto chunk = m_ready.Pop();
+	if (chunk)
+	{
+		return *chunk;
+	}
+
+	// the stages are done, an error of theirs is visible after they exit
+	Stop();
+	if (m_readError)
+	{
+		std::rethrow_exception(m_readError);
+	}
+	if (m_computeError)
+	{
+		std::rethrow_exception(m_computeError);
+	}
+	return nullptr;
+}
+
+void UploadPipeline::Release(Chunk* chunk)
+{
+	m_free.Push(chunk);
+}
+
+uint32_t UploadPipeline::FileCrc()
+{
+	Stop();
+	ClientLogic::UpdateUploadCrcs(m_source, m_crcs, m_source.Size());
+	return m_crcs.file.Value();
+}
+
+const std::vector<uint32_t>& UploadPipeline::ChunkCrcs()
+{
+	FileCrc();
+	return m_crcs.chunks;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "Protocol.h"
+#include "AESWrapper.h"
+#include "ClientLogic.h"
+#include "FileSource.h"
+#include "BoundedQueue.h"
+#include <vector>
+#include <thread>
+#include <span>
+#include <exception>
+#include <boost/noncopyable.hpp>
+
+/*
+ * Read, checksum and encrypt the chunks of an upload ahead of the sender, so disk, CPU and network work at the same time.
+ * A reader thread faults the pages of the next chunks in, a compute thread adds them to the file crc, compresses and encrypts them to free buffers,
+ * and the sender takes them in file order with Next and gives the buffers back with Release.
+ * The compression level adapts to the sender: chunks that wait for the network are worth a higher level, a sender that waits for chunks a lower one.
+ * The buffers are allocated once for the memory budget and pass between the stages through bounded queues.
+ */
+class UploadPipeline : boost::noncopyable
+{
+public:
+	struct Chunk
+	{
+		uint64_t offset = 0;
+		std::span<const uint8_t> plain;   // in the file source
+		std::vector<uint8_t> compressed;
+		std::vector<uint8_t> encrypted;
+		std::span<const uint8_t> payload; // encrypted bytes to send
+		Codec codec = CODEC_NONE;         // of the chunk bytes in payload
+		uint32_t send = 0;                // its nonces, never repeated in a numbered upload
+	};
+
+	constexpr static size_t MIN_CHUNKS = 3; // one in each stage
+
+	UploadPipeline(const FileSource& source, const AESWrapper& aesWrapper, const UploadCipher& cipher, size_t memoryBudget, uint32_t& sends); // sends of the upload, counted on while the stages run
+	~UploadPipeline();
+
+	void Start(uint64_t offset);   // (re)start reading at offset, after all chunks were released
+	Chunk* Next();                 // next chunk in file order, nullptr after the last one. Rethrow the error of a stage
+	void Release(Chunk* chunk);
+	uint32_t FileCrc();            // crc of the whole file, after the last chunk
+	const std::vector<uint32_t>& ChunkCrcs(); // crc of every chunk of the file, after the last chunk
+
+private:
+	void Stop();
+	void Read(uint64_t offset);
+	void Compute();
+
+	const FileSource& m_source;
+	const AESWrapper& m_aesWrapper;
+	const UploadCipher& m_cipher;
+	std::vector<Chunk> m_chunks;
+	BoundedQueue<Chunk*> m_free;
+	BoundedQueue<Chunk*> m_read;
+	BoundedQueue<Chunk*> m_ready;
+	UploadCrcs m_crcs;
+	int m_level;
+	uint32_t& m_sends;
+	std::exception_ptr m_readError;
+	std::exception_ptr m_computeError;
+	std::thread m_reader;
+	std::thread m_computer;
+};
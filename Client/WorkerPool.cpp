@@ -0,0 +1,106 @@
+#include "WorkerPool.h"
+#include <atomic>
+#include <exception>
+
+WorkerPool::WorkerPool(size_t threads)
+{
+	for (size_t i = 0; i < threads; ++i)
+	{
+		m_workers.emplace_back(&WorkerPool::Work, this);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+	for (auto& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+WorkerPool& WorkerPool::Shared()
+{
+	static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1); // the calling thread works too
+	return pool;
+}
+
+void WorkerPool::Work()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+			if (m_tasks.empty())
+			{
+				return; // stopping
+			}
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void WorkerPool::ParallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+	std::atomic<size_t> next = 0;
+	std::mutex doneMutex;
+	std::condition_variable doneCondition;
+	size_t helpersLeft = std::min(m_workers.size(), count > 0 ? count - 1 : 0);
+	std::exception_ptr error;
+
+	// every runner takes the next index until none is left
+	auto run = [&]()
+	{
+		for (size_t i = next++; i < count; i = next++)
+		{
+			try
+			{
+				task(i);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(doneMutex);
+				if (!error)
+				{
+					error = std::current_exception();
+				}
+				next = count; // stop the other runners
+			}
+		}
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < helpersLeft; ++i)
+		{
+			m_tasks.emplace_back([&]()
+				{
+					run();
+					std::lock_guard<std::mutex> lock(doneMutex);
+					if (--helpersLeft == 0)
+					{
+						doneCondition.notify_one();
+					}
+				});
+		}
+	}
+	m_condition.notify_all();
+
+	run();
+
+	// the helpers refer to this frame, wait until all of them returned
+	std::unique_lock<std::mutex> lock(doneMutex);
+	doneCondition.wait(lock, [&]() { return helpersLeft == 0; });
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
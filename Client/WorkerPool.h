@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <boost/noncopyable.hpp>
+
+// Fixed pool of worker threads for CPU bound work that splits to independent parts, such as encrypting segments
+class WorkerPool : boost::noncopyable
+{
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<std::function<void()>> m_tasks;
+	bool m_stopping = false;
+
+	void Work();
+
+public:
+	explicit WorkerPool(size_t threads);
+	~WorkerPool();
+
+	static WorkerPool& Shared(); // one worker per hardware thread
+
+	size_t Size() const { return m_workers.size(); }
+
+	// Run task(0) .. task(count - 1) on the workers and the calling thread, return when all are done.
+	// Rethrow the first exception thrown by a task.
+	void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+};
@@ -1,21 +1,30 @@
 #include "protocol.h"
 #include <fstream>
 #include <array>
+#include <vector>
 #include "MeInfo.hpp"
-#include <iostream>
 #include "ClientSocket.h"
+#include "Transport.h"
 #include "RSAWrapper.h"
+#include "RSAKeyPool.h"
 #include "ClientLogic.h"
 #include "AESWrapper.h"
-#include <boost/crc.hpp>
-#include "Base64.h"
+#include "Crc32.h"
+#include "FileSource.h"
+#include "BatchUpload.h"
+#include "Log.h"
 #include "FatalError.h"
+#include "Serializer.h"
 #include <modes.h>
 #include <aes.h>
 
 static const std::string TRANSFER_FILE = "transfer.info";
+static constexpr bool SESSION_MODE = true; // Keep one connection open for the whole flow when the server supports it
+static constexpr bool SESSION_TICKETS = true; // Reconnect with a resumption ticket instead of RSA when the server issued one
+static constexpr size_t UPLOAD_MEMORY_BUDGET = 16 * 1024 * 1024; // Chunk buffers read, checksummed and encrypted ahead of the network
 
-void ReadTransferInfo(std::string& ip, int& port, ClientName& clientName, FileName& filePath)
+// transfer.info lines: ip:port, client name, file path (or a manifest of files), optional RSA key bits of a new client and optional concurrent transfers
+void ReadTransferInfo(std::string& ip, int& port, ClientName& clientName, FileName& filePath, size_t& rsaBits, size_t& transfers)
 {
 	constexpr static auto MAX_CLIENT_NAME_IN_FILE = 100;
 
@@ -24,10 +33,10 @@ void ReadTransferInfo(std::string& ip, int& port, ClientName& clientName, FileNa
 	{
 		throw std::invalid_argument("File me.info not exists");
 	}
-	std::array<std::string, 3> lines;
+	std::array<std::string, 5> lines;
 	std::string line;
 	int i = 0;
-	while (i < 3 && std::getline(infile, line))
+	while (i < 5 && std::getline(infile, line))
 	{
 		lines[i++] = line;
 	}
@@ -50,13 +59,18 @@ void ReadTransferInfo(std::string& ip, int& port, ClientName& clientName, FileNa
 		throw std::invalid_argument("The third line should contains file path that will be with max of " + std::to_string(NAME_SIZE) + " letters, the path contains " + std::to_string(lines[1].size()) + " letters");
 	}
 	std::copy(lines[2].begin(), lines[2].end(), std::begin(filePath.name));
-}
 
-uint32_t GetCrc32(const std::string& str)
-{
-	boost::crc_32_type result;
-	result.process_bytes(str.c_str(), str.size());
-	return result.checksum();
+	rsaBits = (i > 3 && !lines[3].empty()) ? std::stoul(lines[3]) : DEFAULT_RSA_BITS;
+	if (!RSAPrivateWrapper::IsValidBits(rsaBits))
+	{
+		throw std::invalid_argument("The fourth line should contains RSA key bits of 1024, 2048 or 3072, the line contains " + lines[3]);
+	}
+
+	transfers = (i > 4 && !lines[4].empty()) ? std::stoul(lines[4]) : BatchUpload::DEFAULT_TRANSFERS;
+	if (transfers == 0 || transfers > BatchUpload::MAX_TRANSFERS)
+	{
+		throw std::invalid_argument("The fifth line should contains concurrent transfers between 1 and " + std::to_string(BatchUpload::MAX_TRANSFERS) + ", the line contains " + lines[4]);
+	}
 }
 
 
@@ -66,37 +80,59 @@ int main(int argc, char* argv[])
 	FileName filePath;
 	std::string ip;
 	int port{};
+	size_t rsaBits = DEFAULT_RSA_BITS;
+	size_t transfers = BatchUpload::DEFAULT_TRANSFERS;
 
 	try
 	{
+		Log::Configure();
+
 		// Read Tranfer info for get ip and port, client name and file path, using client name only if me.info file not exists
-		ReadTransferInfo(ip, port, clientName, filePath);
-		std::cout << "Server ip: " << ip << std::endl;
-		std::cout << "Server port: " << port << std::endl;
-		std::cout << "Client name: " << clientName << std::endl;
-		std::cout << "File path: " << filePath << std::endl;
+		ReadTransferInfo(ip, port, clientName, filePath, rsaBits, transfers);
+		LOG_INFO("Server ip: " << ip);
+		LOG_INFO("Server port: " << port);
+		LOG_INFO("Client name: " << clientName);
+		LOG_INFO("File path: " << filePath);
+
+		// a new client generates its keypair while it registers
+		if (!MeInfo::Exists())
+		{
+			RSAKeyPool::Shared().Prefetch(rsaBits);
+		}
 	}
 	catch (std::exception& e)
 	{
-		std::cerr << "Can't read " << TRANSFER_FILE << ", error details: " << e.what() << std::endl;
+		LOG_ERROR("Can't read " << TRANSFER_FILE << ", error details: " << e.what());
 		return 0;
 	}
 
 	try
 	{
-		ClientSocket socket(ip, std::to_string(port));
+		auto connection = Transport::Instance().Acquire(ip, std::to_string(port), SESSION_MODE);
+		ClientSocket& socket = *connection;
 		std::shared_ptr<MeInfo> meInfo;
 		std::shared_ptr<AESWrapper> aesWrapper;
 		try
 		{
 			meInfo = std::make_shared<MeInfo>();
-			aesWrapper = ClientLogic::SendReconnect(meInfo, ip, port);
+			if (SESSION_TICKETS)
+			{
+				aesWrapper = ClientLogic::SendResume(socket, meInfo);
+			}
 			if (aesWrapper == nullptr)
 			{
-				std::cout << "Tried reconnect to unexists client name, restart as new client. program exited" << std::endl;
-				return 0;
+				aesWrapper = ClientLogic::SendReconnect(socket, meInfo);
+				if (aesWrapper == nullptr)
+				{
+					LOG_ERROR("Tried reconnect to unexists client name, restart as new client. program exited");
+					return 0;
+				}
+				if (SESSION_TICKETS)
+				{
+					ClientLogic::RequestTicket(socket, meInfo, *aesWrapper);
+				}
 			}
-			std::cout << meInfo->GetClientName().ToString() << " reconnected." << std::endl;
+			LOG_INFO(meInfo->GetClientName().ToString() << " reconnected.");
 		}
 		catch (const FatalException& e)
 		{
@@ -104,10 +140,10 @@ int main(int argc, char* argv[])
 		}
 		catch (const std::exception& e)
 		{
-			std::cout << e.what() << std::endl;
+			LOG_INFO(e.what());
 			ClientID clientID;
 
-			if (!ClientLogic::Register(clientName, ip, port, clientID))
+			if (!ClientLogic::Register(socket, clientName, clientID))
 			{
 				return 0;
 			}
@@ -115,42 +151,47 @@ int main(int argc, char* argv[])
 			meInfo = std::make_shared<MeInfo>(clientName, clientID);
 
 			// Our client has been registered, send public key
-			aesWrapper = ClientLogic::SendPublicKey(meInfo, ip, port);
+			aesWrapper = ClientLogic::SendPublicKey(socket, meInfo);
 			if (aesWrapper == nullptr)
 			{
 				return 0;
 			}
+			if (SESSION_TICKETS)
+			{
+				ClientLogic::RequestTicket(socket, meInfo, *aesWrapper);
+			}
 		}
 
-		// read file content
-		std::ifstream infile(filePath.ToString());
-		if (!infile.is_open())
+		// a manifest uploads its files over concurrent transfers of the same client, each with its own crc check
+		if (BatchUpload::IsManifest(filePath.ToString()))
 		{
-			throw std::invalid_argument("File " + filePath.ToString() + " not exists");
+			auto files = BatchUpload::ListFiles(filePath.ToString());
+			LOG_INFO("Manifest of " << files.size() << " files, upload over " << transfers << " transfers");
+			BatchUpload batch(std::move(files), transfers, meInfo, aesWrapper);
+			batch.Run(ip, std::to_string(port));
+			return 0;
 		}
 
-		std::string content;
-		std::string line;
-		while (std::getline(infile, line))
+		// the file is mapped (or a pipe streamed once) and read as binary
+		const FileSource source(filePath.ToString());
+		const auto fileSize = source.Size();
+		uint32_t fileCRC = 0;
+
+		// a server that stores uploads by content stores the file from content it already has without the upload, the digest pass is only for such a server
+		UploadPrecheck precheck;
+		if (ClientLogic::ProbeUploadPrecheck(socket, meInfo, *aesWrapper, filePath, fileSize))
 		{
-			content += line + "\n";
+			precheck = ClientLogic::PrecheckUpload(socket, meInfo, *aesWrapper, filePath, fileSize, ClientLogic::DigestContent(source));
+		}
+		if (precheck.storedCrc)
+		{
+			const auto content = source.Bytes();
+			fileCRC = Crc32::Calculate(content.data(), content.size());
 		}
 
-		std::cout << filePath.ToString() << " content: " << content << std::endl;
-
-		// Calculate crc from the content
-		const auto fileCRC = GetCrc32(content);
-
-		std::cout << "content size: " << content.size() << std::endl;
-		std::cout << "content in base 64: " << Base64::Encode(content) << std::endl;
-
-		// encrypt content with AES
-		const auto encryptedContent = aesWrapper->Encrypt(content);
-
-		std::cout << "encrypted content size: " << encryptedContent.size() << std::endl;
-		std::cout << "encrypted content in base 64: " << Base64::Encode(encryptedContent) << std::endl;
-		std::cout << "encrypted content in base 64: " << encryptedContent << std::endl;
-
+		// every file is uploaded in resumable chunks, whatever its size: only the chunks are compressed and stored by content
+		LOG_INFO("content size: " << fileSize << ", upload in chunks of " << UPLOAD_CHUNK_SIZE << " bytes");
+		const auto sendFile = [&]() { return ClientLogic::UploadFile(socket, meInfo, aesWrapper, filePath, source, fileCRC, UPLOAD_MEMORY_BUDGET); }; // crc in the same pass as the upload reads
 
 		constexpr static int MAX_RETRIES = 3;
 		bool accept = false;
@@ -158,26 +199,25 @@ int main(int argc, char* argv[])
 		while (!accept && tryIndex <= MAX_RETRIES)
 		{
 			// Send encrypted content to the server and get crc 
-			const auto serverCrc = ClientLogic::SendFileContent(meInfo, ip, port, filePath, encryptedContent);
-			std::cout << "Recieved crc from server: " << serverCrc << ", original crc: " << fileCRC << std::endl;
+			const auto serverCrc = (tryIndex == 1 && precheck.storedCrc) ? *precheck.storedCrc : sendFile();
+			LOG_INFO("Recieved crc from server: " << serverCrc << ", original crc: " << fileCRC);
 			// Compare our crc vs server crc
 			if (serverCrc == fileCRC)
 			{
 				RequestValidCrc reqValidCrc(meInfo->GetClientID());
 				reqValidCrc.fileName = filePath;
-				const auto response = socket.SendAndReceive((uint8_t*)(&reqValidCrc), sizeof(RequestValidCrc));
-				if (response == nullptr)
+				const auto wire = Serializer::Encode(reqValidCrc);
+				const auto response = socket.SendAndReceive(wire.data(), wire.size());
+				if (!response)
 				{
 					return 0;
 				}
 
-				ResponseHeader* resHeader = (ResponseHeader*)response;
-				if (resHeader->code == RESPONSE_MSG_RECEIVED)
+				if (response.Code() == RESPONSE_MSG_RECEIVED)
 				{
-					if (ClientLogic::ValidateResponse(*(ResponseHeader*)(response), RESPONSE_MSG_RECEIVED))
+					if (ClientLogic::ValidateResponse(response.Header(), RESPONSE_MSG_RECEIVED))
 					{
-						ResponseWithClientID* resWithClient = (ResponseWithClientID*)(response);
-						std::cout << "Finish communication with server" << std::endl;
+						LOG_INFO("Finish communication with server");
 						return 0;
 					}
 				}
@@ -185,46 +225,46 @@ int main(int argc, char* argv[])
 			}
 			else
 			{
-				std::cerr << "Received invalid CRC, this is the " << tryIndex << " attemp, try to send file again" << std::endl;
+				LOG_WARNING("Received invalid CRC, this is the " << tryIndex << " attemp, try to send file again");
 
 				// resend file again up to 3 times
 				RequestInvalidCrc reqinvalidCrc(meInfo->GetClientID());
 				reqinvalidCrc.fileName = filePath;
-				const auto status = socket.ConnectAndSend((uint8_t*)(&reqinvalidCrc), sizeof(RequestInvalidCrc));
+				const auto wire = Serializer::Encode(reqinvalidCrc);
+				const auto status = socket.ConnectAndSend(wire.data(), wire.size());
 			}
 
 			++tryIndex;
 		}
 
 
-		std::cerr << "Fatal: Received invalid CRC in the fourth time" << std::endl;
+		LOG_ERROR("Fatal: Received invalid CRC in the fourth time");
 		// Send invalid crc with finish 
 		RequestInvalidCrcFinish reqinvalidCrcFinish(meInfo->GetClientID());
 		reqinvalidCrcFinish.fileName = filePath;
-		const auto response = socket.SendAndReceive((uint8_t*)(&reqinvalidCrcFinish), sizeof(RequestInvalidCrcFinish));
-		if (response == nullptr)
+		const auto wire = Serializer::Encode(reqinvalidCrcFinish);
+		const auto response = socket.SendAndReceive(wire.data(), wire.size());
+		if (!response)
 		{
 			return 0;
 		}
 
-		ResponseHeader* resHeader = (ResponseHeader*)response;
-		if (resHeader->code == RESPONSE_MSG_RECEIVED)
+		if (response.Code() == RESPONSE_MSG_RECEIVED)
 		{
-			if (ClientLogic::ValidateResponse(*(ResponseHeader*)(response), RESPONSE_MSG_RECEIVED))
+			if (ClientLogic::ValidateResponse(response.Header(), RESPONSE_MSG_RECEIVED))
 			{
-				ResponseWithClientID* resWithClient = (ResponseWithClientID*)(response);
-				std::cout << "Finish communication with server" << std::endl;
+				LOG_INFO("Finish communication with server");
 			}
 		}
 
 	}
 	catch (const FatalException& e)
 	{
-		std::cerr << "Fatal Error: " << e.what() << ". program exited" << std::endl;
+		LOG_ERROR("Fatal Error: " << e.what() << ". program exited");
 	}
 	catch (const std::exception& e)
 	{
-		std::cerr << "Error: " << e.what() << ". program exited" << std::endl;
+		LOG_ERROR("Error: " << e.what() << ". program exited");
 	}
 
 	system("pause");
@@ -3,6 +3,7 @@ __author__ = "Lior Zemah"
 from datetime import datetime
 import sqlite3
 import protocol
+from log import logger
 
 
 class Client:
@@ -11,7 +12,7 @@ class Client:
     def __init__(self, cid, cname, public_key, last_seen, aes_key):
         self.ID = bytes.fromhex(cid)  # Unique client ID, 16 bytes.
         self.Name = cname  # Client's name, 255 bytes.
-        self.PublicKey = public_key  # Client's public key, 160 bytes.
+        self.PublicKey = public_key  # Client's public key, up to 1024 bytes.
         self.LastSeen = last_seen  # The time of client last request.
         self.AESKey = aes_key  # Client's AES key, 16 bytes
 
@@ -33,7 +34,7 @@ class Client:
             return False
         if not self.Name or len(self.Name) >= protocol.NAME_SIZE:
             return False
-        if not self.PublicKey or len(self.PublicKey) != protocol.PUBLIC_KEY_SIZE:
+        if not self.PublicKey or len(self.PublicKey) > protocol.MAX_PUBLIC_KEY_SIZE:
             return False
         if not self.LastSeen:
             return False
@@ -63,9 +64,23 @@ class File:
         return True
 
 
+class Upload:
+    """ Represents an upload in progress, the received plain bytes are kept in PartPath """
+    def __init__(self, cid, filename, file_size, part_path, cipher_mode=0, nonce=None, codec=0):
+        self.ID = cid  # Client ID, 16 bytes.
+        self.Filename = filename  # File name as sent by the client, 255 bytes.
+        self.FileSize = file_size  # Plain file size.
+        self.PartPath = part_path  # Local path of the received bytes.
+        self.CipherMode = cipher_mode  # Cipher of the chunks, protocol.CipherMode value.
+        self.Nonce = nonce  # File nonce of a segmented cipher, 12 bytes.
+        self.Codec = codec  # Compression of the compressed chunks, protocol.Codec value.
+
+
 class Database:
     CLIENTS_DB = 'clients'
     FILES_DB = 'files'
+    UPLOADS_DB = 'uploads'
+    DIGESTS_DB = 'digests'
 
     def __init__(self, name):
         self.name = name
@@ -99,7 +114,7 @@ class Database:
             if get_last_row:
                 results = cur.lastrowid  # special query.
         except Exception as err:
-            print(f'Error: Database execute failed with error details: {err}')
+            logger.error(f'Database execute failed with error details: {err}')
         conn.close()  # commit is not required.
         return results
 
@@ -125,6 +140,39 @@ class Database:
             );
             """)
 
+        self.execute_script(f"""
+            CREATE TABLE {self.UPLOADS_DB}(
+              ID CHAR(16) NOT NULL,
+              FileName CHAR(255) NOT NULL,
+              FileSize INTEGER NOT NULL,
+              PartPath TEXT NOT NULL,
+              CipherMode INTEGER NOT NULL DEFAULT 0,
+              Nonce BLOB,
+              Codec INTEGER NOT NULL DEFAULT 0,
+              PRIMARY KEY(ID, FileName),
+              FOREIGN KEY(ID) REFERENCES {self.CLIENTS_DB}(ID)
+            );
+            """)
+
+        # Stored files of every client by the digest of their content, a path is in the index once
+        self.execute_script(f"""
+            CREATE TABLE {self.DIGESTS_DB}(
+              ID CHAR(16) NOT NULL,
+              Digest BLOB NOT NULL,
+              Path TEXT NOT NULL,
+              FileSize INTEGER NOT NULL,
+              Crc INTEGER NOT NULL,
+              PRIMARY KEY(ID, Path),
+              FOREIGN KEY(ID) REFERENCES {self.CLIENTS_DB}(ID)
+            );
+            CREATE INDEX {self.DIGESTS_DB}_digest ON {self.DIGESTS_DB}(ID, Digest);
+            """)
+
+        # Add the cipher and codec columns to an uploads table of an older server, fails harmlessly if they exist
+        self.execute_script(f"ALTER TABLE {self.UPLOADS_DB} ADD COLUMN CipherMode INTEGER NOT NULL DEFAULT 0;")
+        self.execute_script(f"ALTER TABLE {self.UPLOADS_DB} ADD COLUMN Nonce BLOB;")
+        self.execute_script(f"ALTER TABLE {self.UPLOADS_DB} ADD COLUMN Codec INTEGER NOT NULL DEFAULT 0;")
+
     def insert_new_client(self, client):
         """ Insert new client to the database """
         if not type(client) is Client or not client.validate_except_keys():
@@ -162,7 +210,7 @@ class Database:
 
     def update_aes_key(self, client_id, key):
         if self.is_client_id_exists(client_id) is False:
-            print(f"Client with id {client_id} not exists")
+            logger.warning(f"Client with id {client_id} not exists")
             return False
         return self.execute(f"UPDATE {Database.CLIENTS_DB} SET AESKey = ? WHERE ID = ?", [key, client_id], True)
 
@@ -199,3 +247,42 @@ class Database:
             return False
         return self.execute(f"UPDATE {Database.FILES_DB} SET Verified = ? WHERE ID = ?",
                             [verified, fid], True)
+
+    def upsert_upload(self, upload):
+        """ Insert upload or restart the existing upload of the same client and file name """
+        return self.execute(f"INSERT OR REPLACE INTO {Database.UPLOADS_DB} "
+                            f"(ID, FileName, FileSize, PartPath, CipherMode, Nonce, Codec) VALUES (?, ?, ?, ?, ?, ?, ?)",
+                            [upload.ID, upload.Filename, upload.FileSize, upload.PartPath, upload.CipherMode,
+                             upload.Nonce, upload.Codec], True)
+
+    def update_upload_cipher(self, upload):
+        return self.execute(f"UPDATE {Database.UPLOADS_DB} SET CipherMode = ?, Nonce = ?, Codec = ? WHERE ID = ? AND FileName = ?",
+                            [upload.CipherMode, upload.Nonce, upload.Codec, upload.ID, upload.Filename], True)
+
+    def get_upload(self, client_id, filename):
+        results = self.execute(f"SELECT FileSize, PartPath, CipherMode, Nonce, Codec FROM {Database.UPLOADS_DB} "
+                               f"WHERE ID = ? AND FileName = ?", [client_id, filename])
+        if not results:
+            return None
+        file_size, part_path, cipher_mode, nonce, codec = results[0]
+        return Upload(client_id, filename, file_size, part_path.decode('utf-8'), cipher_mode, nonce, codec)
+
+    def delete_upload(self, client_id, filename):
+        return self.execute(f"DELETE FROM {Database.UPLOADS_DB} WHERE ID = ? AND FileName = ?",
+                            [client_id, filename], True)
+
+    def index_content(self, client_id, digest, path, file_size, crc):
+        """ Index the content stored in path, it replaces the content the path had before """
+        return self.execute(f"INSERT OR REPLACE INTO {Database.DIGESTS_DB} (ID, Digest, Path, FileSize, Crc) VALUES (?, ?, ?, ?, ?)",
+                            [client_id, digest, path, file_size, crc], True)
+
+    def find_content(self, client_id, digest):
+        """ Return (path, size, crc) of the stored files of the client with the content digest """
+        results = self.execute(f"SELECT Path, FileSize, Crc FROM {Database.DIGESTS_DB} WHERE ID = ? AND Digest = ?",
+                               [client_id, digest])
+        if not results:
+            return []
+        return [(path.decode('utf-8'), file_size, crc) for path, file_size, crc in results]
+
+    def delete_content(self, client_id, path):
+        return self.execute(f"DELETE FROM {Database.DIGESTS_DB} WHERE ID = ? AND Path = ?", [client_id, path], True)
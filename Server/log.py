@@ -0,0 +1,36 @@
+__author__ = "Lior Zemah"
+
+import logging
+import os
+from base64 import b64encode
+
+DEFAULT_LEVEL = "INFO"
+DEFAULT_DUMP_BYTES = 64
+
+logger = logging.getLogger("server")
+
+
+def configure():
+    """ Set the level and the dump size from the LOG_LEVEL (DEBUG .. CRITICAL) and LOG_DUMP_BYTES environment variables """
+    level = os.environ.get("LOG_LEVEL", DEFAULT_LEVEL).upper()
+    logging.basicConfig(format="%(message)s", level=level if isinstance(logging.getLevelName(level), int) else DEFAULT_LEVEL)
+    try:
+        Dump.limit = int(os.environ.get("LOG_DUMP_BYTES", DEFAULT_DUMP_BYTES))
+    except ValueError:
+        pass
+
+
+class Dump:
+    """ Log argument of a payload, formatted to base64 of its first bytes only when the record is emitted """
+    limit = DEFAULT_DUMP_BYTES
+
+    __slots__ = ("data",)
+
+    def __init__(self, data):
+        self.data = data
+
+    def __str__(self):
+        prefix = b64encode(self.data[:Dump.limit]).decode('utf-8')
+        if len(self.data) > Dump.limit:
+            return f"{prefix}... ({len(self.data)} bytes)"
+        return prefix
@@ -1,5 +1,6 @@
 __author__ = "Lior Zemah"
 
+import log
 import server
 
 
@@ -13,20 +14,21 @@ def read_port_info(filepath, default_port):
             port_as_str = port_info.readline().strip()
             port = int(port_as_str)
     except FileNotFoundError as err:
-        print(f"Warning: {err}, use default port 1234")
+        log.logger.warning(f"{err}, use default port 1234")
     except ValueError as err:
-        print(f"Error: {err}, use default port 1234")
+        log.logger.error(f"{err}, use default port 1234")
     finally:
         return port
 
 
 if __name__ == '__main__':
+    log.configure()
     PORT_FILE = "port.info"
     DEFAULT_PORT = 1234
     server_port = read_port_info(PORT_FILE, DEFAULT_PORT)
-    print(f"Server port is: {server_port}")
+    log.logger.info(f"Server port is: {server_port}")
 
     serv = server.Server('', server_port, False)
     if not serv.start():
-        print(f"Error: Server failed to start")
+        log.logger.error("Server failed to start")
         exit(1)
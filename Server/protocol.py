@@ -3,7 +3,10 @@ __author__ = "Lior Zemah"
 import struct
 from enum import Enum
 
-SERVER_VERSION = 3
+SERVER_VERSION = 4
+PADDED_VERSION = 3  # Last version that pads every message to whole packets, later versions send exactly header and payload
+VERSION_FLAG_KEEP_ALIVE = 0x80  # Flag bit in the header version, request asks to keep the connection open and response confirms it
+VERSION_MASK = 0x7F  # Masks out the flag bits from the header version
 DEFAULT_INT_VAL = 0  # Default integer value to initialize inner fields.
 HEADER_SIZE = 7  # Header size without clientID. (version, code, payload size).
 CLIENT_ID_SIZE = 16
@@ -11,19 +14,45 @@ MSG_ID_SIZE = 4
 MSG_TYPE_MAX = 0xFF
 MSG_ID_MAX = 0xFFFFFFFF
 NAME_SIZE = 255  # represent client name, file name and file path size
-PUBLIC_KEY_SIZE = 160
+PUBLIC_KEY_SIZE = 160  # public key of REQUEST_SEND_PUBLIC_KEY, only a 1024 bits key fits
+MAX_PUBLIC_KEY_SIZE = 1024  # public key of REQUEST_SEND_VARIABLE_PUBLIC_KEY
 AES_KEY_SIZE = 16
+UPLOAD_CHUNK_SIZE = 1024 * 1024  # Plain bytes in each chunk of a chunked upload
+CIPHER_SEGMENT_SIZE = 64 * 1024  # Plain bytes in each independently encrypted segment of CIPHER_AES_GCM_SEGMENTS
+CIPHER_NONCE_SIZE = 12
+CIPHER_TAG_SIZE = 16
+TICKET_SIZE = 68  # resumption ticket, nonce + sealed (client id, expiry, session key) + tag
+RESUME_NONCE_SIZE = 16  # random nonce of each side, both are mixed into the resumed session key
+CONTENT_DIGEST_SIZE = 32  # SHA-256 of the plain file content, the key of stored content for deduplication
+STRONG_SIGNATURE_SIZE = 16  # SHA-256 of a block truncated, confirms a match of the rolling checksum of a delta upload
+MAX_RESPONSE_PAYLOAD_SIZE = 1024 * 1024  # The client treats a response with a larger payload as broken
 
 
 # Request Codes (compatible to the client)
 class RequestCode(Enum):
     REQUEST_REGISTRATION = 1100
     REQUEST_SEND_PUBLIC_KEY = 1101
+    REQUEST_SEND_VARIABLE_PUBLIC_KEY = 1102
     REQUEST_RECONNECT = 1002
     REQUEST_SEND_FILE = 1003
     REQUEST_VALID_CRC = 1004
     REQUEST_INVALID_CRC_RETRY = 1005
     REQUEST_INVALID_CRC_FINISH = 1006
+    REQUEST_UPLOAD_BEGIN = 1007
+    REQUEST_UPLOAD_CHUNK = 1008
+    REQUEST_UPLOAD_COMMIT = 1009
+    REQUEST_UPLOAD_BEGIN_CIPHER = 1010
+    REQUEST_RESUMPTION_TICKET = 1011
+    REQUEST_RESUME = 1012
+    REQUEST_UPLOAD_VERIFY = 1013
+    REQUEST_UPLOAD_REPAIR_CHUNK = 1014
+    REQUEST_UPLOAD_PRECHECK = 1015
+    REQUEST_UPLOAD_SIGNATURES = 1016
+    REQUEST_UPLOAD_DELTA = 1017
+    REQUEST_UPLOAD_BEGIN_CODEC = 1018
+    REQUEST_UPLOAD_NUMBERED_CHUNK = 1019
+    REQUEST_UPLOAD_NUMBERED_REPAIR_CHUNK = 1020
+    REQUEST_UPLOAD_NUMBERED_DELTA = 1021
 
 
 # Responses Codes
@@ -36,9 +65,32 @@ class ResponseCode(Enum):
     RESPONSE_RECONNECT_ALLOWED = 2105
     RESPONSE_RECONNECT_REJECTED = 2106
     RESPONSE_GLOBAL_ERROR = 2107
+    RESPONSE_UPLOAD_STATE = 2108
+    RESPONSE_UPLOAD_CRC = 2109
+    RESPONSE_RESUMPTION_TICKET = 2110
+    RESPONSE_RESUME_ALLOWED = 2111
+    RESPONSE_UPLOAD_CHUNK_CRCS = 2112
+    RESPONSE_UPLOAD_SIGNATURES = 2113
 
 
 
+# Ciphers of upload chunks (compatible to the client)
+class CipherMode(Enum):
+    CIPHER_AES_CBC = 0
+    CIPHER_AES_GCM_SEGMENTS = 1
+
+
+# Compression of upload chunks before their encryption (compatible to the client)
+class Codec(Enum):
+    CODEC_NONE = 0
+    CODEC_ZLIB = 1
+
+
+# Instructions of a delta upload (compatible to the client)
+class DeltaOp(Enum):
+    DELTA_COPY = 0  # first block and block count of the stored version, 4 bytes each
+    DELTA_LITERAL = 1  # 4 bytes size and the bytes
+
 
 class RequestHeader:
     """ Little Endian unpack Request Header """
@@ -47,6 +99,7 @@ class RequestHeader:
         self.version = DEFAULT_INT_VAL      # 1 byte
         self.code = DEFAULT_INT_VAL         # 2 bytes
         self.payloadSize = DEFAULT_INT_VAL  # 4 bytes
+        self.keepAlive = False  # version flag, client asks to keep the connection open
         self.SIZE = CLIENT_ID_SIZE + HEADER_SIZE
 
     def unpack(self, data):
@@ -54,12 +107,15 @@ class RequestHeader:
             self.clientID = struct.unpack(f"<{CLIENT_ID_SIZE}s", data[:CLIENT_ID_SIZE])[0]
             header_data = data[CLIENT_ID_SIZE:CLIENT_ID_SIZE + HEADER_SIZE]
             self.version, self.code, self.payloadSize = struct.unpack("<BHL", header_data)
+            self.keepAlive = (self.version & VERSION_FLAG_KEEP_ALIVE) != 0
+            self.version &= VERSION_MASK
             return True
         except:
             self.clientID = b""
             self.version = DEFAULT_INT_VAL
             self.code = DEFAULT_INT_VAL
             self.payloadSize = DEFAULT_INT_VAL
+            self.keepAlive = False
             self.SIZE = CLIENT_ID_SIZE + HEADER_SIZE
             return False
 
@@ -153,6 +209,29 @@ class PublicKeyRequest:
             return False
 
 
+class VariablePublicKeyRequest:
+    def __init__(self):
+        self.header = RequestHeader()
+        self.clientName = b""
+        self.publicKey = b""
+
+    def unpack(self, data):
+        if not self.header.unpack(data):
+            return False
+        try:
+            offset = self.header.SIZE
+            self.clientName, key_size = struct.unpack(f"<{NAME_SIZE}sH", data[offset:offset + NAME_SIZE + 2])
+            offset += NAME_SIZE + 2
+            if key_size > MAX_PUBLIC_KEY_SIZE or offset + key_size > len(data):
+                raise ValueError("invalid public key size")
+            self.publicKey = bytes(data[offset:offset + key_size])
+            return True
+        except:
+            self.clientName = b""
+            self.publicKey = b""
+            return False
+
+
 class AesKeyResponse:
     def __init__(self, is_reconnect):
         if is_reconnect:
@@ -255,6 +334,7 @@ class ReconnectRejectedResponse:
     def __init__(self):
         self.header = ResponseHeader(ResponseCode.RESPONSE_RECONNECT_REJECTED.value)
         self.clientID = b""
+        self.header.payloadSize = CLIENT_ID_SIZE
 
     def pack(self):
         try:
@@ -263,3 +343,316 @@ class ReconnectRejectedResponse:
             return data
         except:
             return b""
+
+
+class ResumeRequest:
+    def __init__(self):
+        self.header = RequestHeader()
+        self.clientNonce = b""
+        self.ticket = b""
+
+    def unpack(self, data):
+        if not self.header.unpack(data):
+            return False
+        try:
+            offset = self.header.SIZE
+            self.clientNonce, self.ticket = struct.unpack(f"<{RESUME_NONCE_SIZE}s{TICKET_SIZE}s",
+                                                          data[offset:offset + RESUME_NONCE_SIZE + TICKET_SIZE])
+            return True
+        except:
+            self.clientNonce = b""
+            self.ticket = b""
+            return False
+
+
+class ResumptionTicketResponse:
+    def __init__(self):
+        self.header = ResponseHeader(ResponseCode.RESPONSE_RESUMPTION_TICKET.value)
+        self.clientID = b""
+        self.lifetime = DEFAULT_INT_VAL  # seconds the ticket is valid
+        self.ticket = b""
+        self.header.payloadSize = CLIENT_ID_SIZE + 4 + TICKET_SIZE
+
+    def pack(self):
+        try:
+            data = self.header.pack()
+            data += struct.pack(f"<{CLIENT_ID_SIZE}sL{TICKET_SIZE}s", self.clientID, self.lifetime, self.ticket)
+            return data
+        except:
+            return b""
+
+
+class ResumeAllowedResponse:
+    def __init__(self):
+        self.header = ResponseHeader(ResponseCode.RESPONSE_RESUME_ALLOWED.value)
+        self.clientID = b""
+        self.serverNonce = b""
+        self.lifetime = DEFAULT_INT_VAL
+        self.ticket = b""  # ticket of the resumed session key
+        self.header.payloadSize = CLIENT_ID_SIZE + RESUME_NONCE_SIZE + 4 + TICKET_SIZE
+
+    def pack(self):
+        try:
+            data = self.header.pack()
+            data += struct.pack(f"<{CLIENT_ID_SIZE}s{RESUME_NONCE_SIZE}sL{TICKET_SIZE}s", self.clientID,
+                                self.serverNonce, self.lifetime, self.ticket)
+            return data
+        except:
+            return b""
+
+
+class UploadBeginRequest:
+    def __init__(self):
+        self.header = RequestHeader()
+        self.fileName = b""
+        self.fileSize = DEFAULT_INT_VAL
+
+    def unpack(self, data):
+        if not self.header.unpack(data):
+            return False
+        try:
+            offset = self.header.SIZE
+            self.fileName = struct.unpack(f"<{NAME_SIZE}s", data[offset:offset + NAME_SIZE])[0]
+            offset += NAME_SIZE
+            self.fileSize = struct.unpack("<Q", data[offset:offset + 8])[0]
+            return True
+        except:
+            self.fileName = b""
+            self.fileSize = DEFAULT_INT_VAL
+            return False
+
+
+class UploadBeginCipherRequest:
+    def __init__(self):
+        self.header = RequestHeader()
+        self.fileName = b""
+        self.fileSize = DEFAULT_INT_VAL
+        self.cipherMode = DEFAULT_INT_VAL
+        self.nonce = b""  # file nonce, the nonce of each segment is derived from it
+
+    def unpack(self, data):
+        if not self.header.unpack(data):
+            return False
+        try:
+            offset = self.header.SIZE
+            self.fileName, self.fileSize, self.cipherMode, self.nonce = struct.unpack(
+                f"<{NAME_SIZE}sQB{CIPHER_NONCE_SIZE}s", data[offset:offset + NAME_SIZE + 8 + 1 + CIPHER_NONCE_SIZE])
+            return True
+        except:
+            self.fileName = b""
+            self.fileSize = DEFAULT_INT_VAL
+            self.cipherMode = DEFAULT_INT_VAL
+            self.nonce = b""
+            return False
+
+
+class UploadBeginCodecRequest:
+    def __init__(self):
+        self.header = RequestHeader()
+        self.fileName = b""
+        self.fileSize = DEFAULT_INT_VAL
+        self.cipherMode = DEFAULT_INT_VAL
+        self.nonce = b""
+        self.codec = DEFAULT_INT_VAL  # compression of the chunks sent as compressed chunks
+
+    def unpack(self, data):
+        if not self.header.unpack(data):
+            return False
+        try:
+            offset = self.header.SIZE
+            self.fileName, self.fileSize, self.cipherMode, self.nonce, self.codec = struct.unpack(
+                f"<{NAME_SIZE}sQB{CIPHER_NONCE_SIZE}sB", data[offset:offset + NAME_SIZE + 8 + 1 + CIPHER_NONCE_SIZE + 1])
+            return True
+        except:
+            self.fileName = b""
+            self.fileSize = DEFAULT_INT_VAL
+            self.cipherMode = DEFAULT_INT_VAL
+            self.nonce = b""
+            self.codec = DEFAULT_INT_VAL
+            return False
+
+
+class UploadPrecheckRequest:
+    """ The content (file name, size and digest) is sealed with AES-GCM under the session key, unpack_content parses it once opened """
+    CONTENT_SIZE = NAME_SIZE + 8 + CONTENT_DIGEST_SIZE
+
+    def __init__(self):
+        self.header = RequestHeader()
+        self.nonce = b""
+        self.sealed = b""  # content and tag
+        self.fileName = b""
+        self.fileSize = DEFAULT_INT_VAL  # plain file size
+        self.digest = b""  # SHA-256 of the plain content
+
+    def unpack(self, data):
+        if not self.header.unpack(data):
+            return False
+        try:
+            offset = self.header.SIZE
+            sealed_size = UploadPrecheckRequest.CONTENT_SIZE + CIPHER_TAG_SIZE
+            self.nonce, self.sealed = struct.unpack(f"<{CIPHER_NONCE_SIZE}s{sealed_size}s",
+                                                    data[offset:offset + CIPHER_NONCE_SIZE + sealed_size])
+            return True
+        except:
+            self.nonce = b""
+            self.sealed = b""
+            return False
+
+    def unpack_content(self, content):
+        try:
+            self.fileName, self.fileSize, self.digest = struct.unpack(f"<{NAME_SIZE}sQ{CONTENT_DIGEST_SIZE}s", content)
+            return True
+        except:
+            self.fileName = b""
+            self.fileSize = DEFAULT_INT_VAL
+            self.digest = b""
+            return False
+
+
+class UploadChunkRequest:
+    def __init__(self):
+        self.header = RequestHeader()
+        self.fileName = b""
+        self.offset = DEFAULT_INT_VAL  # offset of the chunk in the plain file
+        self.contentSize = DEFAULT_INT_VAL  # encrypted chunk size
+        self.content = b""
+
+    def unpack(self, data):
+        if not self.header.unpack(data):
+            return False
+        try:
+            offset = self.header.SIZE
+            self.fileName = struct.unpack(f"<{NAME_SIZE}s", data[offset:offset + NAME_SIZE])[0]
+            offset += NAME_SIZE
+            self.offset, self.contentSize = struct.unpack("<QL", data[offset:offset + 12])
+            offset += 12
+            self.content = bytes(data[offset:offset + self.contentSize])
+            return len(self.content) == self.contentSize
+        except:
+            self.fileName = b""
+            self.offset = DEFAULT_INT_VAL
+            self.contentSize = DEFAULT_INT_VAL
+            self.content = b""
+            return False
+
+
+class UploadNumberedChunkRequest:
+    """ chunk, repair chunk or delta of an upload begun with the codec request """
+    def __init__(self):
+        self.header = RequestHeader()
+        self.fileName = b""
+        self.offset = DEFAULT_INT_VAL  # offset of the chunk in the plain file
+        self.send = DEFAULT_INT_VAL  # sends of the upload count from 1, xor into the first 4 bytes of the segment nonces
+        self.codec = DEFAULT_INT_VAL  # of the content, none for a chunk that didn't get smaller
+        self.contentSize = DEFAULT_INT_VAL  # encrypted chunk size
+        self.content = b""
+
+    def unpack(self, data):
+        if not self.header.unpack(data):
+            return False
+        try:
+            offset = self.header.SIZE
+            self.fileName = struct.unpack(f"<{NAME_SIZE}s", data[offset:offset + NAME_SIZE])[0]
+            offset += NAME_SIZE
+            self.offset, self.send, self.codec, self.contentSize = struct.unpack("<QLBL", data[offset:offset + 17])
+            offset += 17
+            self.content = bytes(data[offset:offset + self.contentSize])
+            return len(self.content) == self.contentSize
+        except:
+            self.fileName = b""
+            self.offset = DEFAULT_INT_VAL
+            self.send = DEFAULT_INT_VAL
+            self.codec = DEFAULT_INT_VAL
+            self.contentSize = DEFAULT_INT_VAL
+            self.content = b""
+            return False
+
+
+class UploadCommitRequest:
+    def __init__(self):
+        self.header = RequestHeader()
+        self.fileName = b""
+
+    def unpack(self, data):
+        if not self.header.unpack(data):
+            return False
+        try:
+            file_name = data[self.header.SIZE:self.header.SIZE + NAME_SIZE]
+            self.fileName = struct.unpack(f"<{NAME_SIZE}s", file_name)[0]
+            return True
+        except:
+            self.fileName = b""
+            return False
+
+
+class UploadStateResponse:
+    """ Response for upload begin and upload chunk, offset is the plain bytes the server already acknowledged """
+    def __init__(self):
+        self.header = ResponseHeader(ResponseCode.RESPONSE_UPLOAD_STATE.value)
+        self.clientID = b""
+        self.offset = DEFAULT_INT_VAL
+        self.header.payloadSize = CLIENT_ID_SIZE + 8
+
+    def pack(self):
+        try:
+            data = self.header.pack()
+            data += struct.pack(f"<{CLIENT_ID_SIZE}sQ", self.clientID, self.offset)
+            return data
+        except:
+            return b""
+
+
+class UploadCrcResponse:
+    def __init__(self):
+        self.header = ResponseHeader(ResponseCode.RESPONSE_UPLOAD_CRC.value)
+        self.clientID = b""
+        self.contentSize = DEFAULT_INT_VAL
+        self.fileName = b""
+        self.crc = DEFAULT_INT_VAL
+        self.header.payloadSize = CLIENT_ID_SIZE + 8 + NAME_SIZE + 4
+
+    def pack(self):
+        try:
+            data = self.header.pack()
+            data += struct.pack(f"<{CLIENT_ID_SIZE}sQ{NAME_SIZE}sL", self.clientID, self.contentSize, self.fileName, self.crc)
+            return data
+        except:
+            return b""
+
+
+class UploadChunkCrcsResponse:
+    """ Response for upload verify, the crc of every UPLOAD_CHUNK_SIZE chunk of the received file """
+    def __init__(self):
+        self.header = ResponseHeader(ResponseCode.RESPONSE_UPLOAD_CHUNK_CRCS.value)
+        self.clientID = b""
+        self.chunkSize = UPLOAD_CHUNK_SIZE
+        self.crcs = []
+
+    def pack(self):
+        try:
+            self.header.payloadSize = CLIENT_ID_SIZE + 8 + 4 * len(self.crcs)
+            data = self.header.pack()
+            data += struct.pack(f"<{CLIENT_ID_SIZE}sLL{len(self.crcs)}L", self.clientID, self.chunkSize, len(self.crcs), *self.crcs)
+            return data
+        except:
+            return b""
+
+
+class UploadSignaturesResponse:
+    """ Response for upload signatures, the rolling and strong checksum of every block of the stored version """
+    def __init__(self):
+        self.header = ResponseHeader(ResponseCode.RESPONSE_UPLOAD_SIGNATURES.value)
+        self.clientID = b""
+        self.baseSize = DEFAULT_INT_VAL
+        self.blockSize = DEFAULT_INT_VAL
+        self.signatures = []  # (weak, strong) of every block
+
+    def pack(self):
+        try:
+            self.header.payloadSize = CLIENT_ID_SIZE + 16 + (4 + STRONG_SIGNATURE_SIZE) * len(self.signatures)
+            data = self.header.pack()
+            data += struct.pack(f"<{CLIENT_ID_SIZE}sQLL", self.clientID, self.baseSize, self.blockSize, len(self.signatures))
+            data += b''.join(struct.pack(f"<L{STRONG_SIGNATURE_SIZE}s", weak, strong) for weak, strong in self.signatures)
+            return data
+        except:
+            return b""
@@ -1,26 +1,66 @@
 __author__ = "Lior Zemah"
 
 import os
+import hashlib
+import math
+import shutil
 import selectors
 import uuid
 import socket
+import struct
+import time
 import zlib
+from concurrent.futures import ThreadPoolExecutor
 
 import protocol
 from datetime import datetime
-from database import Client, File, Database
+from database import Client, File, Upload, Database
 from Crypto.Cipher import AES
 from Crypto.Random import get_random_bytes
 from Crypto.PublicKey import RSA
 from Crypto.Cipher import PKCS1_OAEP
-from base64 import b64encode
+from Crypto.Hash import SHA256
+from Crypto.Protocol.KDF import HKDF
+from log import logger, Dump
 from Crypto.Util.Padding import pad, unpad
 
 
+class Session:
+    """ Represents an open client connection and the bytes received on it that not handled yet """
+
+    def __init__(self):
+        self.buffer = bytearray()  # Received bytes of the next requests.
+        self.keepAlive = False  # True if the last request asked to keep the connection open.
+        self.version = protocol.SERVER_VERSION  # Protocol version of the last request, responses are framed the same.
+        self.lastActive = time.monotonic()  # The time of the last received bytes.
+
+
 class Server:
     DATABASE = 'server.db'
-    PACKET_SIZE = 1024  # Default packet size.
+    PACKET_SIZE = 1024  # Default packet size, messages of protocol.PADDED_VERSION are padded to whole packets.
+    RECV_SIZE = 64 * PACKET_SIZE  # Bytes to read at once, large requests such as upload chunks span many packets.
+    UPLOADS_DIR = 'uploads'  # Directory of the received files.
+    CRC_READ_SIZE = 1024 * 1024  # Bytes to read at once when calculating crc of a stored file.
     MAX_QUEUED_CONN = 5  # Default maximum number of queued connections.
+    SESSION_IDLE_TIMEOUT = 60  # Seconds a kept alive connection may stay idle before the server closes it.
+    SELECT_TIMEOUT = 5  # Seconds to wait for events before checking for idle sessions.
+    DECRYPT_WORKERS = os.cpu_count() or 1  # Threads decrypting the segments of a chunk, AES releases the GIL.
+    TICKET_KEY_FILE = 'ticket.key'  # Key that seals resumption tickets, kept so tickets survive a restart.
+    TICKET_LIFETIME = 24 * 60 * 60  # Seconds a resumption ticket is valid.
+    RESUME_KEY_INFO = b'resume session key'  # HKDF info of the resumed session key, same as the client.
+    MAX_PAYLOAD_SIZE = 4 * PACKET_SIZE  # Largest payload of a request without file content, such as a public key.
+    MAX_CONTENT_PAYLOAD_SIZE = (MAX_PAYLOAD_SIZE + protocol.UPLOAD_CHUNK_SIZE  # Largest payload of a request with an encrypted chunk,
+                                + protocol.UPLOAD_CHUNK_SIZE // protocol.CIPHER_SEGMENT_SIZE * protocol.CIPHER_TAG_SIZE)  # delta or small file.
+    CONTENT_REQUESTS = {protocol.RequestCode.REQUEST_SEND_FILE.value,
+                        protocol.RequestCode.REQUEST_UPLOAD_CHUNK.value,
+                        protocol.RequestCode.REQUEST_UPLOAD_REPAIR_CHUNK.value,
+                        protocol.RequestCode.REQUEST_UPLOAD_DELTA.value,
+                        protocol.RequestCode.REQUEST_UPLOAD_NUMBERED_CHUNK.value,
+                        protocol.RequestCode.REQUEST_UPLOAD_NUMBERED_REPAIR_CHUNK.value,
+                        protocol.RequestCode.REQUEST_UPLOAD_NUMBERED_DELTA.value}
+    DELTA_MIN_BLOCK_SIZE = 2048  # Smallest block of the signatures of a stored version.
+    DELTA_MAX_SIGNATURES = ((protocol.MAX_RESPONSE_PAYLOAD_SIZE - protocol.CLIENT_ID_SIZE - 16)
+                            // (4 + protocol.STRONG_SIGNATURE_SIZE))  # Most blocks whose signatures fit one response.
 
     def __init__(self, host, port, is_blocking):
         """ Initialize server, db and create map of request codes to handle """
@@ -28,15 +68,34 @@ class Server:
         self.port = port
         self.isBlocking = is_blocking
         self.selector = selectors.DefaultSelector()
+        self.sessions = {}  # Open client connections to their session state.
         self.database = Database(Server.DATABASE)
+        self.decryptPool = ThreadPoolExecutor(max_workers=Server.DECRYPT_WORKERS)
+        self.ticketKey = self.load_ticket_key()
         self.requestHandlers = {
             protocol.RequestCode.REQUEST_REGISTRATION.value: self.handle_registration_request,
             protocol.RequestCode.REQUEST_SEND_PUBLIC_KEY.value: self.handle_public_key_request,
+            protocol.RequestCode.REQUEST_SEND_VARIABLE_PUBLIC_KEY.value: self.handle_variable_public_key_request,
             protocol.RequestCode.REQUEST_RECONNECT.value: self.handle_reconnect_request,
             protocol.RequestCode.REQUEST_SEND_FILE.value: self.handle_send_file_request,
             protocol.RequestCode.REQUEST_VALID_CRC.value: self.handle_crc_and_finish,
             protocol.RequestCode.REQUEST_INVALID_CRC_RETRY.value: self.handle_invalid_crc_request,
-            protocol.RequestCode.REQUEST_INVALID_CRC_FINISH.value: self.handle_crc_and_finish
+            protocol.RequestCode.REQUEST_INVALID_CRC_FINISH.value: self.handle_crc_and_finish,
+            protocol.RequestCode.REQUEST_UPLOAD_BEGIN.value: self.handle_upload_begin_request,
+            protocol.RequestCode.REQUEST_UPLOAD_CHUNK.value: self.handle_upload_chunk_request,
+            protocol.RequestCode.REQUEST_UPLOAD_COMMIT.value: self.handle_upload_commit_request,
+            protocol.RequestCode.REQUEST_UPLOAD_BEGIN_CIPHER.value: self.handle_upload_begin_cipher_request,
+            protocol.RequestCode.REQUEST_RESUMPTION_TICKET.value: self.handle_resumption_ticket_request,
+            protocol.RequestCode.REQUEST_RESUME.value: self.handle_resume_request,
+            protocol.RequestCode.REQUEST_UPLOAD_VERIFY.value: self.handle_upload_verify_request,
+            protocol.RequestCode.REQUEST_UPLOAD_REPAIR_CHUNK.value: self.handle_upload_repair_chunk_request,
+            protocol.RequestCode.REQUEST_UPLOAD_PRECHECK.value: self.handle_upload_precheck_request,
+            protocol.RequestCode.REQUEST_UPLOAD_SIGNATURES.value: self.handle_upload_signatures_request,
+            protocol.RequestCode.REQUEST_UPLOAD_DELTA.value: self.handle_upload_delta_request,
+            protocol.RequestCode.REQUEST_UPLOAD_BEGIN_CODEC.value: self.handle_upload_begin_codec_request,
+            protocol.RequestCode.REQUEST_UPLOAD_NUMBERED_CHUNK.value: self.handle_upload_numbered_chunk_request,
+            protocol.RequestCode.REQUEST_UPLOAD_NUMBERED_REPAIR_CHUNK.value: self.handle_upload_numbered_repair_chunk_request,
+            protocol.RequestCode.REQUEST_UPLOAD_NUMBERED_DELTA.value: self.handle_upload_numbered_delta_request
         }
 
     def start(self):
@@ -50,39 +109,95 @@ class Server:
             self.selector.register(sock, selectors.EVENT_READ, self.accept)
         except Exception as err:
             return False
-        print(f"Server start listening on port {self.port}..")
+        logger.info(f"Server start listening on port {self.port}..")
         while True:
             try:
-                events = self.selector.select()
+                events = self.selector.select(timeout=Server.SELECT_TIMEOUT)
                 for key, mask in events:
                     callback = key.data
                     callback(key.fileobj, mask)
+                self.close_idle_sessions()
             except Exception as e:
-                print(f"Server main loop exception: {e}")
+                logger.error(f"Server main loop exception: {e}")
 
     def accept(self, sock, mask):
         """ accept new connection """
         conn, address = sock.accept()
-        print(f"Accepted new connection from {address}")
+        logger.info(f"Accepted new connection from {address}")
         conn.setblocking(self.isBlocking)
+        self.sessions[conn] = Session()
         self.selector.register(conn, selectors.EVENT_READ, self.read)
 
-    def read(self, conn, mask):
-        """ read data from client and parse it"""
-        data = conn.recv(Server.PACKET_SIZE)
-        if data:
-            self.handle_data(conn, data)
-        else:
-            print("Receive empty data")
-        # Closing connection in the end because it's stateless server
+    def close(self, conn):
+        """ unregister connection and close it """
+        self.sessions.pop(conn, None)
         self.selector.unregister(conn)
         conn.close()
 
+    def close_idle_sessions(self):
+        """ close kept alive connections that idle more than SESSION_IDLE_TIMEOUT """
+        now = time.monotonic()
+        for conn, session in list(self.sessions.items()):
+            if now - session.lastActive > Server.SESSION_IDLE_TIMEOUT:
+                logger.info(f"Session idle for more than {Server.SESSION_IDLE_TIMEOUT} seconds, closing connection")
+                self.close(conn)
+
+    def read(self, conn, mask):
+        """ read data from client and parse every complete request in it """
+        session = self.sessions[conn]
+        try:
+            data = conn.recv(Server.RECV_SIZE)
+        except BlockingIOError:
+            return
+        except OSError:
+            data = b""
+        if not data:
+            logger.info("Connection closed by client")
+            self.close(conn)
+            return
+
+        session.buffer += data
+        session.lastActive = time.monotonic()
+        try:
+            request = self.pop_request(session)
+            while request is not None:
+                self.handle_data(conn, request)
+                # Closing connection after the request unless the client asked for a session
+                if not session.keepAlive:
+                    self.close(conn)
+                    return
+                request = self.pop_request(session)
+        except ValueError as err:
+            logger.warning(f"Request rejected, closing connection: {err}")
+            self.close(conn)
+
+    @staticmethod
+    def pop_request(session):
+        """ cut the next request from the session buffer, None if not fully received, raise ValueError if it's too large.
+            requests of an older client are padded to whole packets, later versions are exactly header and payload """
+        request_header = protocol.RequestHeader()
+        if len(session.buffer) < request_header.SIZE or not request_header.unpack(session.buffer):
+            return None
+        # checked once the header arrives, so a claimed size never makes the buffer grow beyond one request
+        max_payload_size = Server.MAX_CONTENT_PAYLOAD_SIZE if request_header.code in Server.CONTENT_REQUESTS else Server.MAX_PAYLOAD_SIZE
+        if request_header.payloadSize > max_payload_size:
+            raise ValueError(f"payload of {request_header.payloadSize} bytes exceeds {max_payload_size} bytes of request {request_header.code}")
+        framed_size = request_header.SIZE + request_header.payloadSize
+        if request_header.version <= protocol.PADDED_VERSION:
+            framed_size = -(-framed_size // Server.PACKET_SIZE) * Server.PACKET_SIZE
+        if len(session.buffer) < framed_size:
+            return None
+        request = bytes(session.buffer[:framed_size])
+        del session.buffer[:framed_size]
+        session.keepAlive = request_header.keepAlive
+        session.version = min(request_header.version, protocol.SERVER_VERSION)
+        return request
+
     def handle_data(self, conn, data):
         request_header = protocol.RequestHeader()
         success = False
         if not request_header.unpack(data):
-            print("Failed to parse request header!")
+            logger.warning("Failed to parse request header!")
         else:
             if request_header.code in self.requestHandlers.keys():
                 success = self.requestHandlers[request_header.code](conn, data)  # invoke corresponding handle.
@@ -93,43 +208,41 @@ class Server:
             self.database.update_last_seen(request_header.clientID)
 
     def write(self, conn, data):
-        """ Send a response to client"""
-        size = len(data)
-        sent = 0
-        while sent < size:
-            leftover = size - sent
-            if leftover > Server.PACKET_SIZE:
-                leftover = Server.PACKET_SIZE
-            to_send = data[sent:sent + leftover]
-            if len(to_send) < Server.PACKET_SIZE:
-                to_send += bytearray(Server.PACKET_SIZE - len(to_send))
-            try:
-                conn.send(to_send)
-                sent += len(to_send)
-            except:
-                print("Failed to send response to " + conn)
-                return False
-        print("Response sent successfully.")
+        """ Send a response to client in the version of its request, padded to whole packets only for an older client """
+        session = self.sessions.get(conn)
+        version = protocol.SERVER_VERSION if session is None else session.version
+        if data:
+            if session is not None and session.keepAlive:
+                version |= protocol.VERSION_FLAG_KEEP_ALIVE  # confirm the session to the client
+            data = bytes([version]) + data[1:]
+        if (version & protocol.VERSION_MASK) <= protocol.PADDED_VERSION and len(data) % Server.PACKET_SIZE:
+            data += bytearray(Server.PACKET_SIZE - len(data) % Server.PACKET_SIZE)
+        try:
+            conn.sendall(data)
+        except Exception as e:
+            logger.error("Failed to send response to %s: %s", conn, e)
+            return False
+        logger.debug("Response sent successfully.")
         return True
 
     def try_to_register(self, data):
         request = protocol.RegistrationRequest()
         if not request.unpack(data):
-            print("Failed to parse Registration Request")
+            logger.warning("Failed to parse Registration Request")
             return None
         try:
             if self.database.is_client_name_exists(request.name):
-                print(f"User name '{request.name}' already exists in {Server.DATABASE}")
+                logger.info(f"User name '{request.name}' already exists in {Server.DATABASE}")
                 return None
         except:
-            print(f"Failed connect to {Server.DATABASE}")
+            logger.error(f"Failed connect to {Server.DATABASE}")
             return None
 
         client = Client(uuid.uuid4().hex, request.name, "", str(datetime.now()), "")
         if not self.database.insert_new_client(client):
-            print(f"Failed to insert client '{request.name}'")
+            logger.error(f"Failed to insert client '{request.name}'")
             return None
-        print(f"Successfully registered client '{request.name}'")
+        logger.info(f"Successfully registered client '{request.name}'")
         return client
 
     def handle_registration_request(self, conn, data):
@@ -146,10 +259,10 @@ class Server:
     def create_and_send_aes(self, conn, client_id, pub_key, reconnect):
         # create aes key and save it in the db
         aes_key = get_random_bytes(protocol.AES_KEY_SIZE)
-        print(f"aes key: {b64encode(aes_key).decode('utf-8')}")
+        logger.debug("aes key: %s", Dump(aes_key))
 
         if self.database.update_aes_key(client_id, aes_key) is False:
-            print("Failed to update db with the new aes")
+            logger.error("Failed to update db with the new aes")
 
         # encrypt aes key with the public key
         rsa_public_key = RSA.import_key(pub_key)
@@ -161,60 +274,153 @@ class Server:
         response.encryptedAesKey = encrypted_aes
         response.encryptedAesKeyLen = len(response.encryptedAesKey)
         response.header.payloadSize = protocol.CLIENT_ID_SIZE + len(response.encryptedAesKey)
-        print(f"Successfully create aes response for client id ({client_id})")
+        logger.info(f"Successfully create aes response for client id ({client_id})")
         return self.write(conn, response.pack())
 
     def handle_public_key_request(self, conn, data):
         """ respond with public key of requested user id """
         request = protocol.PublicKeyRequest()
         if not request.unpack(data):
-            print("Failed to parse PublicKey Request")
+            logger.warning("Failed to parse PublicKey Request")
+        return self.store_public_key_and_send_aes(conn, request)
 
+    def handle_variable_public_key_request(self, conn, data):
+        """ same as public key request, for keys larger than 1024 bits """
+        request = protocol.VariablePublicKeyRequest()
+        if not request.unpack(data):
+            logger.warning("Failed to parse Variable PublicKey Request")
+            return False
+        return self.store_public_key_and_send_aes(conn, request)
+
+    def store_public_key_and_send_aes(self, conn, request):
         # keep public key in the db
         if self.database.update_public_key(request.header.clientID, request.publicKey) is False:
-            print("Failed to update db with the new public key")
+            logger.error("Failed to update db with the new public key")
 
         return self.create_and_send_aes(conn, request.header.clientID, request.publicKey, False)
 
     def handle_reconnect_request(self, conn, data):
         request = protocol.ReconnectRequest()
         if not request.unpack(data):
-            print("Failed to parse Reconnect Request")
+            logger.warning("Failed to parse Reconnect Request")
 
         rejected = protocol.ReconnectRejectedResponse()
         rejected.clientID = request.header.clientID
         client_for_reconnect = request.name
         exists = self.database.is_client_name_exists(client_for_reconnect)
         if exists is False:
-            print(f"Reconnect rejected, client name {client_for_reconnect} is not exists in the db")
+            logger.warning(f"Reconnect rejected, client name {client_for_reconnect} is not exists in the db")
             return self.write(conn, rejected.pack())
 
         client_id = self.database.get_client_id(client_for_reconnect)
         if client_id is None or client_id != request.header.clientID:
-            print(f"Reconnect rejected, client id {request.header.clientID} is not match to one in the db: {client_id}")
+            logger.warning(f"Reconnect rejected, client id {request.header.clientID} is not match to one in the db: {client_id}")
             return self.write(conn, rejected.pack())
 
         ras_public_key = self.database.get_client_public_key(client_id)
         if ras_public_key is None or ras_public_key == b'':
-            print(f"Reconnect rejected, client id {request.header.clientID} not contains any rsa public key")
+            logger.warning(f"Reconnect rejected, client id {request.header.clientID} not contains any rsa public key")
             return self.write(conn, rejected.pack())
 
         return self.create_and_send_aes(conn, client_id, ras_public_key, True)
 
+    @staticmethod
+    def load_ticket_key():
+        """ read the ticket key, create it on the first run """
+        try:
+            with open(Server.TICKET_KEY_FILE, 'rb') as key_file:
+                key = key_file.read()
+            if len(key) == 32:
+                return key
+        except FileNotFoundError:
+            pass
+        key = get_random_bytes(32)
+        with open(Server.TICKET_KEY_FILE, 'wb') as key_file:
+            key_file.write(key)
+        return key
+
+    def seal_ticket(self, client_id, aes_key):
+        """ return ticket of the session key bound to the client id, only this server can open it """
+        nonce = get_random_bytes(12)
+        expiry = int(time.time()) + Server.TICKET_LIFETIME
+        cipher = AES.new(self.ticketKey, AES.MODE_GCM, nonce=nonce)
+        sealed, tag = cipher.encrypt_and_digest(client_id + struct.pack("<Q", expiry) + aes_key)
+        return nonce + sealed + tag
+
+    def open_ticket(self, client_id, ticket):
+        """ return session key of a valid ticket of client id, None if it is forged, expired or of another client """
+        try:
+            cipher = AES.new(self.ticketKey, AES.MODE_GCM, nonce=ticket[:12])
+            plain = cipher.decrypt_and_verify(ticket[12:-16], ticket[-16:])
+        except ValueError:
+            return None
+        ticket_client_id = plain[:protocol.CLIENT_ID_SIZE]
+        expiry = struct.unpack("<Q", plain[protocol.CLIENT_ID_SIZE:protocol.CLIENT_ID_SIZE + 8])[0]
+        if ticket_client_id != client_id or expiry < time.time():
+            return None
+        return plain[protocol.CLIENT_ID_SIZE + 8:]
+
+    def handle_resumption_ticket_request(self, conn, data):
+        """ respond with ticket of the current session key, the client resumes with it instead of RSA """
+        request = protocol.RequestHeader()
+        if not request.unpack(data):
+            logger.warning("Failed to parse Resumption Ticket Request")
+            return False
+
+        aes_key = self.database.get_client_aes(request.clientID)
+        if not aes_key:
+            logger.warning(f"Ticket rejected, client id {request.clientID} has no session key")
+            return False
+
+        response = protocol.ResumptionTicketResponse()
+        response.clientID = request.clientID
+        response.lifetime = Server.TICKET_LIFETIME
+        response.ticket = self.seal_ticket(request.clientID, aes_key)
+        return self.write(conn, response.pack())
+
+    def handle_resume_request(self, conn, data):
+        """ reconnect with a ticket, derive the new session key from the one in the ticket without any RSA """
+        request = protocol.ResumeRequest()
+        if not request.unpack(data):
+            logger.warning("Failed to parse Resume Request")
+            return False
+
+        client_id = request.header.clientID
+        ticket_key = self.open_ticket(client_id, request.ticket)
+        if ticket_key is None:
+            logger.warning(f"Resume rejected, invalid ticket of client id {client_id}")
+            rejected = protocol.ReconnectRejectedResponse()
+            rejected.clientID = client_id
+            return self.write(conn, rejected.pack())
+
+        server_nonce = get_random_bytes(protocol.RESUME_NONCE_SIZE)
+        aes_key = HKDF(ticket_key, protocol.AES_KEY_SIZE, request.clientNonce + server_nonce, SHA256,
+                       context=Server.RESUME_KEY_INFO)
+        if self.database.update_aes_key(client_id, aes_key) is False:
+            logger.error("Failed to update db with the resumed aes")
+            return False
+
+        response = protocol.ResumeAllowedResponse()
+        response.clientID = client_id
+        response.serverNonce = server_nonce
+        response.lifetime = Server.TICKET_LIFETIME
+        response.ticket = self.seal_ticket(client_id, aes_key)
+        logger.info(f"Client id ({client_id}) resumed its session")
+        return self.write(conn, response.pack())
+
     def handle_send_file_request(self, conn, data):
         request = protocol.SendFileRequest()
         if not request.unpack(data):
-            print("Failed to parse Reconnect Request")
+            logger.warning("Failed to parse Reconnect Request")
 
-        print("encrypted content size: ", len(request.fileContent))
-        print("encrypted content: ", b64encode(request.fileContent).decode('utf-8'))
-        print("encrypted content: ", request.fileContent)
+        logger.info("encrypted content size: %d", len(request.fileContent))
+        logger.debug("encrypted content: %s", Dump(request.fileContent))
 
         decrypted_content = None
         try:
             # get client aes key
             aes_key = self.database.get_client_aes(request.header.clientID)
-            print(f"aes len: {len(aes_key)}, aes key: {b64encode(aes_key).decode('utf-8')}")
+            logger.debug("aes len: %d, aes key: %s", len(aes_key), Dump(aes_key))
 
             # create aes cipher from the key
             cipher = AES.new(aes_key, AES.MODE_CBC,  bytes(16))
@@ -222,12 +428,12 @@ class Server:
             # decrypt content
             decrypted_content = cipher.decrypt(request.fileContent)
         except:
-            print("Failed to create AES key, return global error")
+            logger.error("Failed to create AES key, return global error")
             self.send_global_error(conn)
             return False
 
-        print("decrypted_content size: ", len(decrypted_content))
-        print("decrypted_content: ", b64encode(decrypted_content).decode('utf-8'))
+        logger.info("decrypted_content size: %d", len(decrypted_content))
+        logger.debug("decrypted_content: %s", Dump(decrypted_content))
 
         # store file in db
         file_full_path = str(request.fileName)
@@ -236,11 +442,11 @@ class Server:
         file_name = head_tail[1]
         new_file = File(request.header.clientID, file_name, file_dir_path, False)
         self.database.insert_new_file(new_file)
-        print(f"Store file {str(request.fileName)}")
+        logger.info(f"Store file {str(request.fileName)}")
 
         # calculate crc from the content
         crc = zlib.crc32(decrypted_content)
-        print("file crc: ", crc)
+        logger.info("file crc: %d", crc)
 
         response = protocol.ValidCrcResponse()
         response.clientID = request.header.clientID
@@ -248,7 +454,7 @@ class Server:
         response.fileName = request.fileName
         response.crc = crc
         response.header.payloadSize = protocol.CLIENT_ID_SIZE + protocol.NAME_SIZE + 8
-        print(f"Successfully send valid crc response")
+        logger.info(f"Successfully send valid crc response")
         return self.write(conn, response.pack())
 
     """
@@ -258,7 +464,7 @@ class Server:
     def handle_crc_and_finish(self, conn, data):
         request = protocol.CrcStatusRequest()
         if not request.unpack(data):
-            print(f"Failed to parse CRC Request code: {request.header.code}")
+            logger.warning(f"Failed to parse CRC Request code: {request.header.code}")
 
         # check if the status code is of valid or invalid crc and update verified bit
         verified = False
@@ -267,24 +473,506 @@ class Server:
 
         # update file verified status to false
         if self.database.update_file_verified(request.fileName, False) is False:
-            print(f"Failed to update {request.fileName} verified bit, maybe file not exists")
+            logger.error(f"Failed to update {request.fileName} verified bit, maybe file not exists")
 
         response = protocol.MsgRecvResponse()
         response.clientID = request.header.clientID
         response.header.payloadSize = protocol.CLIENT_ID_SIZE
-        print(f"Finish Communication with client id: {request.header.clientID}")
+        logger.info(f"Finish Communication with client id: {request.header.clientID}")
         return self.write(conn, response.pack())
 
     def handle_invalid_crc_request(self, conn, data):
         request = protocol.CrcStatusRequest()
         if not request.unpack(data):
-            print(f"Failed to parse invalid CRC Request code: {request.header.code}")
+            logger.warning(f"Failed to parse invalid CRC Request code: {request.header.code}")
 
         # update file verified status to false
         if self.database.update_file_verified(request.fileName, False) is False:
-            print(f"Failed to update {request.fileName} verified bit, maybe file not exists")
+            logger.error(f"Failed to update {request.fileName} verified bit, maybe file not exists")
         return True
 
+    @staticmethod
+    def upload_paths(client_id, file_name):
+        """ return local paths of the received part and of the completed file, None if file name is not valid """
+        name = file_name.partition(b'\0')[0].decode('utf-8', errors='replace').replace('\\', '/')
+        base_name = os.path.basename(name)
+        if base_name in ('', '.', '..'):
+            return None, None
+        client_dir = os.path.join(Server.UPLOADS_DIR, client_id.hex())
+        os.makedirs(client_dir, exist_ok=True)
+        final_path = os.path.join(client_dir, base_name)
+        return final_path + '.part', final_path
+
+    def handle_upload_begin_request(self, conn, data):
+        """ start a chunked upload or resume the one of the same file, respond with the bytes already received """
+        request = protocol.UploadBeginRequest()
+        if not request.unpack(data):
+            logger.warning("Failed to parse Upload Begin Request")
+            return False
+        return self.begin_upload(conn, request, protocol.CipherMode.CIPHER_AES_CBC.value, None)
+
+    def handle_upload_begin_cipher_request(self, conn, data):
+        """ same as upload begin, the chunks that follow are encrypted with the requested cipher """
+        request = protocol.UploadBeginCipherRequest()
+        if not request.unpack(data):
+            logger.warning("Failed to parse Upload Begin Cipher Request")
+            return False
+        if request.cipherMode not in [mode.value for mode in protocol.CipherMode]:
+            logger.warning(f"Upload rejected, unknown cipher mode {request.cipherMode}")
+            return False
+        return self.begin_upload(conn, request, request.cipherMode, request.nonce)
+
+    def handle_upload_begin_codec_request(self, conn, data):
+        """ same as upload begin cipher, the chunks that follow may also be numbered chunks, compressed with the requested codec """
+        request = protocol.UploadBeginCodecRequest()
+        if not request.unpack(data):
+            logger.warning("Failed to parse Upload Begin Codec Request")
+            return False
+        if request.cipherMode not in [mode.value for mode in protocol.CipherMode]:
+            logger.warning(f"Upload rejected, unknown cipher mode {request.cipherMode}")
+            return False
+        if request.codec not in [codec.value for codec in protocol.Codec]:
+            logger.warning(f"Upload rejected, unknown codec {request.codec}")
+            return False
+        return self.begin_upload(conn, request, request.cipherMode, request.nonce, request.codec)
+
+    def begin_upload(self, conn, request, cipher_mode, nonce, codec=protocol.Codec.CODEC_NONE.value):
+        """ start or resume upload, the received part is plain so a resumed upload may switch the cipher and codec """
+        client_id = request.header.clientID
+        part_path, _ = self.upload_paths(client_id, request.fileName)
+        if part_path is None:
+            logger.warning(f"Upload rejected, invalid file name {request.fileName}")
+            return False
+
+        upload = self.database.get_upload(client_id, request.fileName)
+        if upload is None or upload.FileSize != request.fileSize or not os.path.exists(upload.PartPath):
+            open(part_path, 'wb').close()
+            upload = Upload(client_id, request.fileName, request.fileSize, part_path, cipher_mode, nonce, codec)
+            if not self.database.upsert_upload(upload):
+                logger.error("Failed to update db with the new upload")
+                return False
+        elif upload.CipherMode != cipher_mode or upload.Nonce != nonce or upload.Codec != codec:
+            upload.CipherMode = cipher_mode
+            upload.Nonce = nonce
+            upload.Codec = codec
+            if not self.database.update_upload_cipher(upload):
+                logger.error("Failed to update db with the upload cipher")
+                return False
+
+        response = protocol.UploadStateResponse()
+        response.clientID = client_id
+        response.offset = os.path.getsize(upload.PartPath)
+        logger.info(f"Upload of {upload.FileSize} bytes continues from offset {response.offset}")
+        return self.write(conn, response.pack())
+
+    @staticmethod
+    def decrypt_segment(aes_key, nonce, segment):
+        """ decrypt and verify one segment of CIPHER_AES_GCM_SEGMENTS, nonce is the file nonce xor the segment index """
+        content, tag = segment
+        cipher = AES.new(aes_key, AES.MODE_GCM, nonce=nonce)
+        return cipher.decrypt_and_verify(content, tag)
+
+    def decrypt_chunk(self, upload, aes_key, offset, content, send=0):
+        """ decrypt chunk of upload that starts at plain offset, raise if it fails.
+            The segment nonces of a numbered chunk have the first 4 bytes of the file nonce xor its send """
+        if upload.CipherMode == protocol.CipherMode.CIPHER_AES_CBC.value:
+            cipher = AES.new(aes_key, AES.MODE_CBC, bytes(16))
+            return unpad(cipher.decrypt(content), AES.block_size)
+
+        if offset % protocol.CIPHER_SEGMENT_SIZE != 0:
+            raise ValueError("Chunk doesn't start at a segment")
+        wire_segment_size = protocol.CIPHER_SEGMENT_SIZE + protocol.CIPHER_TAG_SIZE
+        first = offset // protocol.CIPHER_SEGMENT_SIZE
+        nonce_prefix = (int.from_bytes(upload.Nonce[:protocol.CIPHER_NONCE_SIZE - 8], 'big') ^ send).to_bytes(protocol.CIPHER_NONCE_SIZE - 8, 'big')
+        nonce_index = int.from_bytes(upload.Nonce[protocol.CIPHER_NONCE_SIZE - 8:], 'big')
+        nonces, segments = [], []
+        for start in range(0, len(content), wire_segment_size):
+            segment = content[start:start + wire_segment_size]
+            if len(segment) <= protocol.CIPHER_TAG_SIZE:
+                raise ValueError("Segment is shorter than its tag")
+            index = first + len(segments)
+            nonces.append(nonce_prefix + (nonce_index ^ index).to_bytes(8, 'big'))
+            segments.append((segment[:-protocol.CIPHER_TAG_SIZE], segment[-protocol.CIPHER_TAG_SIZE:]))
+        return b''.join(self.decryptPool.map(self.decrypt_segment, [aes_key] * len(segments), nonces, segments))
+
+    @staticmethod
+    def decompress_chunk(upload, offset, content):
+        """ decompress decrypted chunk of upload that starts at plain offset, raise if it isn't a whole chunk of the upload codec """
+        if upload.Codec != protocol.Codec.CODEC_ZLIB.value:
+            raise ValueError(f"Compressed chunk of an upload with codec {upload.Codec}")
+        limit = min(protocol.UPLOAD_CHUNK_SIZE, upload.FileSize - offset)  # bounds the memory of a malicious chunk
+        if limit <= 0:
+            raise ValueError("Compressed chunk after the end of the file")
+        decompressor = zlib.decompressobj()
+        chunk = decompressor.decompress(content, limit)
+        if not decompressor.eof or decompressor.unconsumed_tail:
+            raise ValueError("Compressed chunk is truncated or larger than a chunk")
+        return chunk
+
+    def handle_upload_chunk_request(self, conn, data):
+        """ decrypt chunk and append it to the received part """
+        request = protocol.UploadChunkRequest()
+        if not request.unpack(data):
+            logger.warning("Failed to parse Upload Chunk Request")
+            return False
+        return self.append_upload_chunk(conn, request)
+
+    @staticmethod
+    def unpack_numbered_chunk(data, name):
+        """ numbered chunk request of data, None if it doesn't parse or its send or codec isn't valid """
+        request = protocol.UploadNumberedChunkRequest()
+        if not request.unpack(data):
+            logger.warning(f"Failed to parse {name}")
+            return None
+        if request.send == 0:
+            logger.warning(f"{name} rejected, send 0 is of the unnumbered chunks")
+            return None
+        if request.codec not in [codec.value for codec in protocol.Codec]:
+            logger.warning(f"{name} rejected, unknown codec {request.codec}")
+            return None
+        return request
+
+    def handle_upload_numbered_chunk_request(self, conn, data):
+        """ decrypt chunk under the nonces of its send, decompress it if it is compressed and append it to the received part """
+        request = self.unpack_numbered_chunk(data, "Upload Numbered Chunk Request")
+        if request is None:
+            return False
+        return self.append_upload_chunk(conn, request, request.send, request.codec)
+
+    def append_upload_chunk(self, conn, request, send=0, codec=protocol.Codec.CODEC_NONE.value):
+        """ append chunk of send to the received part, decompressed if it is of a codec. chunks that not start at the received size are ignored """
+        client_id = request.header.clientID
+        upload = self.database.get_upload(client_id, request.fileName)
+        if upload is None:
+            logger.warning("Upload chunk rejected, upload not begun")
+            return False
+
+        received = os.path.getsize(upload.PartPath)
+        if request.offset == received:
+            try:
+                aes_key = self.database.get_client_aes(client_id)
+                chunk = self.decrypt_chunk(upload, aes_key, request.offset, request.content, send)
+                if codec != protocol.Codec.CODEC_NONE.value:
+                    chunk = self.decompress_chunk(upload, request.offset, chunk)
+            except Exception as err:
+                logger.error(f"Failed to decrypt upload chunk: {err}")
+                return False
+            if received + len(chunk) > upload.FileSize:
+                logger.warning("Upload chunk rejected, chunk exceeds the file size")
+                return False
+            with open(upload.PartPath, 'ab') as part:
+                part.write(chunk)
+            logger.debug(f"Chunk at offset {request.offset}: {len(request.content)} bytes made {len(chunk)} bytes")
+            received += len(chunk)
+        else:
+            logger.warning(f"Upload chunk at offset {request.offset} ignored, expected offset {received}")
+
+        response = protocol.UploadStateResponse()
+        response.clientID = client_id
+        response.offset = received
+        return self.write(conn, response.pack())
+
+    @staticmethod
+    def delta_block_size(file_size):
+        """ about the square root of the file size like rsync, so both the signatures and the literals of a change stay small,
+            but never so small that the signatures of the file exceed one response """
+        block = max(math.isqrt(file_size), -(-file_size // Server.DELTA_MAX_SIGNATURES))
+        return max(-(-block // 1024) * 1024, Server.DELTA_MIN_BLOCK_SIZE)
+
+    def handle_upload_signatures_request(self, conn, data):
+        """ respond with the block signatures of the stored version of the file, none if there isn't one """
+        request = protocol.UploadCommitRequest()  # same payload, the file name
+        if not request.unpack(data):
+            logger.warning("Failed to parse Upload Signatures Request")
+            return False
+
+        client_id = request.header.clientID
+        _, final_path = self.upload_paths(client_id, request.fileName)
+        if final_path is None:
+            logger.warning(f"Upload signatures rejected, invalid file name {request.fileName}")
+            return False
+
+        response = protocol.UploadSignaturesResponse()
+        response.clientID = client_id
+        if os.path.isfile(final_path):
+            response.baseSize = os.path.getsize(final_path)
+            response.blockSize = self.delta_block_size(response.baseSize)
+            if response.blockSize > 0xFFFFFFFF:  # the block size field is 4 bytes
+                logger.warning(f"Stored {final_path} is too large for signatures, uploading without a delta")
+                response.blockSize = 0
+            else:
+                with open(final_path, 'rb') as stored:
+                    response.signatures = [(zlib.adler32(block), hashlib.sha256(block).digest()[:protocol.STRONG_SIGNATURE_SIZE])
+                                           for block in iter(lambda: stored.read(response.blockSize), b'')]
+            if len(response.signatures) > self.DELTA_MAX_SIGNATURES:  # grew while read, would be rejected by the client
+                logger.warning(f"Signatures of {final_path} exceed a response, uploading without a delta")
+                response.signatures = []
+        logger.debug(f"Signatures of {final_path}: {len(response.signatures)} blocks of {response.blockSize} bytes")
+        return self.write(conn, response.pack())
+
+    @staticmethod
+    def apply_delta(delta, stored, stored_size, block_size, part, budget):
+        """ append the file the delta instructions make from the stored version to part, return the bytes appended.
+            An instruction that would append more than budget bytes in total raises before it writes """
+        written = 0
+        offset = 0
+        while offset < len(delta):
+            op = delta[offset]
+            if op == protocol.DeltaOp.DELTA_COPY.value:
+                first, count = struct.unpack_from("<LL", delta, offset + 1)
+                offset += 9
+                start = first * block_size
+                if count == 0 or start >= stored_size:
+                    raise ValueError(f"Copy of blocks {first}-{first + count} out of the stored version")
+                length = min(count * block_size, stored_size - start)
+                if written + length > budget:
+                    raise ValueError("Delta exceeds the file size")
+                stored.seek(start)
+                for position in range(0, length, Server.CRC_READ_SIZE):
+                    part.write(stored.read(min(Server.CRC_READ_SIZE, length - position)))
+            elif op == protocol.DeltaOp.DELTA_LITERAL.value:
+                length = struct.unpack_from("<L", delta, offset + 1)[0]
+                offset += 5
+                if offset + length > len(delta):
+                    raise ValueError("Literal exceeds the delta")
+                if written + length > budget:
+                    raise ValueError("Delta exceeds the file size")
+                part.write(delta[offset:offset + length])
+                offset += length
+            else:
+                raise ValueError(f"Unknown delta instruction {op}")
+            written += length
+        return written
+
+    def handle_upload_delta_request(self, conn, data):
+        """ make the next bytes of the upload from the stored version and the literals of the delta, like a chunk that starts at the received size """
+        request = protocol.UploadChunkRequest()  # same payload as upload chunk
+        if not request.unpack(data):
+            logger.warning("Failed to parse Upload Delta Request")
+            return False
+        return self.apply_upload_delta(conn, request)
+
+    def handle_upload_numbered_delta_request(self, conn, data):
+        """ delta of a numbered upload, encrypted with the upload cipher under the nonces of its send and its segments counted from 0 """
+        request = self.unpack_numbered_chunk(data, "Upload Numbered Delta Request")
+        if request is None:
+            return False
+        if request.codec != protocol.Codec.CODEC_NONE.value:
+            logger.warning(f"Upload numbered delta rejected, codec {request.codec} of delta instructions")
+            return False
+        return self.apply_upload_delta(conn, request, request.send)
+
+    def apply_upload_delta(self, conn, request, send=0):
+        """ apply delta of send to the received part. send 0 is a delta in CBC whatever the upload cipher """
+        client_id = request.header.clientID
+        upload = self.database.get_upload(client_id, request.fileName)
+        _, final_path = self.upload_paths(client_id, request.fileName)
+        if upload is None or not os.path.isfile(final_path):
+            logger.warning("Upload delta rejected, upload not begun or no stored version")
+            return False
+
+        received = os.path.getsize(upload.PartPath)
+        if request.offset == received:
+            try:
+                aes_key = self.database.get_client_aes(client_id)
+                if send == 0:
+                    cipher = AES.new(aes_key, AES.MODE_CBC, bytes(16))
+                    delta = unpad(cipher.decrypt(request.content), AES.block_size)
+                else:
+                    delta = self.decrypt_chunk(upload, aes_key, 0, request.content, send)
+                stored_size = os.path.getsize(final_path)
+                with open(final_path, 'rb') as stored, open(upload.PartPath, 'ab') as part:
+                    written = self.apply_delta(delta, stored, stored_size, self.delta_block_size(stored_size), part, upload.FileSize - received)
+            except Exception as err:
+                logger.error(f"Failed to apply upload delta: {err}")
+                os.truncate(upload.PartPath, received)
+                return False
+            logger.debug(f"Delta of {len(delta)} bytes made {written} bytes of {upload.PartPath}")
+            received += written
+        else:
+            logger.warning(f"Upload delta at offset {request.offset} ignored, expected offset {received}")
+
+        response = protocol.UploadStateResponse()
+        response.clientID = client_id
+        response.offset = received
+        return self.write(conn, response.pack())
+
+    def handle_upload_verify_request(self, conn, data):
+        """ respond with the crc of every chunk of an upload that received all its bytes, the client resends the damaged ones """
+        request = protocol.UploadCommitRequest()  # same payload, the file name
+        if not request.unpack(data):
+            logger.warning("Failed to parse Upload Verify Request")
+            return False
+
+        client_id = request.header.clientID
+        upload = self.database.get_upload(client_id, request.fileName)
+        if upload is None or os.path.getsize(upload.PartPath) != upload.FileSize:
+            logger.warning("Upload verify rejected, upload not completed")
+            return False
+
+        response = protocol.UploadChunkCrcsResponse()
+        response.clientID = client_id
+        with open(upload.PartPath, 'rb') as part:
+            response.crcs = [zlib.crc32(chunk) for chunk in iter(lambda: part.read(protocol.UPLOAD_CHUNK_SIZE), b'')]
+        logger.debug(f"Upload of {upload.FileSize} bytes verified in {len(response.crcs)} chunks")
+        return self.write(conn, response.pack())
+
+    def handle_upload_repair_chunk_request(self, conn, data):
+        """ decrypt chunk and write it over the received chunk at its offset """
+        request = protocol.UploadChunkRequest()  # same payload as upload chunk
+        if not request.unpack(data):
+            logger.warning("Failed to parse Upload Repair Chunk Request")
+            return False
+        return self.repair_upload_chunk(conn, request)
+
+    def handle_upload_numbered_repair_chunk_request(self, conn, data):
+        """ decrypt chunk under the nonces of its send and write it over the received chunk at its offset """
+        request = self.unpack_numbered_chunk(data, "Upload Numbered Repair Chunk Request")
+        if request is None:
+            return False
+        return self.repair_upload_chunk(conn, request, request.send, request.codec)
+
+    def repair_upload_chunk(self, conn, request, send=0, codec=protocol.Codec.CODEC_NONE.value):
+        """ write chunk of send over the received chunk at its offset, decompressed if it is of a codec. only whole chunks of the received part are replaced """
+        client_id = request.header.clientID
+        upload = self.database.get_upload(client_id, request.fileName)
+        if upload is None:
+            logger.warning("Upload repair rejected, upload not begun")
+            return False
+
+        received = os.path.getsize(upload.PartPath)
+        if request.offset % protocol.UPLOAD_CHUNK_SIZE != 0 or request.offset >= received:
+            logger.warning(f"Upload repair rejected, offset {request.offset} is not of a received chunk")
+            return False
+        try:
+            aes_key = self.database.get_client_aes(client_id)
+            chunk = self.decrypt_chunk(upload, aes_key, request.offset, request.content, send)
+            if codec != protocol.Codec.CODEC_NONE.value:
+                chunk = self.decompress_chunk(upload, request.offset, chunk)
+        except Exception as err:
+            logger.error(f"Failed to decrypt upload repair chunk: {err}")
+            return False
+        if len(chunk) != min(protocol.UPLOAD_CHUNK_SIZE, received - request.offset):
+            logger.warning(f"Upload repair rejected, chunk of {len(chunk)} bytes doesn't replace a whole chunk")
+            return False
+        with open(upload.PartPath, 'r+b') as part:
+            part.seek(request.offset)
+            part.write(chunk)
+        logger.info(f"Repaired chunk at offset {request.offset} of upload {upload.PartPath}")
+
+        response = protocol.UploadStateResponse()
+        response.clientID = client_id
+        response.offset = received
+        return self.write(conn, response.pack())
+
+    def handle_upload_commit_request(self, conn, data):
+        """ complete upload that received all its bytes, store it and respond with its crc """
+        request = protocol.UploadCommitRequest()
+        if not request.unpack(data):
+            logger.warning("Failed to parse Upload Commit Request")
+            return False
+
+        client_id = request.header.clientID
+        upload = self.database.get_upload(client_id, request.fileName)
+        if upload is None or os.path.getsize(upload.PartPath) != upload.FileSize:
+            logger.warning("Upload commit rejected, upload not completed")
+            return False
+
+        crc = 0
+        digest = hashlib.sha256()
+        with open(upload.PartPath, 'rb') as part:
+            for block in iter(lambda: part.read(Server.CRC_READ_SIZE), b''):
+                crc = zlib.crc32(block, crc)
+                digest.update(block)
+
+        _, final_path = self.upload_paths(client_id, request.fileName)
+        os.replace(upload.PartPath, final_path)
+        self.database.delete_upload(client_id, request.fileName)
+        self.database.index_content(client_id, digest.digest(), final_path, upload.FileSize, crc)
+
+        head_tail = os.path.split(request.fileName.partition(b'\0')[0].decode('utf-8', errors='replace'))
+        self.database.insert_new_file(File(client_id, head_tail[1], head_tail[0], False))
+        logger.info(f"Store file {final_path}, size: {upload.FileSize}, crc: {crc}")
+
+        response = protocol.UploadCrcResponse()
+        response.clientID = client_id
+        response.contentSize = upload.FileSize
+        response.fileName = request.fileName
+        response.crc = crc
+        return self.write(conn, response.pack())
+
+    def find_stored_content(self, client_id, digest, file_size):
+        """ return (path, crc) of a stored file of the client with the content digest, None if there isn't one.
+            index entries of files that were removed or changed since are dropped """
+        for path, size, crc in self.database.find_content(client_id, digest):
+            if size == file_size and os.path.isfile(path) and os.path.getsize(path) == size:
+                return path, crc
+            self.database.delete_content(client_id, path)
+        return None
+
+    @staticmethod
+    def link_content(source_path, final_path):
+        """ store the content of source_path also in final_path, a hard link shares it on disk.
+            a later upload of either name replaces its directory entry and doesn't change the other """
+        temp_path = final_path + '.link'
+        if os.path.exists(temp_path):
+            os.remove(temp_path)
+        try:
+            os.link(source_path, temp_path)
+        except OSError:
+            shutil.copyfile(source_path, temp_path)
+        os.replace(temp_path, final_path)
+
+    def handle_upload_precheck_request(self, conn, data):
+        """ store the file under its name without receiving it when the client already uploaded the same content,
+            respond with the crc of the stored content, or with message received if the content should be uploaded """
+        request = protocol.UploadPrecheckRequest()
+        if not request.unpack(data):
+            logger.warning("Failed to parse Upload Precheck Request")
+            return False
+
+        # the tag proves the request is of the client, nothing is matched for anyone who only knows its id
+        client_id = request.header.clientID
+        try:
+            aes_key = self.database.get_client_aes(client_id)
+            sealed = (request.sealed[:-protocol.CIPHER_TAG_SIZE], request.sealed[-protocol.CIPHER_TAG_SIZE:])
+            content = self.decrypt_segment(aes_key, request.nonce, sealed)
+        except Exception as err:
+            logger.warning(f"Upload precheck rejected, failed to open its content: {err}")
+            return False
+        if not request.unpack_content(content):
+            logger.warning("Failed to parse Upload Precheck content")
+            return False
+
+        _, final_path = self.upload_paths(client_id, request.fileName)
+        if final_path is None:
+            logger.warning(f"Upload precheck rejected, invalid file name {request.fileName}")
+            return False
+
+        stored = self.find_stored_content(client_id, request.digest, request.fileSize)
+        if stored is None:
+            logger.debug(f"Content of {final_path} is not stored, wait for its upload")
+            response = protocol.MsgRecvResponse()
+            response.clientID = client_id
+            response.header.payloadSize = protocol.CLIENT_ID_SIZE
+            return self.write(conn, response.pack())
+
+        stored_path, crc = stored
+        if os.path.abspath(stored_path) != os.path.abspath(final_path):
+            self.link_content(stored_path, final_path)
+            self.database.index_content(client_id, request.digest, final_path, request.fileSize, crc)
+
+        head_tail = os.path.split(request.fileName.partition(b'\0')[0].decode('utf-8', errors='replace'))
+        self.database.insert_new_file(File(client_id, head_tail[1], head_tail[0], False))
+        logger.info(f"Store file {final_path} with the content of {stored_path}, size: {request.fileSize}, crc: {crc}")
+
+        response = protocol.UploadCrcResponse()
+        response.clientID = client_id
+        response.contentSize = request.fileSize
+        response.fileName = request.fileName
+        response.crc = crc
+        return self.write(conn, response.pack())
+
     def send_global_error(self, conn):
         request_header = protocol.ResponseHeader(protocol.ResponseCode.RESPONSE_GLOBAL_ERROR.value)
         self.write(conn, request_header.pack())